@@ -18,9 +18,13 @@ static std::unique_ptr<GameBoy> gb;
 // Buffer for ROM data transfer
 static std::vector<uint8_t> romBuffer;
 
+// Scanline streaming is on (it rules out threaded rendering)
+static bool scanlineStreaming = false;
+
 // Initialize emulator
 void init() {
     gb = std::make_unique<GameBoy>();
+    scanlineStreaming = false;
 }
 
 // Allocate ROM buffer and return pointer for direct memory access
@@ -43,6 +47,50 @@ void runFrame() {
     }
 }
 
+// Run part of a frame (beam racing), returns true when the frame completed
+bool runLines(int count) {
+    return gb ? gb->runLines(count) : false;
+}
+
+// Audio-paced execution: returns the number of frames completed
+int runForSamples(int count) {
+    return gb ? gb->runForSamples(count) : 0;
+}
+
+int runUntilAudioFill(int level) {
+    return gb ? gb->runUntilAudioFill(level) : 0;
+}
+
+// Fast-forward: emulate `factor` frames per runFrame at the original pitch
+void setTurbo(int factor) {
+    if (gb) {
+        gb->setTurbo(factor);
+    }
+}
+
+// Run-ahead: hide `frames` frames of input lag (0 = off)
+void setRunAhead(int frames) {
+    if (gb) {
+        gb->setRunAhead(frames);
+    }
+}
+
+// Mean cost per host frame in microseconds; resets the averages
+val getRunAheadStats() {
+    if (!gb) return val::null();
+    
+    GameBoy::RunAheadStats runAhead = gb->getRunAheadStats();
+    gb->resetRunAheadStats();
+    
+    val stats = val::object();
+    stats.set("runAhead", gb->getRunAhead());
+    stats.set("frames", runAhead.frames);
+    stats.set("frameMicros", runAhead.frameMicros);
+    stats.set("speculationMicros", runAhead.speculationMicros);
+    stats.set("snapshotMicros", runAhead.snapshotMicros);
+    return stats;
+}
+
 // Reset emulator
 void reset() {
     if (gb) {
@@ -50,6 +98,114 @@ void reset() {
     }
 }
 
+// Save states share one buffer: saveState() fills it and returns a view,
+// allocateStateBuffer() sizes it for JS to copy a state in before loading
+static std::vector<uint8_t> stateBuffer;
+
+val saveState() {
+    if (!gb) return val::null();
+    
+    stateBuffer.resize(gb->getStateSize());
+    size_t size = gb->saveState(stateBuffer.data(), stateBuffer.size());
+    return val(typed_memory_view(size, stateBuffer.data()));
+}
+
+uintptr_t allocateStateBuffer(size_t size) {
+    stateBuffer.resize(size);
+    return reinterpret_cast<uintptr_t>(stateBuffer.data());
+}
+
+bool loadStateFromBuffer(size_t size) {
+    if (!gb) return false;
+    if (stateBuffer.size() < size) return false;
+    return gb->loadState(stateBuffer.data(), size);
+}
+
+// Rewind: keep `seconds` of history within `budgetMB` megabytes (0 = off)
+void setRewind(int seconds, int budgetMB) {
+    if (gb) {
+        gb->setRewind(seconds, static_cast<size_t>(budgetMB) << 20);
+    }
+}
+
+// Step back one frame, returns false when the history is exhausted
+bool rewindFrame() {
+    return gb ? gb->rewindFrame() : false;
+}
+
+val getRewindStats() {
+    if (!gb) return val::null();
+    
+    val stats = val::object();
+    stats.set("frames", gb->getRewindFrames());
+    stats.set("memoryBytes", static_cast<double>(gb->getRewindMemoryUsage()));
+    return stats;
+}
+
+// Input movies share one buffer like save states: saveMovie() fills it
+// and returns a view, allocateMovieBuffer() sizes it for JS to copy a movie
+// in before startMoviePlayback()
+static std::vector<uint8_t> movieBuffer;
+
+bool startMovieRecording() {
+    return gb ? gb->startMovieRecording() : false;
+}
+
+void stopMovie() {
+    if (gb) {
+        gb->stopMovie();
+    }
+}
+
+val saveMovie() {
+    if (!gb) return val::null();
+    
+    movieBuffer.resize(gb->saveMovie(nullptr, 0));
+    size_t size = gb->saveMovie(movieBuffer.data(), movieBuffer.size());
+    return val(typed_memory_view(size, movieBuffer.data()));
+}
+
+uintptr_t allocateMovieBuffer(size_t size) {
+    movieBuffer.resize(size);
+    return reinterpret_cast<uintptr_t>(movieBuffer.data());
+}
+
+bool startMoviePlayback(size_t size) {
+    if (!gb) return false;
+    if (movieBuffer.size() < size) return false;
+    return gb->startMoviePlayback(movieBuffer.data(), size);
+}
+
+// Keyframe spacing for new recordings, in seconds (0 = none)
+void setMovieKeyframeInterval(int seconds) {
+    if (gb) {
+        gb->setMovieKeyframeInterval(seconds);
+    }
+}
+
+// Jump to `cycle` cycles into the movie (a double, exact up to 2^53)
+bool seekMovie(double cycle) {
+    return gb ? gb->seekMovie(cycle > 0 ? static_cast<uint64_t>(cycle) : 0) : false;
+}
+
+val getMovieStatus() {
+    if (!gb) return val::null();
+    
+    GameBoy::MovieStatus movie = gb->getMovieStatus();
+    static const char* modes[] = { "none", "recording", "playing" };
+    val status = val::object();
+    status.set("mode", modes[movie.mode]);
+    status.set("inputs", movie.inputs);
+    status.set("totalInputs", movie.totalInputs);
+    status.set("checkpoints", movie.checkpoints);
+    status.set("cycle", static_cast<double>(movie.cycle));
+    status.set("length", static_cast<double>(movie.length));
+    status.set("finished", movie.finished);
+    status.set("desynced", movie.desynced);
+    status.set("desyncCycle", static_cast<double>(movie.desyncCycle));
+    return status;
+}
+
 // Button handling
 void setButton(int button, bool pressed) {
     if (gb) {
@@ -57,6 +213,57 @@ void setButton(int button, bool pressed) {
     }
 }
 
+// Toggle end-of-frame batch rendering
+void setDeferredRendering(bool enabled) {
+    if (gb) {
+        gb->setDeferredRendering(enabled);
+    }
+}
+
+// Move rasterisation to a render thread (pthreads builds only). Refused
+// while scanlines are streamed, see setScanlineStreaming.
+bool setThreadedRendering(bool enabled) {
+    if (!gb || (enabled && scanlineStreaming)) return false;
+    return gb->setThreadedRendering(enabled);
+}
+
+// Ring of completed scanline indices for beam-racing presenters.
+// written counts lines published so far; lines[written % SIZE] is the next slot.
+static constexpr int SCANLINE_RING_SIZE = 256;
+struct ScanlineRing {
+    int32_t written;
+    int32_t lines[SCANLINE_RING_SIZE];
+};
+static ScanlineRing scanlineRing;
+
+static void onScanline(void*, int line, const uint32_t*) {
+    int32_t written = scanlineRing.written;
+    scanlineRing.lines[written & (SCANLINE_RING_SIZE - 1)] = line;
+    __atomic_store_n(&scanlineRing.written, written + 1, __ATOMIC_RELEASE);
+}
+
+// Publish completed scanlines into the ring; the lines are already in
+// getFramebuffer(). Refused (false) with threaded rendering, which draws
+// into a back buffer that getFramebuffer() only shows once the frame is
+// complete. Streaming therefore always calls back on the emulation thread,
+// which is this one, so the ring can be reset here.
+bool setScanlineStreaming(bool enabled) {
+    if (!gb || (enabled && gb->isThreadedRendering())) return false;
+    
+    gb->setScanlineCallback(enabled ? &onScanline : nullptr, nullptr);
+    scanlineRing.written = 0;
+    scanlineStreaming = enabled;
+    return true;
+}
+
+// Get scanline ring as Int32Array view ([written, lines...])
+val getScanlineRing() {
+    return val(typed_memory_view(
+        sizeof(ScanlineRing) / sizeof(int32_t),
+        reinterpret_cast<int32_t*>(&scanlineRing)
+    ));
+}
+
 // Get framebuffer as JavaScript Uint32Array view
 val getFramebuffer() {
     if (!gb) {
@@ -149,7 +356,68 @@ val getAudioBuffer() {
 
 // Get audio sample rate
 int getAudioSampleRate() {
-    return APU::SAMPLE_RATE;
+    return gb ? gb->getAPU().getSampleRate() : APU::SAMPLE_RATE;
+}
+
+// Generate audio at the host's rate (e.g. AudioContext.sampleRate)
+bool setAudioSampleRate(int rate) {
+    return gb ? gb->getAPU().setSampleRate(rate) : false;
+}
+
+// Steer the output rate so the ring stays around targetFill frames
+void setAudioRateControl(bool enabled, int targetFill) {
+    if (gb) {
+        gb->getAPU().setRateControl(enabled, targetFill);
+    }
+}
+
+// Stop/start sample generation (e.g. muted tab); emulation stays exact
+void setAudioEnabled(bool enabled) {
+    if (gb) {
+        gb->getAPU().setOutputEnabled(enabled);
+    }
+}
+
+// Mute individual channels (bit N = channel N+1 audible)
+void setAudioChannelMask(int mask) {
+    if (gb) {
+        gb->getAPU().setChannelMask(static_cast<uint8_t>(mask));
+    }
+}
+
+// Get the audio output ring as a Uint8Array view of its whole block (header
+// words followed by samples, see AudioRing). In the pthreads build the heap is
+// shared, so view.buffer/view.byteOffset can be handed to an AudioWorklet that
+// reads the ring in place. The view is invalidated by setAudioFormat.
+val getAudioRing() {
+    if (!gb) return val::null();
+    
+    AudioRing& ring = gb->getAPU().getOutputRing();
+    return val(typed_memory_view(
+        ring.sizeBytes(),
+        static_cast<uint8_t*>(ring.data())
+    ));
+}
+
+// Select the ring sample format (AUDIO_FORMAT_FLOAT32 or AUDIO_FORMAT_INT16)
+bool setAudioFormat(int format) {
+    if (!gb) return false;
+    if (format != AudioRing::FORMAT_FLOAT32 && format != AudioRing::FORMAT_INT16) return false;
+    return gb->getAPU().setOutputFormat(static_cast<AudioRing::Format>(format));
+}
+
+// Get audio ring counters for latency/glitch monitoring
+val getAudioStats() {
+    if (!gb) return val::null();
+    
+    AudioRing& ring = gb->getAPU().getOutputRing();
+    val stats = val::object();
+    stats.set("buffered", ring.readable());
+    stats.set("capacity", ring.capacity());
+    stats.set("overruns", ring.overruns());
+    stats.set("underruns", ring.underruns());
+    stats.set("rateRatio", gb->getAPU().getRateRatio());
+    return stats;
 }
 
 EMSCRIPTEN_BINDINGS(gbemu) {
@@ -157,8 +425,32 @@ EMSCRIPTEN_BINDINGS(gbemu) {
     function("allocateROMBuffer", &allocateROMBuffer);
     function("loadROMFromBuffer", &loadROMFromBuffer);
     function("runFrame", &runFrame);
+    function("runLines", &runLines);
+    function("runForSamples", &runForSamples);
+    function("runUntilAudioFill", &runUntilAudioFill);
+    function("setTurbo", &setTurbo);
+    function("setRunAhead", &setRunAhead);
+    function("getRunAheadStats", &getRunAheadStats);
     function("reset", &reset);
+    function("saveState", &saveState);
+    function("allocateStateBuffer", &allocateStateBuffer);
+    function("loadStateFromBuffer", &loadStateFromBuffer);
+    function("setRewind", &setRewind);
+    function("rewindFrame", &rewindFrame);
+    function("getRewindStats", &getRewindStats);
+    function("startMovieRecording", &startMovieRecording);
+    function("stopMovie", &stopMovie);
+    function("saveMovie", &saveMovie);
+    function("allocateMovieBuffer", &allocateMovieBuffer);
+    function("startMoviePlayback", &startMoviePlayback);
+    function("getMovieStatus", &getMovieStatus);
+    function("setMovieKeyframeInterval", &setMovieKeyframeInterval);
+    function("seekMovie", &seekMovie);
     function("setButton", &setButton);
+    function("setDeferredRendering", &setDeferredRendering);
+    function("setThreadedRendering", &setThreadedRendering);
+    function("setScanlineStreaming", &setScanlineStreaming);
+    function("getScanlineRing", &getScanlineRing);
     function("getFramebuffer", &getFramebuffer);
     function("getScreenWidth", &getScreenWidth);
     function("getScreenHeight", &getScreenHeight);
@@ -169,6 +461,13 @@ EMSCRIPTEN_BINDINGS(gbemu) {
     function("getAudioSamplesCount", &getAudioSamplesCount);
     function("getAudioBuffer", &getAudioBuffer);
     function("getAudioSampleRate", &getAudioSampleRate);
+    function("setAudioSampleRate", &setAudioSampleRate);
+    function("setAudioRateControl", &setAudioRateControl);
+    function("setAudioEnabled", &setAudioEnabled);
+    function("setAudioChannelMask", &setAudioChannelMask);
+    function("getAudioRing", &getAudioRing);
+    function("setAudioFormat", &setAudioFormat);
+    function("getAudioStats", &getAudioStats);
     
     // Button constants
     constant("BUTTON_A", static_cast<int>(GameBoy::BUTTON_A));
@@ -179,4 +478,8 @@ EMSCRIPTEN_BINDINGS(gbemu) {
     constant("BUTTON_LEFT", static_cast<int>(GameBoy::BUTTON_LEFT));
     constant("BUTTON_UP", static_cast<int>(GameBoy::BUTTON_UP));
     constant("BUTTON_DOWN", static_cast<int>(GameBoy::BUTTON_DOWN));
+    
+    // Audio ring formats
+    constant("AUDIO_FORMAT_FLOAT32", static_cast<int>(AudioRing::FORMAT_FLOAT32));
+    constant("AUDIO_FORMAT_INT16", static_cast<int>(AudioRing::FORMAT_INT16));
 }
@@ -0,0 +1,115 @@
+#include "c_api.h"
+#include "../core/vector_env.h"
+
+struct gbenv {
+    VectorEnv env;
+    float (*hook)(gbenv* env, int index, void* user);
+    void* hookUser;
+    
+    explicit gbenv(int threads)
+        : env(threads)
+        , hook(nullptr)
+        , hookUser(nullptr)
+    {
+    }
+};
+
+// Adapts the C hook to VectorEnv's
+static float callRewardHook(GameBoy& gb, int index, void* user) {
+    (void)gb;
+    gbenv* handle = static_cast<gbenv*>(user);
+    return handle->hook(handle, index, handle->hookUser);
+}
+
+extern "C" {
+
+gbenv* gbenv_create(const uint8_t* rom, size_t romSize, int envs, int threads) {
+    gbenv* handle = new gbenv(threads);
+    if (!rom || !handle->env.loadROM(rom, romSize, envs)) {
+        delete handle;
+        return nullptr;
+    }
+    return handle;
+}
+
+void gbenv_destroy(gbenv* env) {
+    delete env;
+}
+
+int gbenv_env_count(const gbenv* env) {
+    return env->env.getEnvCount();
+}
+
+int gbenv_set_observation(gbenv* env, int format, int downsample) {
+    if (format != GBENV_SHADES && format != GBENV_GRAYSCALE) return 0;
+    return env->env.setObservation(static_cast<VectorEnv::ObservationFormat>(format), downsample);
+}
+
+int gbenv_observation_width(const gbenv* env) {
+    return env->env.getObservationWidth();
+}
+
+int gbenv_observation_height(const gbenv* env) {
+    return env->env.getObservationHeight();
+}
+
+int gbenv_set_start_state(gbenv* env, const uint8_t* state, size_t size) {
+    return env->env.setStartState(state, size);
+}
+
+int gbenv_add_reward(gbenv* env, uint16_t address, int width, float weight) {
+    VectorEnv::RewardTerm term = { address, static_cast<uint8_t>(width), weight };
+    return env->env.addRewardTerm(term);
+}
+
+int gbenv_add_termination(gbenv* env, uint16_t address, uint8_t mask, int compare, uint8_t value) {
+    VectorEnv::TerminationRule rule = { address, mask, static_cast<uint8_t>(compare), value };
+    return env->env.addTerminationRule(rule);
+}
+
+void gbenv_set_reward_hook(gbenv* env, float (*hook)(gbenv* env, int index, void* user), void* user) {
+    env->hook = hook;
+    env->hookUser = user;
+    env->env.setRewardHook(hook ? callRewardHook : nullptr, env);
+}
+
+void gbenv_clear_rules(gbenv* env) {
+    env->env.clearRules();
+    env->hook = nullptr;
+    env->hookUser = nullptr;
+}
+
+void gbenv_set_max_episode_frames(gbenv* env, uint32_t frames) {
+    env->env.setMaxEpisodeFrames(frames);
+}
+
+void gbenv_set_noop_max(gbenv* env, int frames) {
+    env->env.setNoopMax(frames);
+}
+
+void gbenv_set_auto_reset(gbenv* env, int enabled) {
+    env->env.setAutoReset(enabled != 0);
+}
+
+void gbenv_reset(gbenv* env, const uint64_t* seeds, uint8_t* observations) {
+    env->env.reset(seeds, observations);
+}
+
+void gbenv_step(gbenv* env, const uint8_t* actions, int frameskip,
+                uint8_t* observations, float* rewards, uint8_t* dones) {
+    env->env.step(actions, frameskip, observations, rewards, dones);
+}
+
+uint8_t gbenv_peek(gbenv* env, int index, uint16_t address) {
+    return env->env.getEnv(index).getMMU().peek(address);
+}
+
+size_t gbenv_state_size(gbenv* env, int index) {
+    return env->env.getEnv(index).getStateSize();
+}
+
+size_t gbenv_save_state(gbenv* env, int index, uint8_t* buffer, size_t capacity) {
+    return env->env.getEnv(index).saveState(buffer, capacity);
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * C interface to the batched RL environment (core/vector_env.h), for
+ * ctypes/cffi and other foreign-function callers.
+ *
+ * All buffers belong to the caller; nothing is allocated per call after
+ * gbenv_create. Functions returning int return 1 on success, 0 on failure.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gbenv gbenv;
+
+// Actions: bit N = button N held
+#define GBENV_BUTTON_A      0x01
+#define GBENV_BUTTON_B      0x02
+#define GBENV_BUTTON_SELECT 0x04
+#define GBENV_BUTTON_START  0x08
+#define GBENV_BUTTON_RIGHT  0x10
+#define GBENV_BUTTON_LEFT   0x20
+#define GBENV_BUTTON_UP     0x40
+#define GBENV_BUTTON_DOWN   0x80
+
+// Observation formats
+#define GBENV_SHADES        0
+#define GBENV_GRAYSCALE     1
+
+// Termination comparisons
+#define GBENV_EQUAL         0
+#define GBENV_NOT_EQUAL     1
+#define GBENV_LESS          2
+#define GBENV_GREATER       3
+
+// Bits of a done flag
+#define GBENV_TERMINATED    1
+#define GBENV_TRUNCATED     2
+
+// `threads` 0 = one per hardware thread. Null on failure.
+gbenv* gbenv_create(const uint8_t* rom, size_t romSize, int envs, int threads);
+void gbenv_destroy(gbenv* env);
+
+int gbenv_env_count(const gbenv* env);
+
+// Observation layout: envs x height x width bytes
+int gbenv_set_observation(gbenv* env, int format, int downsample);
+int gbenv_observation_width(const gbenv* env);
+int gbenv_observation_height(const gbenv* env);
+
+// Episode start state (a save state); default is power-on
+int gbenv_set_start_state(gbenv* env, const uint8_t* state, size_t size);
+
+int gbenv_add_reward(gbenv* env, uint16_t address, int width, float weight);
+int gbenv_add_termination(gbenv* env, uint16_t address, uint8_t mask, int compare, uint8_t value);
+void gbenv_set_reward_hook(gbenv* env, float (*hook)(gbenv* env, int index, void* user), void* user);
+void gbenv_clear_rules(gbenv* env);
+
+void gbenv_set_max_episode_frames(gbenv* env, uint32_t frames);
+void gbenv_set_noop_max(gbenv* env, int frames);
+void gbenv_set_auto_reset(gbenv* env, int enabled);
+
+// `seeds` (one per environment) and `observations` may be null
+void gbenv_reset(gbenv* env, const uint64_t* seeds, uint8_t* observations);
+
+// Any output may be null
+void gbenv_step(gbenv* env, const uint8_t* actions, int frameskip,
+                uint8_t* observations, float* rewards, uint8_t* dones);
+
+// For reward hooks: read a byte of an environment's memory
+uint8_t gbenv_peek(gbenv* env, int index, uint16_t address);
+
+// Save state access, e.g. to build start states (gbenv_state_size bytes)
+size_t gbenv_state_size(gbenv* env, int index);
+size_t gbenv_save_state(gbenv* env, int index, uint8_t* buffer, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
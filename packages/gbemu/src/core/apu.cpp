@@ -1,20 +1,203 @@
 #include "apu.h"
+#include "state.h"
 #include <cstring>
 #include <algorithm>
 #include <cmath>
 
-APU::APU() {
+// SIMD helpers for the audio output stage
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define APU_SIMD 1
+using f32x4 = v128_t;
+static inline f32x4 vLoad(const float* p) { return wasm_v128_load(p); }
+static inline void vStore(float* p, f32x4 v) { wasm_v128_store(p, v); }
+static inline f32x4 vSplat(float x) { return wasm_f32x4_splat(x); }
+static inline f32x4 vAdd(f32x4 a, f32x4 b) { return wasm_f32x4_add(a, b); }
+static inline f32x4 vSub(f32x4 a, f32x4 b) { return wasm_f32x4_sub(a, b); }
+static inline f32x4 vMul(f32x4 a, f32x4 b) { return wasm_f32x4_mul(a, b); }
+static inline f32x4 vClamp(f32x4 v) { return wasm_f32x4_pmax(wasm_f32x4_splat(-1.0f), wasm_f32x4_pmin(wasm_f32x4_splat(1.0f), v)); }
+static inline f32x4 vFromInt(const int32_t* p) { return wasm_f32x4_convert_i32x4(wasm_v128_load(p)); }
+template <int Lane> static inline f32x4 vBroadcast(f32x4 v) { return wasm_i32x4_shuffle(v, v, Lane, Lane, Lane, Lane); }
+static inline float vLast(f32x4 v) { return wasm_f32x4_extract_lane(v, 3); }
+static inline f32x4 vInterleaveLo(f32x4 a, f32x4 b) { return wasm_i32x4_shuffle(a, b, 0, 4, 1, 5); }
+static inline f32x4 vInterleaveHi(f32x4 a, f32x4 b) { return wasm_i32x4_shuffle(a, b, 2, 6, 3, 7); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define APU_SIMD 1
+using f32x4 = __m128;
+static inline f32x4 vLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void vStore(float* p, f32x4 v) { _mm_storeu_ps(p, v); }
+static inline f32x4 vSplat(float x) { return _mm_set1_ps(x); }
+static inline f32x4 vAdd(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+static inline f32x4 vSub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+static inline f32x4 vMul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+static inline f32x4 vClamp(f32x4 v) { return _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(_mm_set1_ps(1.0f), v)); }
+static inline f32x4 vFromInt(const int32_t* p) { return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+template <int Lane> static inline f32x4 vBroadcast(f32x4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(Lane, Lane, Lane, Lane)); }
+static inline float vLast(f32x4 v) { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); }
+static inline f32x4 vInterleaveLo(f32x4 a, f32x4 b) { return _mm_unpacklo_ps(a, b); }
+static inline f32x4 vInterleaveHi(f32x4 a, f32x4 b) { return _mm_unpackhi_ps(a, b); }
+#else
+#define APU_SIMD 0
+#endif
+
+#if APU_SIMD
+// Four steps of a first-order recursion: out = gains[0] * prev + sum(gains[1 + j] * in[j])
+static inline f32x4 recurse4(f32x4 in, float& prev, const float (*gains)[4]) {
+    f32x4 out = vMul(vLoad(gains[0]), vSplat(prev));
+    out = vAdd(out, vMul(vLoad(gains[1]), vBroadcast<0>(in)));
+    out = vAdd(out, vMul(vLoad(gains[2]), vBroadcast<1>(in)));
+    out = vAdd(out, vMul(vLoad(gains[3]), vBroadcast<2>(in)));
+    out = vAdd(out, vMul(vLoad(gains[4]), vBroadcast<3>(in)));
+    prev = vLast(out);
+    return out;
+}
+#endif
+
+APU::APU(bool output)
+    : blipLeft(output ? BLIP_BUFFER_SIZE : 0)
+    , blipRight(output ? BLIP_BUFFER_SIZE : 0)
+    , outputRing(output ? OUTPUT_RING_FRAMES : 1, AudioRing::FORMAT_FLOAT32)
+    , samplesFlushed(0)
+    , stretching(false)
+    , stretchRatio(1.0)
+    , sampleRate(SAMPLE_RATE)
+    , rateControlEnabled(false)
+    , rateTargetFill(OUTPUT_RING_FRAMES / 2)
+    , rateFillAverage(0.0f)
+    , rateIntegral(0.0)
+    , rateRatio(1.0)
+    , outputEnabled(output)
+    , outputSuspended(false)
+    , outputReleased(!output)
+    , channelMask(0x0F)
+    , synthMask(output ? 0x0F : 0)
+{
+    blipLeft.setRates(CLOCK_RATE, sampleRate);
+    blipRight.setRates(CLOCK_RATE, sampleRate);
     reset();
 }
 
+bool APU::setSampleRate(int rate) {
+    if (rate < 8000 || rate > 192000) return false;
+    
+    sampleRate = rate;
+    // The controller's history was measured against the old rate
+    rateRatio = 1.0;
+    rateFillAverage = static_cast<float>(rateTargetFill);
+    rateIntegral = 0.0;
+    if (timeStretch) {
+        timeStretch->setSampleRate(rate);
+    }
+    blipLeft.setRates(CLOCK_RATE, sampleRate);
+    blipRight.setRates(CLOCK_RATE, sampleRate);
+    
+    // Filter coefficients depend on the rate; restart from a clean state
+    initFilters();
+    clearBuffer();
+    return true;
+}
+
+void APU::setRateControl(bool enabled, int targetFill) {
+    rateControlEnabled = enabled;
+    rateTargetFill = std::max(1, std::min(targetFill, OUTPUT_RING_FRAMES - 1));
+    rateFillAverage = static_cast<float>(rateTargetFill);
+    rateIntegral = 0.0;
+    
+    if (!enabled && rateRatio != 1.0) {
+        rateRatio = 1.0;
+        blipLeft.setRates(CLOCK_RATE, sampleRate);
+        blipRight.setRates(CLOCK_RATE, sampleRate);
+    }
+}
+
+void APU::setOutputEnabled(bool enabled) {
+    if (enabled == outputEnabled) return;
+    
+    if (enabled && outputReleased) {
+        outputReleased = false;
+        blipLeft.setCapacity(BLIP_BUFFER_SIZE);
+        blipRight.setCapacity(BLIP_BUFFER_SIZE);
+        outputRing.allocate(OUTPUT_RING_FRAMES, outputRing.format());
+        rateFillAverage = static_cast<float>(rateTargetFill);
+        if (stretching) {
+            stretching = false;
+            setTimeStretch(stretchRatio);
+        }
+    }
+    
+    outputEnabled = enabled;
+    if (outputSuspended) {
+        return;
+    }
+    if (enabled) {
+        // Channels kept running silently; pick up from their current levels
+        synthMask = channelMask;
+        restartSynthesis();
+    } else {
+        // Fade to silence and flush what was already synthesised
+        synthMask = 0;
+        updateAllOutputs(blipTime);
+        endBlipFrame();
+    }
+}
+
+void APU::releaseOutput() {
+    if (outputReleased) return;
+    
+    setOutputEnabled(false);
+    
+    outputReleased = true;
+    blipLeft.setCapacity(0);
+    blipRight.setCapacity(0);
+    timeStretch.reset();
+    outputRing.allocate(1, outputRing.format());
+}
+
+size_t APU::getMemoryUsage() const {
+    size_t bytes = blipLeft.getMemoryUsage() + blipRight.getMemoryUsage() + outputRing.getMemoryUsage();
+    if (timeStretch) {
+        bytes += sizeof(TimeStretch) + timeStretch->getMemoryUsage();
+    }
+    return bytes;
+}
+
+void APU::setOutputSuspended(bool suspended) {
+    outputSuspended = suspended;
+    synthMask = (outputEnabled && !suspended) ? channelMask : 0;
+}
+
+void APU::setChannelMask(uint8_t mask) {
+    channelMask = mask & 0x0F;
+    if (outputEnabled && !outputSuspended) {
+        synthMask = channelMask;
+        updateAllOutputs(blipTime);
+    }
+}
+
+void APU::updateRateControl() {
+    // Smooth over ~20 blip frames (~20ms) so bursty host reads don't wobble
+    // the pitch, then steer by the distance from the target. The slow
+    // integral term takes over the steady clock drift so the fill settles
+    // on the target instead of below it.
+    float fill = static_cast<float>(outputRing.readable());
+    rateFillAverage += (fill - rateFillAverage) * 0.05f;
+    
+    double error = (rateTargetFill - rateFillAverage) / rateTargetFill;
+    error = std::max(-1.0, std::min(1.0, error));
+    rateIntegral += error * RATE_INTEGRAL_GAIN;
+    rateIntegral = std::max(-MAX_RATE_ADJUST, std::min(MAX_RATE_ADJUST, rateIntegral));
+    
+    double adjust = MAX_RATE_ADJUST * error + rateIntegral;
+    rateRatio = 1.0 + std::max(-MAX_RATE_ADJUST, std::min(MAX_RATE_ADJUST, adjust));
+    
+    blipLeft.setRates(CLOCK_RATE, sampleRate * rateRatio);
+    blipRight.setRates(CLOCK_RATE, sampleRate * rateRatio);
+}
+
 void APU::reset() {
     frameSequencerCycles = 0;
     frameSequencerStep = 0;
-    sampleCycles = 0;
-    sampleCyclesFrac = 0;
-    sampleBufferPos = 0;
-    sampleBuffer.resize(SAMPLE_BUFFER_SIZE * 2);
-    
     nr50 = 0x77;
     nr51 = 0xF3;
     nr52 = 0xF1;
@@ -42,70 +225,271 @@ void APU::reset() {
     
     waveRam.fill(0);
     initFilters();
+    clearBuffer();
 }
 
-void APU::step(int cycles) {
-    if (!(nr52 & 0x80)) {
-        return;
-    }
+void APU::clearBuffer() {
+    outputRing.discard();
+    rateFillAverage = static_cast<float>(rateTargetFill);
+    restartSynthesis();
+}
+
+void APU::restartSynthesis() {
+    blipLeft.clear();
+    blipRight.clear();
+    blipTime = 0;
     
-    frameSequencerCycles += cycles;
-    while (frameSequencerCycles >= 8192) {
-        frameSequencerCycles -= 8192;
-        stepFrameSequencer();
+    // Restart from silence and re-add the current channel levels
+    for (int i = 0; i < 4; i++) {
+        channelLeft[i] = 0;
+        channelRight[i] = 0;
     }
+    updateAllOutputs(0);
+}
+
+void APU::step(int cycles) {
+    uint32_t endTime = blipTime + cycles;
     
-    sampleCycles += cycles;
-    while (sampleCycles >= CYCLES_PER_SAMPLE_INT) {
-        sampleCycles -= CYCLES_PER_SAMPLE_INT;
-        sampleCyclesFrac += CYCLES_PER_SAMPLE_FRAC;
+    if (nr52 & 0x80) {
+        frameSequencerCycles += cycles;
+        while (frameSequencerCycles >= 8192) {
+            frameSequencerCycles -= 8192;
+            stepFrameSequencer();
+            if (synthMask) updateAllOutputs(endTime - frameSequencerCycles);
+        }
+        
+        // Frequency timers: each expiry is an output edge at endTime + timer.
+        // Channels that are not synthesised advance in closed form.
+        if (ch1.enabled) {
+            ch1.frequencyTimer -= cycles;
+            advanceSquare(ch1.frequencyTimer, ch1.dutyPosition, (2048 - ch1.frequency) * 4, ch1.dutyCycle, 0, endTime);
+        }
+        
+        if (ch2.enabled) {
+            ch2.frequencyTimer -= cycles;
+            advanceSquare(ch2.frequencyTimer, ch2.dutyPosition, (2048 - ch2.frequency) * 4, ch2.dutyCycle, 1, endTime);
+        }
         
-        if (sampleCyclesFrac >= 1000) {
-            sampleCyclesFrac -= 1000;
-            sampleCycles--;
+        if (ch3.enabled) {
+            ch3.frequencyTimer -= cycles;
+            if (ch3.frequencyTimer <= 0) {
+                int period = (2048 - ch3.frequency) * 2;
+                if (synthMask & 0x04) {
+                    while (ch3.frequencyTimer <= 0) {
+                        uint32_t edgeTime = endTime + ch3.frequencyTimer;
+                        ch3.frequencyTimer += period;
+                        ch3.positionCounter = (ch3.positionCounter + 1) & 31;
+                        updateChannelOutput(2, edgeTime);
+                    }
+                } else {
+                    int expiries = 1 + (-ch3.frequencyTimer) / period;
+                    ch3.frequencyTimer += expiries * period;
+                    ch3.positionCounter = (ch3.positionCounter + expiries) & 31;
+                }
+            }
         }
         
-        generateSample();
+        if (ch4.enabled) {
+            ch4.frequencyTimer -= cycles;
+            if (ch4.frequencyTimer <= 0) {
+                int divisor = ch4.divisor == 0 ? 8 : ch4.divisor * 16;
+                int period = divisor << ch4.clockShift;
+                if (synthMask & 0x08) {
+                    while (ch4.frequencyTimer <= 0) {
+                        uint32_t edgeTime = endTime + ch4.frequencyTimer;
+                        ch4.frequencyTimer += period;
+                        ch4.lfsr = stepLfsr(ch4.lfsr, ch4.widthMode);
+                        updateChannelOutput(3, edgeTime);
+                    }
+                } else {
+                    int expiries = 1 + (-ch4.frequencyTimer) / period;
+                    ch4.frequencyTimer += expiries * period;
+                    ch4.lfsr = jumpLfsr(ch4.lfsr, ch4.widthMode, expiries);
+                }
+            }
+        }
     }
     
-    if (ch1.enabled) {
-        ch1.frequencyTimer -= cycles;
-        while (ch1.frequencyTimer <= 0) {
-            ch1.frequencyTimer += (2048 - ch1.frequency) * 4;
-            ch1.dutyPosition = (ch1.dutyPosition + 1) & 7;
+    // APU off still advances time so the output keeps streaming silence;
+    // with output disabled or suspended no time is tracked and no samples
+    // are made
+    if (outputEnabled && !outputSuspended) {
+        blipTime = endTime;
+        if (blipTime >= BLIP_FRAME_CYCLES) {
+            endBlipFrame();
         }
     }
+}
+
+void APU::advanceSquare(int& timer, int& position, int period, int dutyCycle, int channel, uint32_t endTime) {
+    if (timer > 0) return;
+    
+    if (!(synthMask & (1 << channel))) {
+        // Not heard: only the duty position has to stay exact
+        int expiries = 1 + (-timer) / period;
+        timer += expiries * period;
+        position = (position + expiries) & 7;
+        return;
+    }
     
-    if (ch2.enabled) {
-        ch2.frequencyTimer -= cycles;
-        while (ch2.frequencyTimer <= 0) {
-            ch2.frequencyTimer += (2048 - ch2.frequency) * 4;
-            ch2.dutyPosition = (ch2.dutyPosition + 1) & 7;
+    // Jump from one duty transition to the next; the expiries in between
+    // leave the output level unchanged
+    const DutyRuns& runs = dutyRuns();
+    while (timer <= 0) {
+        int expiries = 1 + (-timer) / period;
+        int run = runs.steps[dutyCycle][position];
+        int steps = std::min(expiries, run);
+        uint32_t edgeTime = endTime + timer + (steps - 1) * period;
+        
+        timer += steps * period;
+        position = (position + steps) & 7;
+        if (steps == run) {
+            updateChannelOutput(channel, edgeTime);
+        }
+    }
+}
+
+const APU::DutyRuns& APU::dutyRuns() {
+    static const DutyRuns table = [] {
+        DutyRuns runs;
+        for (int duty = 0; duty < 4; duty++) {
+            for (int position = 0; position < 8; position++) {
+                // Positions are read MSB first (see getChannel1Level)
+                auto bit = [duty](int pos) { return (DUTY_TABLE[duty] >> (7 - (pos & 7))) & 1; };
+                int steps = 1;
+                while (bit(position + steps) == bit(position)) steps++;
+                runs.steps[duty][position] = static_cast<uint8_t>(steps);
+            }
+        }
+        return runs;
+    }();
+    return table;
+}
+
+uint16_t APU::stepLfsr(uint16_t lfsr, bool widthMode) {
+    uint16_t xorResult = (lfsr & 1) ^ ((lfsr >> 1) & 1);
+    lfsr = (lfsr >> 1) | (xorResult << 14);
+    if (widthMode) {
+        lfsr &= ~(1 << 6);
+        lfsr |= (xorResult << 6);
+    }
+    return lfsr;
+}
+
+uint16_t APU::jumpLfsr(uint16_t lfsr, bool widthMode, uint32_t shifts) {
+    // A shift is linear over GF(2), so 2^k shifts are a precomputed matrix;
+    // apply one per set bit of the shift count
+    const LfsrJumps& jumps = lfsrJumps();
+    for (int k = 0; shifts != 0; k++, shifts >>= 1) {
+        if (shifts & 1) {
+            lfsr = applyLfsrJump(jumps.columns[widthMode][k], lfsr);
         }
     }
+    return lfsr;
+}
+
+uint16_t APU::applyLfsrJump(const uint16_t* columns, uint16_t lfsr) {
+    uint16_t result = 0;
+    for (uint32_t bits = lfsr & 0x7FFF; bits; bits &= bits - 1) {
+        result ^= columns[__builtin_ctz(bits)];
+    }
+    return result;
+}
+
+const APU::LfsrJumps& APU::lfsrJumps() {
+    static const LfsrJumps table = [] {
+        LfsrJumps jumps;
+        for (int mode = 0; mode < 2; mode++) {
+            // Column i: where the single-bit state (1 << i) ends up
+            for (int i = 0; i < LFSR_BITS; i++) {
+                jumps.columns[mode][0][i] = stepLfsr(static_cast<uint16_t>(1 << i), mode != 0);
+            }
+            // Squaring: 2^k shifts are 2^(k-1) shifts applied twice
+            for (int k = 1; k < LFSR_JUMP_COUNT; k++) {
+                for (int i = 0; i < LFSR_BITS; i++) {
+                    jumps.columns[mode][k][i] = applyLfsrJump(jumps.columns[mode][k - 1], jumps.columns[mode][k - 1][i]);
+                }
+            }
+        }
+        return jumps;
+    }();
+    return table;
+}
+
+void APU::endBlipFrame() {
+    blipLeft.endFrame(blipTime);
+    blipRight.endFrame(blipTime);
+    blipTime = 0;
     
-    if (ch3.enabled) {
-        ch3.frequencyTimer -= cycles;
-        while (ch3.frequencyTimer <= 0) {
-            ch3.frequencyTimer += (2048 - ch3.frequency) * 2;
-            ch3.positionCounter = (ch3.positionCounter + 1) & 31;
+    // Integrate in blocks, then filter straight into the ring when it has a
+    // contiguous float span, otherwise through a scratch block (int16 format,
+    // wrap-around or overrun; the ring counts dropped frames)
+    constexpr int BLOCK = 256;
+    int32_t left[BLOCK];
+    int32_t right[BLOCK];
+    float scratch[BLOCK * 2];
+    
+    while (blipLeft.samplesAvail() > 0) {
+        int n = std::min(blipLeft.samplesAvail(), BLOCK);
+        blipLeft.readSamples(left, n);
+        blipRight.readSamples(right, n);
+        samplesFlushed += n;
+        
+        int spanFrames = n;
+        float* span = stretching ? nullptr : outputRing.writeSpan(spanFrames);
+        if (span && spanFrames == n) {
+            processBlock(left, right, span, n);
+            outputRing.commitWrite(n);
+        } else if (stretching) {
+            processBlock(left, right, scratch, n);
+            timeStretch->push(scratch, n);
+        } else {
+            processBlock(left, right, scratch, n);
+            outputRing.write(scratch, n);
         }
     }
     
-    if (ch4.enabled) {
-        ch4.frequencyTimer -= cycles;
-        while (ch4.frequencyTimer <= 0) {
-            int divisor = ch4.divisor == 0 ? 8 : ch4.divisor * 16;
-            ch4.frequencyTimer += divisor << ch4.clockShift;
-            
-            uint8_t xorResult = (ch4.lfsr & 1) ^ ((ch4.lfsr >> 1) & 1);
-            ch4.lfsr = (ch4.lfsr >> 1) | (xorResult << 14);
-            if (ch4.widthMode) {
-                ch4.lfsr &= ~(1 << 6);
-                ch4.lfsr |= (xorResult << 6);
-            }
+    while (stretching && timeStretch->available() > 0) {
+        int n = timeStretch->pull(scratch, BLOCK);
+        outputRing.write(scratch, n);
+    }
+    
+    if (rateControlEnabled) {
+        updateRateControl();
+    }
+}
+
+void APU::updateChannelOutput(int channel, uint32_t time) {
+    int level = 0;
+    if (synthMask & (1 << channel)) {
+        switch (channel) {
+            case 0: level = getChannel1Level(); break;
+            case 1: level = getChannel2Level(); break;
+            case 2: level = getChannel3Level(); break;
+            default: level = getChannel4Level(); break;
         }
     }
+    
+    int leftVol = ((nr50 >> 4) & 7) + 1;
+    int rightVol = (nr50 & 7) + 1;
+    
+    int left = (nr51 & (0x10 << channel)) ? level * leftVol : 0;
+    int right = (nr51 & (0x01 << channel)) ? level * rightVol : 0;
+    
+    if (left != channelLeft[channel]) {
+        blipLeft.addDelta(time, left - channelLeft[channel]);
+        channelLeft[channel] = left;
+    }
+    if (right != channelRight[channel]) {
+        blipRight.addDelta(time, right - channelRight[channel]);
+        channelRight[channel] = right;
+    }
+}
+
+void APU::updateAllOutputs(uint32_t time) {
+    for (int channel = 0; channel < 4; channel++) {
+        updateChannelOutput(channel, time);
+    }
 }
 
 void APU::stepFrameSequencer() {
@@ -268,98 +652,81 @@ void APU::triggerChannel4() {
     ch4.lfsr = 0x7FFF;
 }
 
-float APU::getChannel1Sample() {
-    if (!ch1.enabled || !ch1.dacEnabled) return 0.0f;
+int APU::getChannel1Level() {
+    if (!ch1.enabled || !ch1.dacEnabled) return 0;
     
     uint8_t duty = DUTY_TABLE[ch1.dutyCycle];
     bool high = (duty >> (7 - ch1.dutyPosition)) & 1;
     
-    return high ? (ch1.volume / 15.0f) : -(ch1.volume / 15.0f);
+    return high ? ch1.volume : -ch1.volume;
 }
 
-float APU::getChannel2Sample() {
-    if (!ch2.enabled || !ch2.dacEnabled) return 0.0f;
+int APU::getChannel2Level() {
+    if (!ch2.enabled || !ch2.dacEnabled) return 0;
     
     uint8_t duty = DUTY_TABLE[ch2.dutyCycle];
     bool high = (duty >> (7 - ch2.dutyPosition)) & 1;
     
-    return high ? (ch2.volume / 15.0f) : -(ch2.volume / 15.0f);
+    return high ? ch2.volume : -ch2.volume;
 }
 
-float APU::getChannel3Sample() {
-    if (!ch3.enabled || !ch3.dacEnabled) return 0.0f;
+int APU::getChannel3Level() {
+    if (!ch3.enabled || !ch3.dacEnabled) return 0;
     
     int sampleIndex = ch3.positionCounter;
     uint8_t waveByte = waveRam[sampleIndex / 2];
     uint8_t sample = (sampleIndex & 1) ? (waveByte & 0x0F) : (waveByte >> 4);
     
     int volumeShift = (ch3.nr32 >> 5) & 0x03;
-    if (volumeShift == 0) return 0.0f;
+    if (volumeShift == 0) return 0;
     sample >>= (volumeShift - 1);
     
-    return (sample / 15.0f) * 2.0f - 1.0f;
+    return sample * 2 - 15;
 }
 
-float APU::getChannel4Sample() {
-    if (!ch4.enabled || !ch4.dacEnabled) return 0.0f;
+int APU::getChannel4Level() {
+    if (!ch4.enabled || !ch4.dacEnabled) return 0;
     
     bool high = ~ch4.lfsr & 1;
     
-    return high ? (ch4.volume / 15.0f) : -(ch4.volume / 15.0f);
+    return high ? ch4.volume : -ch4.volume;
 }
 
-void APU::generateSample() {
-    if (sampleBufferPos >= SAMPLE_BUFFER_SIZE * 2) {
-        return;
-    }
-    
-    float ch1Sample = getChannel1Sample();
-    float ch2Sample = getChannel2Sample();
-    float ch3Sample = getChannel3Sample();
-    float ch4Sample = getChannel4Sample();
-    
-    float left = 0.0f;
-    float right = 0.0f;
-    
-    if (nr51 & 0x10) left += ch1Sample;
-    if (nr51 & 0x01) right += ch1Sample;
-    if (nr51 & 0x20) left += ch2Sample;
-    if (nr51 & 0x02) right += ch2Sample;
-    if (nr51 & 0x40) left += ch3Sample;
-    if (nr51 & 0x04) right += ch3Sample;
-    if (nr51 & 0x80) left += ch4Sample;
-    if (nr51 & 0x08) right += ch4Sample;
-    
-    int leftVol = ((nr50 >> 4) & 7) + 1;
-    int rightVol = (nr50 & 7) + 1;
-    
-    left = left * leftVol / 32.0f;
-    right = right * rightVol / 32.0f;
-    
-    applyFilters(left, right);
-    
-    left = std::max(-1.0f, std::min(1.0f, left));
-    right = std::max(-1.0f, std::min(1.0f, right));
-    
-    sampleBuffer[sampleBufferPos++] = left;
-    sampleBuffer[sampleBufferPos++] = right;
+int APU::getSamples(float* buffer, int maxSamples) {
+    flushSamples();
+    return outputRing.read(buffer, maxSamples);
 }
 
-int APU::getSamples(float* buffer, int maxSamples) {
-    int samplesToReturn = std::min(sampleBufferPos, maxSamples * 2);
-    
-    if (samplesToReturn > 0) {
-        std::memcpy(buffer, sampleBuffer.data(), samplesToReturn * sizeof(float));
-        
-        if (samplesToReturn < sampleBufferPos) {
-            std::memmove(sampleBuffer.data(), 
-                        sampleBuffer.data() + samplesToReturn,
-                        (sampleBufferPos - samplesToReturn) * sizeof(float));
+void APU::setTimeStretch(double ratio) {
+    bool enable = ratio != 1.0;
+    if (enable && !outputReleased) {
+        if (!timeStretch) {
+            timeStretch = std::make_unique<TimeStretch>();
+            timeStretch->setSampleRate(sampleRate);
+        } else if (!stretching) {
+            timeStretch->clear();
         }
-        sampleBufferPos -= samplesToReturn;
     }
-    
-    return samplesToReturn / 2;
+    if (timeStretch) {
+        timeStretch->setRatio(ratio);
+    }
+    stretchRatio = enable ? std::max(TimeStretch::MIN_RATIO, std::min(TimeStretch::MAX_RATIO, ratio)) : 1.0;
+    stretching = enable;
+}
+
+uint64_t APU::getSamplesGenerated() const {
+    return samplesFlushed + blipLeft.samplesAt(blipTime);
+}
+
+void APU::flushSamples() {
+    if (outputEnabled && !outputSuspended) {
+        endBlipFrame();
+    }
+}
+
+bool APU::setOutputFormat(AudioRing::Format format) {
+    if (format == outputRing.format()) return true;
+    return outputRing.allocate(outputReleased ? 1 : OUTPUT_RING_FRAMES, format);
 }
 
 uint8_t APU::read(uint16_t addr) {
@@ -618,6 +985,11 @@ void APU::write(uint16_t addr, uint8_t val) {
             waveRam[addr - 0xFF30] = val;
             break;
     }
+    
+    // Register writes can change any channel's level, volume or panning
+    if (synthMask) {
+        updateAllOutputs(blipTime);
+    }
 }
 
 void APU::initFilters() {
@@ -634,7 +1006,7 @@ void APU::initFilters() {
     // alpha = RC / (RC + dt) for high-pass
     // where RC = 1 / (2 * PI * cutoff) and dt = 1 / sampleRate
     
-    float dt = 1.0f / static_cast<float>(SAMPLE_RATE);
+    float dt = 1.0f / static_cast<float>(sampleRate);
     
     // Low-pass filter coefficient (14kHz cutoff)
     float lpfRC = 1.0f / (2.0f * 3.14159265f * LPF_CUTOFF);
@@ -643,6 +1015,19 @@ void APU::initFilters() {
     // High-pass filter coefficient (20Hz cutoff)
     float hpfRC = 1.0f / (2.0f * 3.14159265f * HPF_CUTOFF);
     hpfAlpha = hpfRC / (hpfRC + dt);
+    
+    // Unrolled over four samples (lane k, input j <= k):
+    // HPF on d = x[n] - x[n-1]: y[k] = a^(k+1) * y[-1] + sum a^(k-j+1) * d[j]
+    // LPF with c = 1 - alpha:   z[k] = c^(k+1) * z[-1] + sum alpha * c^(k-j) * y[j]
+    float lpfDecay = 1.0f - lpfAlpha;
+    for (int k = 0; k < 4; k++) {
+        hpfBlock[0][k] = std::pow(hpfAlpha, static_cast<float>(k + 1));
+        lpfBlock[0][k] = std::pow(lpfDecay, static_cast<float>(k + 1));
+        for (int j = 0; j < 4; j++) {
+            hpfBlock[1 + j][k] = (k >= j) ? std::pow(hpfAlpha, static_cast<float>(k - j + 1)) : 0.0f;
+            lpfBlock[1 + j][k] = (k >= j) ? lpfAlpha * std::pow(lpfDecay, static_cast<float>(k - j)) : 0.0f;
+        }
+    }
 }
 
 void APU::applyFilters(float& left, float& right) {
@@ -665,3 +1050,213 @@ void APU::applyFilters(float& left, float& right) {
     left = lpfLeftPrev;
     right = lpfRightPrev;
 }
+
+void APU::processBlock(const int32_t* left, const int32_t* right, float* out, int count) {
+    int i = 0;
+    
+#if APU_SIMD
+    const f32x4 scale = vSplat(OUTPUT_SCALE);
+    
+    for (; i + 4 <= count; i += 4) {
+        f32x4 l = vMul(vFromInt(left + i), scale);
+        f32x4 r = vMul(vFromInt(right + i), scale);
+        
+        // High-pass input is the first difference, built from the previous sample
+        alignas(16) float lastL[4];
+        alignas(16) float lastR[4];
+        vStore(lastL, l);
+        vStore(lastR, r);
+        float shiftedL[4] = { hpfLeftPrev, lastL[0], lastL[1], lastL[2] };
+        float shiftedR[4] = { hpfRightPrev, lastR[0], lastR[1], lastR[2] };
+        hpfLeftPrev = lastL[3];
+        hpfRightPrev = lastR[3];
+        
+        l = recurse4(vSub(l, vLoad(shiftedL)), hpfLeftCapacitor, hpfBlock);
+        r = recurse4(vSub(r, vLoad(shiftedR)), hpfRightCapacitor, hpfBlock);
+        l = vClamp(recurse4(l, lpfLeftPrev, lpfBlock));
+        r = vClamp(recurse4(r, lpfRightPrev, lpfBlock));
+        
+        vStore(out + i * 2, vInterleaveLo(l, r));
+        vStore(out + i * 2 + 4, vInterleaveHi(l, r));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        float l = left[i] * OUTPUT_SCALE;
+        float r = right[i] * OUTPUT_SCALE;
+        
+        applyFilters(l, r);
+        
+        out[i * 2] = std::max(-1.0f, std::min(1.0f, l));
+        out[i * 2 + 1] = std::max(-1.0f, std::min(1.0f, r));
+    }
+}
+
+// Only the emulated sound hardware is saved. Output-side state (blip buffers,
+// filters, time stretch, sample ring) is host-specific and simply carries on.
+void APU::saveState(StateWriter& state) const {
+    state.write(frameSequencerCycles);
+    state.write(frameSequencerStep);
+    state.write(nr50);
+    state.write(nr51);
+    state.write(nr52);
+    state.writeBytes(waveRam.data(), waveRam.size());
+    
+    // Channel 1
+    state.write(ch1.nr10);
+    state.write(ch1.nr11);
+    state.write(ch1.nr12);
+    state.write(ch1.nr13);
+    state.write(ch1.nr14);
+    state.write(ch1.enabled);
+    state.write(ch1.dacEnabled);
+    state.write(ch1.lengthCounter);
+    state.write(ch1.frequencyTimer);
+    state.write(ch1.dutyCycle);
+    state.write(ch1.dutyPosition);
+    state.write(ch1.volume);
+    state.write(ch1.envelopeTimer);
+    state.write(ch1.envelopeIncreasing);
+    state.write(ch1.envelopePeriod);
+    state.write(ch1.sweepTimer);
+    state.write(ch1.sweepPeriod);
+    state.write(ch1.sweepNegate);
+    state.write(ch1.sweepNegateUsed);
+    state.write(ch1.sweepShift);
+    state.write(ch1.frequency);
+    state.write(ch1.shadowFrequency);
+    state.write(ch1.sweepEnabled);
+    
+    // Channel 2
+    state.write(ch2.nr21);
+    state.write(ch2.nr22);
+    state.write(ch2.nr23);
+    state.write(ch2.nr24);
+    state.write(ch2.enabled);
+    state.write(ch2.dacEnabled);
+    state.write(ch2.lengthCounter);
+    state.write(ch2.frequencyTimer);
+    state.write(ch2.dutyCycle);
+    state.write(ch2.dutyPosition);
+    state.write(ch2.volume);
+    state.write(ch2.envelopeTimer);
+    state.write(ch2.envelopeIncreasing);
+    state.write(ch2.envelopePeriod);
+    state.write(ch2.frequency);
+    
+    // Channel 3
+    state.write(ch3.nr30);
+    state.write(ch3.nr31);
+    state.write(ch3.nr32);
+    state.write(ch3.nr33);
+    state.write(ch3.nr34);
+    state.write(ch3.enabled);
+    state.write(ch3.dacEnabled);
+    state.write(ch3.lengthCounter);
+    state.write(ch3.frequencyTimer);
+    state.write(ch3.positionCounter);
+    state.write(ch3.volume);
+    state.write(ch3.frequency);
+    
+    // Channel 4
+    state.write(ch4.nr41);
+    state.write(ch4.nr42);
+    state.write(ch4.nr43);
+    state.write(ch4.nr44);
+    state.write(ch4.enabled);
+    state.write(ch4.dacEnabled);
+    state.write(ch4.lengthCounter);
+    state.write(ch4.frequencyTimer);
+    state.write(ch4.volume);
+    state.write(ch4.envelopeTimer);
+    state.write(ch4.envelopeIncreasing);
+    state.write(ch4.envelopePeriod);
+    state.write(ch4.lfsr);
+    state.write(ch4.widthMode);
+    state.write(ch4.divisor);
+    state.write(ch4.clockShift);
+}
+
+void APU::loadState(StateReader& state) {
+    state.read(frameSequencerCycles);
+    state.read(frameSequencerStep);
+    state.read(nr50);
+    state.read(nr51);
+    state.read(nr52);
+    state.readBytes(waveRam.data(), waveRam.size());
+    
+    state.read(ch1.nr10);
+    state.read(ch1.nr11);
+    state.read(ch1.nr12);
+    state.read(ch1.nr13);
+    state.read(ch1.nr14);
+    state.read(ch1.enabled);
+    state.read(ch1.dacEnabled);
+    state.read(ch1.lengthCounter);
+    state.read(ch1.frequencyTimer);
+    state.read(ch1.dutyCycle);
+    state.read(ch1.dutyPosition);
+    state.read(ch1.volume);
+    state.read(ch1.envelopeTimer);
+    state.read(ch1.envelopeIncreasing);
+    state.read(ch1.envelopePeriod);
+    state.read(ch1.sweepTimer);
+    state.read(ch1.sweepPeriod);
+    state.read(ch1.sweepNegate);
+    state.read(ch1.sweepNegateUsed);
+    state.read(ch1.sweepShift);
+    state.read(ch1.frequency);
+    state.read(ch1.shadowFrequency);
+    state.read(ch1.sweepEnabled);
+    
+    state.read(ch2.nr21);
+    state.read(ch2.nr22);
+    state.read(ch2.nr23);
+    state.read(ch2.nr24);
+    state.read(ch2.enabled);
+    state.read(ch2.dacEnabled);
+    state.read(ch2.lengthCounter);
+    state.read(ch2.frequencyTimer);
+    state.read(ch2.dutyCycle);
+    state.read(ch2.dutyPosition);
+    state.read(ch2.volume);
+    state.read(ch2.envelopeTimer);
+    state.read(ch2.envelopeIncreasing);
+    state.read(ch2.envelopePeriod);
+    state.read(ch2.frequency);
+    
+    state.read(ch3.nr30);
+    state.read(ch3.nr31);
+    state.read(ch3.nr32);
+    state.read(ch3.nr33);
+    state.read(ch3.nr34);
+    state.read(ch3.enabled);
+    state.read(ch3.dacEnabled);
+    state.read(ch3.lengthCounter);
+    state.read(ch3.frequencyTimer);
+    state.read(ch3.positionCounter);
+    state.read(ch3.volume);
+    state.read(ch3.frequency);
+    
+    state.read(ch4.nr41);
+    state.read(ch4.nr42);
+    state.read(ch4.nr43);
+    state.read(ch4.nr44);
+    state.read(ch4.enabled);
+    state.read(ch4.dacEnabled);
+    state.read(ch4.lengthCounter);
+    state.read(ch4.frequencyTimer);
+    state.read(ch4.volume);
+    state.read(ch4.envelopeTimer);
+    state.read(ch4.envelopeIncreasing);
+    state.read(ch4.envelopePeriod);
+    state.read(ch4.lfsr);
+    state.read(ch4.widthMode);
+    state.read(ch4.divisor);
+    state.read(ch4.clockShift);
+    
+    // Re-seed the synthesis levels so the next delta starts from the new state
+    if (synthMask) {
+        updateAllOutputs(blipTime);
+    }
+}
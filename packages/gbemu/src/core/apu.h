@@ -1,9 +1,17 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <array>
+#include <memory>
 #include <vector>
 
+#include "audio_ring.h"
+#include "blip_buffer.h"
+#include "time_stretch.h"
+
+class StateWriter;
+class StateReader;
 /**
  * Audio Processing Unit - GameBoy Sound
  * 
@@ -25,7 +33,8 @@
  */
 class APU {
 public:
-    APU();
+    // Without `output` the APU starts released (see releaseOutput)
+    explicit APU(bool output = true);
     
     // Step the APU by given CPU cycles
     void step(int cycles);
@@ -33,37 +42,135 @@ public:
     // Reset APU state
     void reset();
     
+    // Save-state serialisation (see state.h)
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+    
     // Register read/write
     uint8_t read(uint16_t addr);
     void write(uint16_t addr, uint8_t val);
     
     // Get audio samples for output (returns number of samples)
     // Buffer should be large enough for stereo samples (left, right, left, right...)
+    // Single-threaded shortcut that flushes pending output and reads the ring.
     int getSamples(float* buffer, int maxSamples);
     
     // Clear audio buffer (call on ROM load to reset audio latency)
-    void clearBuffer() { sampleBufferPos = 0; }
+    void clearBuffer();
+    
+    // Ring the APU writes finished samples into. Another thread (or an
+    // AudioWorklet reading shared memory) may consume it concurrently.
+    AudioRing& getOutputRing() { return outputRing; }
+    
+    // Change the ring's sample format; buffered audio is discarded
+    bool setOutputFormat(AudioRing::Format format);
     
-    // Sample rate for audio output
+    // Time-stretch the output by `ratio` at unchanged pitch, for fast-forward
+    // (1 = off). Output then covers 1/ratio of the emulated time.
+    void setTimeStretch(double ratio);
+    double getTimeStretch() const { return stretchRatio; }
+    
+    // Output samples generated so far (before time-stretching), including
+    // those not yet in the ring
+    uint64_t getSamplesGenerated() const;
+    
+    // Move every generated sample into the ring
+    void flushSamples();
+    
+    // Default sample rate for audio output
     static constexpr int SAMPLE_RATE = 44100;
     
+    // Output at the host's rate (8000-192000 Hz). Band-limited synthesis
+    // produces any rate directly, so no second resampling pass is needed.
+    bool setSampleRate(int rate);
+    int getSampleRate() const { return sampleRate; }
+    
+    // Dynamic rate control: nudge the output rate by up to MAX_RATE_ADJUST
+    // so the ring hovers around targetFill frames, absorbing drift between
+    // the emulation and host audio clocks. Off by default.
+    void setRateControl(bool enabled, int targetFill);
+    double getRateRatio() const { return rateRatio; }
+    static constexpr double MAX_RATE_ADJUST = 0.005;
+    
+    // Audio-off mode: channels, length counters, sweep and NR52 status keep
+    // running exactly, but no samples are synthesised or filtered
+    void setOutputEnabled(bool enabled);
+    bool isOutputEnabled() const { return outputEnabled; }
+    
+    // Headless: disable output as above and free the synthesis buffers,
+    // time-stretch state and the ring's own storage (it shrinks to a single
+    // frame and reads empty). setOutputEnabled(true) allocates them again;
+    // a ring attached to caller memory must then be attached again.
+    void releaseOutput();
+    bool isOutputReleased() const { return outputReleased; }
+    
+    // Host-side buffer bytes held (synthesis, time stretch, owned ring)
+    size_t getMemoryUsage() const;
+    
+    // Speculative execution (run-ahead): stop synthesising but leave the
+    // output exactly where it is. Only resume after restoring the state the
+    // machine had when suspended, then the output continues seamlessly.
+    void setOutputSuspended(bool suspended);
+    
+    // Per-channel mute mask (bit N = channel N+1 audible). Muted channels
+    // are not synthesised at all.
+    void setChannelMask(uint8_t mask);
+    uint8_t getChannelMask() const { return channelMask; }
+    
+    // CPU clock driving the channel timers
+    static constexpr int CLOCK_RATE = 4194304;
+    
 private:
     // Frame sequencer (512 Hz, controls sweep/envelope/length)
     int frameSequencerCycles;
     int frameSequencerStep;
     
-    // Sample generation - use fractional accumulator for precise timing
-    int sampleCycles;
-    int sampleCyclesFrac;  // Fractional part (scaled by 1000)
-    // Precise cycles per sample: 4194304 / 44100 = 95.1020408...
-    // We use 95102 / 1000 to avoid drift
-    static constexpr int CYCLES_PER_SAMPLE_INT = 95;
-    static constexpr int CYCLES_PER_SAMPLE_FRAC = 102;  // 0.102 * 1000
+    // Band-limited synthesis: channel level changes become deltas at exact
+    // cycle timestamps, samples are integrated out at read time
+    BlipBuffer blipLeft;
+    BlipBuffer blipRight;
+    uint32_t blipTime;      // Cycles since the last blip frame ended
+    static constexpr uint32_t BLIP_FRAME_CYCLES = 4096;
+    static constexpr int BLIP_BUFFER_SIZE = 1024;
+    
+    // Filtered output, filled at the end of every blip frame
+    AudioRing outputRing;
+    static constexpr int OUTPUT_RING_FRAMES = 4096;
+    uint64_t samplesFlushed;  // Samples moved from the blip buffers to the ring
     
-    // Audio buffer
-    std::vector<float> sampleBuffer;
-    int sampleBufferPos;
-    static constexpr int SAMPLE_BUFFER_SIZE = 4096;
+    // Fast-forward time-stretch between the filters and the ring, created
+    // the first time fast-forward needs it
+    std::unique_ptr<TimeStretch> timeStretch;
+    bool stretching;
+    double stretchRatio;
+    
+    int sampleRate;
+    
+    // Dynamic rate control state
+    bool rateControlEnabled;
+    int rateTargetFill;     // Ring fill (frames) the controller aims for
+    float rateFillAverage;  // Smoothed ring fill, sampled once per blip frame
+    double rateIntegral;    // Accumulated correction for steady clock drift
+    double rateRatio;       // Current output rate / nominal rate
+    static constexpr double RATE_INTEGRAL_GAIN = 0.000001;
+    
+    void updateRateControl();
+    
+    // Output/mute settings; synthMask is the set of channels actually
+    // synthesised (channelMask, or none when output is disabled or suspended)
+    bool outputEnabled;
+    bool outputSuspended;
+    bool outputReleased;    // Buffers freed (see releaseOutput)
+    uint8_t channelMask;
+    uint8_t synthMask;
+    
+    // Restart band-limited synthesis from the current channel levels
+    void restartSynthesis();
+    
+    // Last contribution of each channel to the left/right outputs
+    // (DAC level -15..15 times master volume 1..8)
+    int channelLeft[4];
+    int channelRight[4];
     
     // Master control registers
     uint8_t nr50;  // 0xFF24 - Master volume / VIN
@@ -178,17 +285,49 @@ private:
     void triggerChannel3();
     void triggerChannel4();
     
-    float getChannel1Sample();
-    float getChannel2Sample();
-    float getChannel3Sample();
-    float getChannel4Sample();
+    // Advance a square channel's frequency timer that has just expired,
+    // emitting output only at duty transitions
+    void advanceSquare(int& timer, int& position, int period, int dutyCycle, int channel, uint32_t endTime);
     
-    void generateSample();
+    // Expiries from each duty position until the output level changes
+    struct DutyRuns {
+        uint8_t steps[4][8];
+    };
+    static const DutyRuns& dutyRuns();
+    
+    // Noise LFSR: single shift, and n shifts at once through GF(2) jump
+    // matrices for 2^k shifts (one table per width mode)
+    static constexpr int LFSR_BITS = 15;
+    static constexpr int LFSR_JUMP_COUNT = 31;
+    struct LfsrJumps {
+        uint16_t columns[2][LFSR_JUMP_COUNT][LFSR_BITS];
+    };
+    static uint16_t stepLfsr(uint16_t lfsr, bool widthMode);
+    static uint16_t jumpLfsr(uint16_t lfsr, bool widthMode, uint32_t shifts);
+    static uint16_t applyLfsrJump(const uint16_t* columns, uint16_t lfsr);
+    static const LfsrJumps& lfsrJumps();
+    
+    // Channel DAC output in 1/15 steps (-15..15)
+    int getChannel1Level();
+    int getChannel2Level();
+    int getChannel3Level();
+    int getChannel4Level();
+    
+    // Record a channel's new output at the given cycle time as blip deltas
+    // (a channel outside synthMask contributes silence)
+    void updateChannelOutput(int channel, uint32_t time);
+    void updateAllOutputs(uint32_t time);
+    
+    // Close the current blip frame and move its samples to the output ring
+    void endBlipFrame();
+    
+    // Full-scale output of one side: 4 channels * level 15 * volume 8
+    static constexpr float OUTPUT_SCALE = 1.0f / (480.0f * (1 << BlipBuffer::KERNEL_BITS));
     
     int calculateSweepFrequency();
     
     // Audio filters for authentic sound
-    // Low-pass filter state (removes harshness/aliasing)
+    // Low-pass filter state (softens the output like the analog path)
     float lpfLeftPrev;
     float lpfRightPrev;
     static constexpr float LPF_CUTOFF = 14000.0f;  // 14kHz cutoff
@@ -204,6 +343,15 @@ private:
     float lpfAlpha;  // Low-pass coefficient
     float hpfAlpha;  // High-pass coefficient
     
+    // Block form of both filters for the vectorised output stage: four
+    // outputs at once from the previous output and four inputs.
+    // [0] = gain of the previous output per lane, [1 + j] = gain of input j.
+    alignas(16) float hpfBlock[5][4];
+    alignas(16) float lpfBlock[5][4];
+    
     void initFilters();
     void applyFilters(float& left, float& right);
+    
+    // Scale, filter, clamp and interleave integrated blip samples into out
+    void processBlock(const int32_t* left, const int32_t* right, float* out, int count);
 };
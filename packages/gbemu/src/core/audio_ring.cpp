@@ -0,0 +1,158 @@
+#include "audio_ring.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+static_assert(sizeof(AudioRing::Header) == 32, "Header layout is shared with JavaScript");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Ring positions must be lock-free");
+
+AudioRing::AudioRing(int capacity, Format format)
+    : header(nullptr)
+    , samples(nullptr)
+{
+    allocate(capacity, format);
+}
+
+size_t AudioRing::frameBytes(Format format) {
+    return format == FORMAT_INT16 ? 2 * sizeof(int16_t) : 2 * sizeof(float);
+}
+
+size_t AudioRing::requiredBytes(int capacity, Format format) {
+    return sizeof(Header) + static_cast<size_t>(capacity) * frameBytes(format);
+}
+
+bool AudioRing::allocate(int capacity, Format format) {
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0) return false;
+    
+    std::vector<uint32_t>((requiredBytes(capacity, format) + 3) / 4, 0).swap(storage);
+    init(storage.data(), capacity, format);
+    return true;
+}
+
+bool AudioRing::attach(void* memory, int capacity, Format format) {
+    if (!memory || (reinterpret_cast<uintptr_t>(memory) & 3) != 0) return false;
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0) return false;
+    
+    init(memory, capacity, format);
+    storage.clear();
+    storage.shrink_to_fit();
+    return true;
+}
+
+void AudioRing::init(void* memory, int capacity, Format format) {
+    header = new (memory) Header();
+    header->capacity = capacity;
+    header->format = format;
+    samples = static_cast<uint8_t*>(memory) + sizeof(Header);
+    reset();
+}
+
+void AudioRing::reset() {
+    header->writePos.store(0, std::memory_order_relaxed);
+    header->readPos.store(0, std::memory_order_relaxed);
+    header->overruns.store(0, std::memory_order_relaxed);
+    header->discardPos.store(0, std::memory_order_relaxed);
+    header->underruns.store(0, std::memory_order_release);
+}
+
+void AudioRing::discard() {
+    uint32_t w = header->writePos.load(std::memory_order_relaxed);
+    header->discardPos.store(w, std::memory_order_release);
+    header->overruns.store(0, std::memory_order_relaxed);
+}
+
+uint32_t AudioRing::readPosition(std::memory_order order) const {
+    uint32_t r = header->readPos.load(order);
+    uint32_t discarded = header->discardPos.load(std::memory_order_acquire);
+    return static_cast<int32_t>(discarded - r) > 0 ? discarded : r;
+}
+
+int AudioRing::writable() const {
+    uint32_t w = header->writePos.load(std::memory_order_relaxed);
+    uint32_t r = readPosition(std::memory_order_acquire);
+    return static_cast<int>(header->capacity - (w - r));
+}
+
+float* AudioRing::writeSpan(int& frames) {
+    if (format() != FORMAT_FLOAT32) {
+        frames = 0;
+        return nullptr;
+    }
+    
+    uint32_t w = header->writePos.load(std::memory_order_relaxed);
+    uint32_t index = w & (header->capacity - 1);
+    frames = std::min({ frames, writable(), static_cast<int>(header->capacity - index) });
+    return static_cast<float*>(samples) + index * 2;
+}
+
+void AudioRing::commitWrite(int frames) {
+    uint32_t w = header->writePos.load(std::memory_order_relaxed);
+    header->writePos.store(w + frames, std::memory_order_release);
+}
+
+int AudioRing::write(const float* in, int frames) {
+    int count = std::min(frames, writable());
+    if (count < frames) {
+        header->overruns.fetch_add(frames - count, std::memory_order_relaxed);
+    }
+    
+    uint32_t w = header->writePos.load(std::memory_order_relaxed);
+    uint32_t mask = header->capacity - 1;
+    
+    // At most two segments: up to the end of the ring, then from the start
+    for (int done = 0; done < count; ) {
+        uint32_t index = (w + done) & mask;
+        int n = std::min(count - done, static_cast<int>(header->capacity - index));
+        
+        if (format() == FORMAT_FLOAT32) {
+            std::memcpy(static_cast<float*>(samples) + index * 2, in + done * 2, n * 2 * sizeof(float));
+        } else {
+            int16_t* out = static_cast<int16_t*>(samples) + index * 2;
+            for (int i = 0; i < n * 2; i++) {
+                float s = std::max(-1.0f, std::min(1.0f, in[done * 2 + i]));
+                out[i] = static_cast<int16_t>(std::lrint(s * 32767.0f));
+            }
+        }
+        done += n;
+    }
+    
+    header->writePos.store(w + count, std::memory_order_release);
+    return count;
+}
+
+int AudioRing::readable() const {
+    // Discard position first: it never passes the writePos loaded after it
+    uint32_t r = readPosition(std::memory_order_relaxed);
+    uint32_t w = header->writePos.load(std::memory_order_acquire);
+    return static_cast<int>(w - r);
+}
+
+int AudioRing::read(float* out, int frames) {
+    int count = std::min(frames, readable());
+    
+    uint32_t r = readPosition(std::memory_order_relaxed);
+    uint32_t mask = header->capacity - 1;
+    
+    for (int done = 0; done < count; ) {
+        uint32_t index = (r + done) & mask;
+        int n = std::min(count - done, static_cast<int>(header->capacity - index));
+        
+        if (format() == FORMAT_FLOAT32) {
+            std::memcpy(out + done * 2, static_cast<const float*>(samples) + index * 2, n * 2 * sizeof(float));
+        } else {
+            const int16_t* in = static_cast<const int16_t*>(samples) + index * 2;
+            for (int i = 0; i < n * 2; i++) {
+                out[done * 2 + i] = in[i] * (1.0f / 32768.0f);
+            }
+        }
+        done += n;
+    }
+    
+    header->readPos.store(r + count, std::memory_order_release);
+    return count;
+}
+
+void AudioRing::addUnderrun(int frames) {
+    header->underruns.fetch_add(frames, std::memory_order_relaxed);
+}
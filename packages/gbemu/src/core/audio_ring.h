@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+/**
+ * AudioRing - Lock-free single-producer/single-consumer stereo sample ring
+ *
+ * The APU writes finished samples straight into the ring and the host reads
+ * them from any one thread. The whole ring is a single block of memory, so in
+ * the WASM pthreads build it can live in shared memory and an AudioWorklet can
+ * read it in place through a view of the heap.
+ *
+ * Memory layout (32-bit words, then samples):
+ *   [0] writePos   frames written so far (producer, wraps at 2^32)
+ *   [1] readPos    frames read so far (consumer)
+ *   [2] capacity   ring size in frames, power of two
+ *   [3] format     FORMAT_FLOAT32 or FORMAT_INT16
+ *   [4] overruns   frames dropped because the ring was full (producer)
+ *   [5] underruns  frames the consumer needed but were missing (consumer)
+ *   [6] discardPos frames before it are stale and skipped (producer)
+ *   [7]            reserved
+ *   samples        capacity interleaved L/R frames, starting at byte 32
+ *
+ * Positions are published with release stores and read with acquire loads,
+ * matching Atomics.load/Atomics.store on the JavaScript side. The producer
+ * never writes readPos: to drop what is buffered while the consumer keeps
+ * running it moves discardPos up to writePos, and the consumer skips to it.
+ */
+class AudioRing {
+public:
+    enum Format : uint32_t {
+        FORMAT_FLOAT32 = 0,
+        FORMAT_INT16 = 1
+    };
+    
+    struct Header {
+        std::atomic<uint32_t> writePos;
+        std::atomic<uint32_t> readPos;
+        uint32_t capacity;
+        uint32_t format;
+        std::atomic<uint32_t> overruns;
+        std::atomic<uint32_t> underruns;
+        std::atomic<uint32_t> discardPos;
+        uint32_t reserved;
+    };
+    
+    AudioRing(int capacity, Format format);
+    
+    AudioRing(const AudioRing&) = delete;
+    AudioRing& operator=(const AudioRing&) = delete;
+    
+    // Bytes needed for a ring of `capacity` frames in the given format
+    static size_t requiredBytes(int capacity, Format format);
+    
+    // Switch to internally owned storage. Capacity must be a power of two.
+    bool allocate(int capacity, Format format);
+    
+    // Switch to caller-provided memory of at least requiredBytes(), 4-byte
+    // aligned (e.g. a region of shared WASM memory). The caller keeps it alive.
+    bool attach(void* memory, int capacity, Format format);
+    
+    // Discard buffered frames and zero the counters (both sides idle)
+    void reset();
+    
+    // Discard buffered frames from the producer side while the consumer
+    // may be reading; it skips them on its next read
+    void discard();
+    
+    // Raw block for handing to another thread or to JavaScript
+    void* data() const { return header; }
+    size_t sizeBytes() const { return requiredBytes(header->capacity, format()); }
+    
+    int capacity() const { return header->capacity; }
+    
+    // Bytes of storage owned by the ring (0 when attached)
+    size_t getMemoryUsage() const { return storage.capacity() * sizeof(uint32_t); }
+    Format format() const { return static_cast<Format>(header->format); }
+    uint32_t overruns() const { return header->overruns.load(std::memory_order_relaxed); }
+    uint32_t underruns() const { return header->underruns.load(std::memory_order_relaxed); }
+    
+    // Producer side
+    
+    // Frames that can be written without overrun
+    int writable() const;
+    
+    // Contiguous float32 span at the write position, up to `frames` long.
+    // Fill it and call commitWrite(). Returns nullptr for int16 rings.
+    float* writeSpan(int& frames);
+    void commitWrite(int frames);
+    
+    // Append interleaved frames, converting to the ring format. Frames that do
+    // not fit are dropped and counted as overruns. Returns frames written.
+    int write(const float* in, int frames);
+    
+    // Consumer side
+    
+    // Frames ready to read
+    int readable() const;
+    
+    // Read up to `frames` interleaved frames as float. Returns frames read.
+    int read(float* out, int frames);
+    
+    // Record frames a real-time consumer needed but could not get
+    void addUnderrun(int frames);
+
+private:
+    Header* header;
+    void* samples;
+    std::vector<uint32_t> storage;  // Backing memory when not attached
+    
+    void init(void* memory, int capacity, Format format);
+    
+    // readPos, moved past discarded frames
+    uint32_t readPosition(std::memory_order order) const;
+    static size_t frameBytes(Format format);
+};
@@ -0,0 +1,274 @@
+#include "batch_runner.h"
+#include <algorithm>
+#include <chrono>
+
+#if GBEMU_HAS_THREADS && defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <pthread.h>
+#include <sched.h>
+#define GBEMU_CAN_PIN_THREADS 1
+#else
+#define GBEMU_CAN_PIN_THREADS 0
+#endif
+
+static constexpr double CYCLES_PER_SECOND = 4194304.0;
+
+static uint64_t packRange(uint32_t begin, uint32_t end) {
+    return (static_cast<uint64_t>(begin) << 32) | end;
+}
+
+BatchRunner::BatchRunner(int threads, bool pinThreads)
+    : threadCount(1)
+    , pinThreads(pinThreads)
+    , rendering(false)
+    , task(nullptr)
+#if GBEMU_HAS_THREADS
+    , generation(0)
+    , busyWorkers(0)
+    , stopping(false)
+#endif
+{
+    resetStats();
+
+#if GBEMU_HAS_THREADS
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    threadCount = std::max(1, threads);
+    queues = std::make_unique<WorkQueue[]>(threadCount);
+    for (int i = 1; i < threadCount; i++) {
+        workers.emplace_back(&BatchRunner::workerLoop, this, i);
+    }
+#else
+    (void)threads;
+    queues = std::make_unique<WorkQueue[]>(threadCount);
+#endif
+}
+
+BatchRunner::~BatchRunner() {
+#if GBEMU_HAS_THREADS
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+#endif
+}
+
+bool BatchRunner::loadROM(const uint8_t* data, size_t size, int count) {
+    // Headless, so forks never allocate audio buffers, and a framebuffer
+    // only when frames are drawn
+    GameBoy prototype(true);
+    if (count < 0 || !prototype.loadROM(data, size)) return false;
+    
+    instances.clear();
+    instances.resize(count);
+    
+    auto create = [this, &prototype](int index) {
+        std::unique_ptr<GameBoy> gb = prototype.fork();
+        gb->getPPU().setVideoOutputEnabled(rendering);
+        gb->getPPU().setRenderingSkipped(!rendering);
+        instances[index].gb = std::move(gb);
+    };
+    
+    // The first fork gives up the prototype's page ownership, the only
+    // write fork() makes to it; after that the workers fork it concurrently,
+    // each instance by its owner so its memory is first touched there.
+    // Instance 0 belongs to this thread anyway.
+    if (count > 0) {
+        create(0);
+    }
+    dispatch([&create](int index) {
+        if (index > 0) {
+            create(index);
+        }
+    });
+    return true;
+}
+
+void BatchRunner::setInputScript(int index, std::vector<ScriptEvent> script) {
+    Instance& instance = instances[index];
+    instance.script = std::move(script);
+    instance.scriptIndex = 0;
+    while (instance.scriptIndex < instance.script.size() &&
+           instance.script[instance.scriptIndex].frame < instance.frame) {
+        instance.scriptIndex++;
+    }
+}
+
+void BatchRunner::setRendering(bool enabled) {
+    rendering = enabled;
+    for (Instance& instance : instances) {
+        if (enabled) {
+            instance.gb->getPPU().setVideoOutputEnabled(true);
+        }
+        instance.gb->getPPU().setRenderingSkipped(!enabled);
+    }
+}
+
+void BatchRunner::runFrames(int frames) {
+    if (frames <= 0 || instances.empty()) return;
+    
+    uint64_t cyclesBefore = 0;
+    for (const Instance& instance : instances) {
+        cyclesBefore += instance.gb->getTotalCycles();
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    dispatch([this, frames](int index) {
+        runInstance(instances[index], frames);
+    });
+    auto end = std::chrono::steady_clock::now();
+    
+    uint64_t cyclesAfter = 0;
+    for (const Instance& instance : instances) {
+        cyclesAfter += instance.gb->getTotalCycles();
+    }
+    
+    totals.frames += static_cast<uint64_t>(frames) * instances.size();
+    totals.cycles += cyclesAfter - cyclesBefore;
+    totals.wallSeconds += std::chrono::duration<double>(end - start).count();
+}
+
+void BatchRunner::forEachInstance(const std::function<void(int index)>& job) {
+    dispatch(job);
+}
+
+BatchRunner::Stats BatchRunner::getStats() const {
+    Stats stats = totals;
+    stats.steals = 0;
+    for (int i = 0; i < threadCount; i++) {
+        stats.steals += queues[i].steals;
+    }
+    if (stats.wallSeconds > 0) {
+        stats.framesPerSecond = stats.frames / stats.wallSeconds;
+        stats.speed = stats.cycles / CYCLES_PER_SECOND / stats.wallSeconds;
+    }
+    return stats;
+}
+
+void BatchRunner::resetStats() {
+    totals = Stats();
+    for (int i = 0; queues && i < threadCount; i++) {
+        queues[i].steals = 0;
+    }
+}
+
+void BatchRunner::runInstance(Instance& instance, int frames) {
+    GameBoy& gb = *instance.gb;
+    for (int i = 0; i < frames; i++) {
+        // Script events due at this frame
+        while (instance.scriptIndex < instance.script.size() &&
+               instance.script[instance.scriptIndex].frame <= instance.frame) {
+            const ScriptEvent& event = instance.script[instance.scriptIndex++];
+            gb.setButton(event.button, event.pressed);
+        }
+        gb.runFrame();
+        instance.frame++;
+    }
+}
+
+void BatchRunner::dispatch(const std::function<void(int)>& job) {
+    // Contiguous blocks, one per worker
+    uint32_t count = static_cast<uint32_t>(instances.size());
+    for (int i = 0; i < threadCount; i++) {
+        uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * i / threadCount);
+        uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (i + 1) / threadCount);
+        queues[i].range.store(packRange(begin, end), std::memory_order_relaxed);
+    }
+    task = &job;
+
+#if GBEMU_HAS_THREADS
+    if (threadCount > 1) {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            busyWorkers = threadCount - 1;
+            generation++;
+        }
+        wakeCondition.notify_all();
+        
+        work(0);
+        
+        // Barrier: every pool thread has run out of work
+        std::unique_lock<std::mutex> lock(poolMutex);
+        doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+        task = nullptr;
+        return;
+    }
+#endif
+
+    work(0);
+    task = nullptr;
+}
+
+void BatchRunner::work(int worker) {
+    int index;
+    while (take(worker, index) || steal(worker, index)) {
+        (*task)(index);
+    }
+}
+
+bool BatchRunner::take(int worker, int& index) {
+    std::atomic<uint64_t>& range = queues[worker].range;
+    uint64_t current = range.load(std::memory_order_relaxed);
+    for (;;) {
+        uint32_t begin = static_cast<uint32_t>(current >> 32);
+        uint32_t end = static_cast<uint32_t>(current);
+        if (begin >= end) return false;
+        if (range.compare_exchange_weak(current, packRange(begin + 1, end), std::memory_order_acq_rel)) {
+            index = static_cast<int>(begin);
+            return true;
+        }
+    }
+}
+
+bool BatchRunner::steal(int worker, int& index) {
+    // Nearest workers first: neighbouring CPUs are the likeliest to share a node
+    for (int distance = 1; distance < threadCount; distance++) {
+        WorkQueue& victim = queues[(worker + distance) % threadCount];
+        uint64_t current = victim.range.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t begin = static_cast<uint32_t>(current >> 32);
+            uint32_t end = static_cast<uint32_t>(current);
+            if (begin >= end) break;
+            if (victim.range.compare_exchange_weak(current, packRange(begin, end - 1), std::memory_order_acq_rel)) {
+                index = static_cast<int>(end - 1);
+                queues[worker].steals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+#if GBEMU_HAS_THREADS
+void BatchRunner::workerLoop(int worker) {
+#if GBEMU_CAN_PIN_THREADS
+    if (pinThreads) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker % CPU_SETSIZE, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            wakeCondition.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        
+        work(worker);
+        
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (--busyWorkers == 0) {
+            doneCondition.notify_one();
+        }
+    }
+}
+#endif
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "gameboy.h"
+#include "threads.h"
+
+/**
+ * BatchRunner - Many headless GameBoy instances on a thread pool
+ *
+ * Runs N machines of one ROM for regression playthroughs and bots. Every
+ * instance is forked from a prototype, so they share the ROM image (and
+ * blank RAM pages until they write them). Instances run with audio
+ * synthesis off; drawing is optional.
+ *
+ * runFrames(n) is a step barrier: each instance runs n frames and the call
+ * returns when all of them are done, so scripts, observers and savestates
+ * always see the whole batch at the same frame.
+ *
+ * Scheduling: instances are split into contiguous blocks, one per worker
+ * (the calling thread is worker 0). A worker runs its own block front to
+ * back and, once empty, steals single instances from the back of other
+ * blocks, nearest worker first. Each instance is created on the worker
+ * that owns it; with pinned threads its memory is first touched on that
+ * worker's CPU, and so on its NUMA node, and it stays on that node unless
+ * stolen.
+ *
+ * Without thread support everything runs on the calling thread.
+ */
+class BatchRunner {
+public:
+    // Joypad event, applied just before the instance's frame `frame`
+    // (frames counted from when the instance was created)
+    struct ScriptEvent {
+        uint32_t frame;
+        uint8_t button;     // GameBoy::Button
+        bool pressed;
+    };
+    
+    // Totals since the last resetStats()
+    struct Stats {
+        uint64_t frames;            // Frames run, all instances together
+        uint64_t cycles;            // Machine cycles emulated
+        uint64_t steals;            // Instances run by a worker other than their owner
+        double wallSeconds;         // Time spent in runFrames
+        double framesPerSecond;     // frames / wallSeconds
+        double speed;               // Emulated time / wallSeconds (1.0 = one real-time GameBoy)
+    };
+    
+    // `threads` workers including the caller; 0 = one per hardware thread.
+    // With `pinThreads` pool thread i is bound to CPU i (Linux only).
+    explicit BatchRunner(int threads = 0, bool pinThreads = false);
+    ~BatchRunner();
+    
+    BatchRunner(const BatchRunner&) = delete;
+    BatchRunner& operator=(const BatchRunner&) = delete;
+    
+    // Replace the batch with `count` fresh instances of this ROM
+    bool loadROM(const uint8_t* data, size_t size, int count);
+    
+    int getInstanceCount() const { return static_cast<int>(instances.size()); }
+    int getThreadCount() const { return threadCount; }
+    GameBoy& getInstance(int index) { return *instances[index].gb; }
+    uint32_t getInstanceFrame(int index) const { return instances[index].frame; }
+    
+    // Input script for one instance, events in frame order. Replaces the
+    // previous script; events for frames already run are skipped.
+    void setInputScript(int index, std::vector<ScriptEvent> script);
+    
+    // Draw every frame (default off: frames are emulated but not drawn, and
+    // instances loaded while it is off get no framebuffer until enabled)
+    void setRendering(bool enabled);
+    
+    // Run every instance `frames` frames; returns when all are done
+    void runFrames(int frames);
+    
+    // Run `task(index)` once for every instance on the pool (for
+    // observation or state saving between steps)
+    void forEachInstance(const std::function<void(int index)>& task);
+    
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    // alignas keeps instances run by different workers off shared cache lines
+    struct alignas(64) Instance {
+        std::unique_ptr<GameBoy> gb;
+        std::vector<ScriptEvent> script;
+        size_t scriptIndex = 0;
+        uint32_t frame = 0;
+    };
+    
+    // A worker's share of the instances: [begin, end) packed into one word
+    // (begin high, end low) so the owner taking from the front and thieves
+    // taking from the back never hand out the same instance
+    struct alignas(64) WorkQueue {
+        std::atomic<uint64_t> range{0};
+        uint64_t steals = 0;
+    };
+    
+    std::vector<Instance> instances;
+    std::unique_ptr<WorkQueue[]> queues;
+    int threadCount;
+    bool pinThreads;
+    bool rendering;
+    
+    Stats totals;
+    
+    // Current job: run task for every instance
+    const std::function<void(int)>* task;
+    void dispatch(const std::function<void(int)>& job);
+    void work(int worker);
+    bool take(int worker, int& index);
+    bool steal(int worker, int& index);
+    
+    void runInstance(Instance& instance, int frames);
+
+#if GBEMU_HAS_THREADS
+    std::vector<std::thread> workers;
+    std::mutex poolMutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    uint64_t generation;
+    int busyWorkers;
+    bool stopping;
+    
+    void workerLoop(int worker);
+#endif
+};
@@ -0,0 +1,120 @@
+#include "blip_buffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+BlipBuffer::BlipBuffer(int maxSamples)
+    : maxSamples(maxSamples)
+    , factor(0)
+    , offset(0)
+    , avail(0)
+    , integrator(0)
+    , level(0)
+    , buffer(maxSamples + HALF_WIDTH * 2 + 1, 0)
+{
+}
+
+void BlipBuffer::setRates(double clockRate, double sampleRate) {
+    factor = static_cast<uint64_t>(std::llround(sampleRate / clockRate * (1ULL << TIME_BITS)));
+}
+
+void BlipBuffer::setCapacity(int maxSamples) {
+    this->maxSamples = maxSamples;
+    std::vector<int32_t>(maxSamples + HALF_WIDTH * 2 + 1, 0).swap(buffer);
+    clear();
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    avail = 0;
+    integrator = 0;
+    level = 0;
+    std::fill(buffer.begin(), buffer.end(), 0);
+}
+
+void BlipBuffer::addDelta(uint32_t time, int delta) {
+    uint64_t pos = offset + time * factor;
+    int index = avail + static_cast<int>(pos >> TIME_BITS);
+    int phase = static_cast<int>(pos >> (TIME_BITS - PHASE_BITS)) & (PHASE_COUNT - 1);
+    
+    // Past the end of a full buffer only the level is kept; endFrame then
+    // drops the whole overflowing block
+    level += delta * (1 << KERNEL_BITS);
+    if (index > maxSamples) return;
+    
+    const int16_t* taps = kernel().taps[phase];
+    int32_t* out = &buffer[index];
+    for (int i = 0; i < HALF_WIDTH * 2; i++) {
+        out[i] += taps[i] * delta;
+    }
+}
+
+void BlipBuffer::endFrame(uint32_t clocks) {
+    uint64_t pos = offset + clocks * factor;
+    avail += static_cast<int>(pos >> TIME_BITS);
+    offset = pos & ((1ULL << TIME_BITS) - 1);
+    
+    if (avail > maxSamples) {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        avail = 0;
+        integrator = level;
+    }
+}
+
+int BlipBuffer::readSamples(int32_t* out, int count) {
+    if (count > avail) count = avail;
+    if (count <= 0) return 0;
+    
+    int32_t sum = integrator;
+    for (int i = 0; i < count; i++) {
+        sum += buffer[i];
+        if (out) out[i] = sum;
+    }
+    integrator = sum;
+    
+    // Shift remaining samples and the kernel tail of pending deltas down
+    int remaining = avail - count + HALF_WIDTH * 2;
+    std::memmove(buffer.data(), buffer.data() + count, remaining * sizeof(int32_t));
+    std::fill(buffer.begin() + remaining, buffer.begin() + remaining + count, 0);
+    avail -= count;
+    
+    return count;
+}
+
+const BlipBuffer::Kernel& BlipBuffer::kernel() {
+    static const Kernel table = makeKernel();
+    return table;
+}
+
+BlipBuffer::Kernel BlipBuffer::makeKernel() {
+    Kernel table;
+    
+    // Blackman-windowed sinc impulse, cutoff slightly below Nyquist.
+    // Tap i of phase p samples the impulse at i - (HALF_WIDTH - 1) - p / PHASE_COUNT.
+    const double pi = 3.14159265358979323846;
+    const double cutoff = 0.45;  // Fraction of the output sample rate
+    
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        double impulse[HALF_WIDTH * 2];
+        double total = 0.0;
+        
+        for (int i = 0; i < HALF_WIDTH * 2; i++) {
+            double x = i - (HALF_WIDTH - 1) - static_cast<double>(phase) / PHASE_COUNT;
+            double sinc = (x == 0.0) ? 1.0 : std::sin(2.0 * pi * cutoff * x) / (2.0 * pi * cutoff * x);
+            double w = x / HALF_WIDTH;
+            double window = 0.42 + 0.5 * std::cos(pi * w) + 0.08 * std::cos(2.0 * pi * w);
+            impulse[i] = sinc * window;
+            total += impulse[i];
+        }
+        
+        // Normalise so every phase sums exactly to unity gain
+        int sum = 0;
+        for (int i = 0; i < HALF_WIDTH * 2; i++) {
+            table.taps[phase][i] = static_cast<int16_t>(std::lround(impulse[i] / total * (1 << KERNEL_BITS)));
+            sum += table.taps[phase][i];
+        }
+        table.taps[phase][HALF_WIDTH - 1] += static_cast<int16_t>((1 << KERNEL_BITS) - sum);
+    }
+    
+    return table;
+}
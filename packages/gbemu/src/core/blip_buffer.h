@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * BlipBuffer - Band-limited step synthesis (in the style of blip_buf)
+ *
+ * Waveform transitions are added as amplitude deltas at exact clock
+ * timestamps. Each delta is spread over HALF_WIDTH * 2 output samples with a
+ * windowed-sinc step kernel, so square/noise edges come out band-limited
+ * instead of aliased. Output samples are produced in bulk at read time by
+ * integrating the buffer, so the cost follows the number of transitions, not
+ * the number of samples.
+ *
+ * Usage per block: addDelta() with times relative to the block start, then
+ * endFrame(blockClocks) to make the completed samples readable.
+ */
+class BlipBuffer {
+public:
+    explicit BlipBuffer(int maxSamples);
+    
+    // Set input clock rate and output sample rate (e.g. 4194304 -> 44100)
+    void setRates(double clockRate, double sampleRate);
+    
+    // Discard all samples and reset the integrator
+    void clear();
+    
+    // Add an amplitude change at clock time (relative to the current block)
+    void addDelta(uint32_t time, int delta);
+    
+    // End the current block of `clocks` cycles; its samples become readable
+    void endFrame(uint32_t clocks);
+    
+    // Samples ready to read
+    int samplesAvail() const { return avail; }
+    
+    // Samples that would be ready if the current block ended after `clocks`
+    int samplesAt(uint32_t clocks) const {
+        return avail + static_cast<int>((offset + clocks * factor) >> TIME_BITS);
+    }
+    
+    // Maximum samples buffered unread. A block that ends past it drops every
+    // unread sample (whole blocks, never single deltas) and resumes at the
+    // level all deltas add up to, so an overflow leaves no DC offset.
+    int capacity() const { return maxSamples; }
+    
+    // Reallocate for `maxSamples` (0 frees nearly everything); clears
+    void setCapacity(int maxSamples);
+    size_t getMemoryUsage() const { return buffer.capacity() * sizeof(int32_t); }
+    
+    // Read up to `count` samples as raw integrated values, removing them.
+    // Full scale of a delta d is d << KERNEL_BITS. Passing nullptr skips samples.
+    int readSamples(int32_t* out, int count);
+    
+    static constexpr int KERNEL_BITS = 15;
+
+private:
+    static constexpr int TIME_BITS = 32;      // Fixed-point fraction of a sample
+    static constexpr int PHASE_BITS = 5;      // Kernel phases per sample
+    static constexpr int PHASE_COUNT = 1 << PHASE_BITS;
+    static constexpr int HALF_WIDTH = 8;      // Kernel taps either side of the step
+    
+    int maxSamples;
+    uint64_t factor;        // Output samples per clock, TIME_BITS fraction
+    uint64_t offset;        // Fractional sample position of the block start
+    int avail;
+    int32_t integrator;
+    int32_t level;          // integrator plus every delta not yet read
+    std::vector<int32_t> buffer;
+    
+    // Step kernel, taps[phase][tap], each phase sums to 1 << KERNEL_BITS
+    struct Kernel {
+        int16_t taps[PHASE_COUNT][HALF_WIDTH * 2];
+    };
+    static Kernel makeKernel();
+    static const Kernel& kernel();
+};
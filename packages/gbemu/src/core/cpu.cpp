@@ -1,5 +1,6 @@
 #include "cpu.h"
 #include "mmu.h"
+#include "state.h"
 
 CPU::CPU(MMU& mmu) : mmu(mmu) {
     reset();
@@ -745,3 +746,39 @@ int CPU::executeCBOpcode(uint8_t opcode) {
         return 8;
     }
 }
+
+void CPU::saveState(StateWriter& state) const {
+    state.write(a);
+    state.write(f);
+    state.write(b);
+    state.write(c);
+    state.write(d);
+    state.write(e);
+    state.write(h);
+    state.write(l);
+    state.write(sp);
+    state.write(pc);
+    state.write(halted);
+    state.write(ime);
+    state.write(imeScheduled);
+    state.write(stopped);
+    state.write(haltBug);
+}
+
+void CPU::loadState(StateReader& state) {
+    state.read(a);
+    state.read(f);
+    state.read(b);
+    state.read(c);
+    state.read(d);
+    state.read(e);
+    state.read(h);
+    state.read(l);
+    state.read(sp);
+    state.read(pc);
+    state.read(halted);
+    state.read(ime);
+    state.read(imeScheduled);
+    state.read(stopped);
+    state.read(haltBug);
+}
@@ -6,6 +6,8 @@
 
 // Forward declarations
 class MMU;
+class StateWriter;
+class StateReader;
 
 /**
  * Sharp LR35902 CPU - The GameBoy's processor
@@ -36,6 +38,10 @@ public:
     // Reset CPU to initial state
     void reset();
     
+    // Save-state serialisation (see state.h)
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+    
     // Interrupt handling
     void requestInterrupt(uint8_t interrupt);
     int handleInterrupts();  // Returns cycles consumed (20 if interrupt dispatched, 0 otherwise)
@@ -145,4 +151,6 @@ private:
     
     // Execute CB-prefixed opcode (returns cycles)
     int executeCBOpcode(uint8_t opcode);
+    
+    friend class LockstepGroup;
 };
@@ -1,16 +1,42 @@
 #include "gameboy.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
-GameBoy::GameBoy()
+GameBoy::GameBoy(bool headless)
     : mmu()
     , cpu(mmu)
-    , ppu(mmu)
+    , ppu(mmu, !headless)
     , timer(mmu)
-    , apu()
+    , apu(!headless)
+    , frameCycles(0)
+    , totalCycles(0)
+    , movieMode(MOVIE_NONE)
+    , movieInputIndex(0)
+    , movieCheckpointIndex(0)
+    , nextInputCycle(UINT64_MAX)
+    , movieFrames(0)
+    , movieFinished(false)
+    , movieDesynced(false)
+    , movieDesyncCycle(0)
+    , movieRTCBase(0)
+    , keyframeInterval(static_cast<uint64_t>(DEFAULT_KEYFRAME_SECONDS) * APU::CLOCK_RATE)
+    , nextKeyframeCycle(UINT64_MAX)
+    , turboFactor(1)
+    , runAheadFrames(0)
+    , speculating(false)
+    , speculationEpoch(0)
+    , runAheadTotals()
     , buttons(0x0F)
     , dpad(0x0F)
 {
     mmu.setAPU(&apu);
     mmu.setTimer(&timer);
+    mmu.setPPU(&ppu);
+}
+
+GameBoy::~GameBoy() {
+    finishKeyframes();
 }
 
 bool GameBoy::loadROM(const uint8_t* data, size_t size) {
@@ -21,52 +47,755 @@ bool GameBoy::loadROM(const uint8_t* data, size_t size) {
     return true;
 }
 
+bool GameBoy::loadROM(const MMU::ROMImage& image) {
+    if (!mmu.attachROM(image)) {
+        return false;
+    }
+    reset();
+    return true;
+}
+
+void GameBoy::powerCycle() {
+    mmu.reset();
+    reset();
+}
+
 void GameBoy::reset() {
+    stopMovie();
+    if (rewind) {
+        rewind->clear();
+    }
+    speculationEpoch = 0;
     cpu.reset();
     ppu.reset();
     timer.reset();
     apu.reset();
+    frameCycles = 0;
+    totalCycles = 0;
     buttons = 0x0F;
     dpad = 0x0F;
     mmu.setJoypad(buttons, dpad);
 }
 
-int GameBoy::step() {
+int GameBoy::tick(bool& frameEnded) {
+    if (totalCycles >= nextInputCycle) {
+        playMovieInputs();
+    }
     int cycles = cpu.step();
+    frameEnded = advance(cycles);
+    return cycles;
+}
+
+bool GameBoy::advance(int cycles) {
+    totalCycles += cycles;
     mmu.stepDMA(cycles);
     mmu.stepSerial(cycles);
     timer.step(cycles);
-    ppu.step(cycles);
     apu.step(cycles);
+    
+    // Frame ends at VBlank or, with the LCD off, after a frame's worth of cycles
+    return ppu.step(cycles) || (frameCycles += cycles) >= CYCLES_PER_FRAME;
+}
+
+void GameBoy::endFrame() {
+    // Frame may end without VBlank (LCD off mid-frame), draw what was logged
+    if (ppu.hasPendingLines()) {
+        ppu.flushPendingLines(true);
+    }
+    frameCycles = 0;
+    frameCompleted();
+}
+
+int GameBoy::step() {
+    bool frameEnded;
+    int cycles = tick(frameEnded);
+    if (frameEnded) {
+        endFrame();
+    }
     return cycles;
 }
 
+bool GameBoy::stepFrame() {
+    bool frameEnded;
+    tick(frameEnded);
+    if (frameEnded) {
+        endFrame();
+    }
+    return frameEnded;
+}
+
 int GameBoy::stepCPU() {
+    if (totalCycles >= nextInputCycle) {
+        playMovieInputs();
+    }
     int cycles = cpu.step();
+    totalCycles += cycles;
     mmu.stepDMA(cycles);  // Must step DMA to prevent it from blocking CPU reads forever
     return cycles;
 }
 
 void GameBoy::runFrame() {
-    int cyclesThisFrame = 0;
-    
-    while (cyclesThisFrame < CYCLES_PER_FRAME) {
-        int cycles = cpu.step();
-        mmu.stepDMA(cycles);
-        mmu.stepSerial(cycles);
-        timer.step(cycles);
-        apu.step(cycles);
+    if (turboFactor == 1) {
+        if (runAheadFrames > 0) {
+            runFrameAhead();
+        } else {
+            runSingleFrame();
+        }
+        return;
+    }
+    
+    // Only the frame that will be presented gets rasterised
+    for (int i = 0; i < turboFactor; i++) {
+        ppu.setRenderingSkipped(i < turboFactor - 1);
+        runSingleFrame();
+    }
+}
+
+void GameBoy::setTurbo(int factor) {
+    turboFactor = std::max(1, std::min(factor, 16));
+    ppu.setRenderingSkipped(false);
+    apu.setTimeStretch(turboFactor);
+}
+
+void GameBoy::setRunAhead(int frames) {
+    runAheadFrames = std::max(0, std::min(frames, 8));
+    resetRunAheadStats();
+    
+    if (runAheadFrames == 0) {
+        speculationRegisters = std::vector<uint8_t>();
+        speculationMemory = std::vector<uint8_t>();
+        return;
+    }
+    
+    StateWriter measure(nullptr, 0);
+    writeSections(measure, false);
+    speculationRegisters.resize(measure.size());
+}
+
+GameBoy::RunAheadStats GameBoy::getRunAheadStats() const {
+    RunAheadStats stats = runAheadTotals;
+    if (stats.frames > 0) {
+        stats.frameMicros /= stats.frames;
+        stats.speculationMicros /= stats.frames;
+        stats.snapshotMicros /= stats.frames;
+    }
+    return stats;
+}
+
+void GameBoy::resetRunAheadStats() {
+    runAheadTotals = RunAheadStats();
+}
+
+void GameBoy::runFrameAhead() {
+    using Clock = std::chrono::steady_clock;
+    auto micros = [](Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::micro>(to - from).count();
+    };
+    Clock::time_point start = Clock::now();
+    
+    // The real frame is heard but never shown
+    ppu.setRenderingSkipped(true);
+    runSingleFrame();
+    Clock::time_point realDone = Clock::now();
+    
+    saveSpeculationPoint();
+    Clock::time_point saved = Clock::now();
+    
+    // Speculate with the current input (a movie's own inputs during
+    // playback); only the last frame is drawn
+    speculating = true;
+    apu.setOutputSuspended(true);
+    for (int i = 0; i < runAheadFrames; i++) {
+        ppu.setRenderingSkipped(i < runAheadFrames - 1);
+        runSingleFrame();
+    }
+    apu.setOutputSuspended(false);
+    speculating = false;
+    Clock::time_point speculated = Clock::now();
+    
+    restoreSpeculationPoint();
+    if (movieMode == MOVIE_PLAYING) {
+        syncMovieCursors();
+    }
+    Clock::time_point restored = Clock::now();
+    
+    runAheadTotals.frames++;
+    runAheadTotals.frameMicros += micros(start, realDone);
+    runAheadTotals.speculationMicros += micros(saved, speculated);
+    runAheadTotals.snapshotMicros += micros(realDone, saved) + micros(speculated, restored);
+}
+
+void GameBoy::saveSpeculationPoint() {
+    StateWriter state(speculationRegisters.data(), speculationRegisters.size());
+    writeSections(state, false);
+    
+    int pageCount = mmu.getMemoryPageCount();
+    if (speculationMemory.size() != static_cast<size_t>(pageCount) * MMU::MEMORY_PAGE_SIZE) {
+        speculationMemory.assign(static_cast<size_t>(pageCount) * MMU::MEMORY_PAGE_SIZE, 0);
+        speculationEpoch = 0;
+    }
+    
+    // Bring the shadow copy up to date with the pages written since the last sync
+    for (int page = 0; page < pageCount; page++) {
+        if (mmu.isMemoryPageWritten(page, speculationEpoch)) {
+            int size;
+            const uint8_t* bytes = mmu.getMemoryPage(page, size);
+            std::memcpy(&speculationMemory[page * MMU::MEMORY_PAGE_SIZE], bytes, size);
+        }
+    }
+    speculationEpoch = mmu.beginMemoryEpoch();
+}
+
+void GameBoy::restoreSpeculationPoint() {
+    // Only pages written while speculating differ from the shadow copy
+    int pageCount = mmu.getMemoryPageCount();
+    for (int page = 0; page < pageCount; page++) {
+        if (mmu.isMemoryPageWritten(page, speculationEpoch)) {
+            int size;
+            uint8_t* bytes = mmu.getWritableMemoryPage(page, size);
+            std::memcpy(bytes, &speculationMemory[page * MMU::MEMORY_PAGE_SIZE], size);
+        }
+    }
+    speculationEpoch = mmu.beginMemoryEpoch();
+    mmu.invalidateMirrors();
+    
+    StateReader state(speculationRegisters.data(), speculationRegisters.size());
+    readSections(state);
+}
+
+void GameBoy::runSingleFrame() {
+    bool frameEnded = false;
+    while (!frameEnded) {
+        tick(frameEnded);
+    }
+    endFrame();
+}
+
+bool GameBoy::runLines(int count) {
+    int cyclesLeft = count * CYCLES_PER_LINE;
+    
+    while (cyclesLeft > 0) {
+        bool frameEnded;
+        cyclesLeft -= tick(frameEnded);
+        if (frameEnded) {
+            endFrame();
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+int GameBoy::runForSamples(int count) {
+    if (count <= 0) return 0;
+    
+    // Audio off generates nothing to count, run the equivalent time instead
+    const bool counting = apu.isOutputEnabled();
+    uint64_t targetSamples = apu.getSamplesGenerated() + count;
+    int64_t cyclesLeft = (static_cast<int64_t>(count) * APU::CLOCK_RATE + apu.getSampleRate() - 1) / apu.getSampleRate();
+    int frames = 0;
+    
+    while (counting ? apu.getSamplesGenerated() < targetSamples : cyclesLeft > 0) {
+        bool frameEnded;
+        cyclesLeft -= tick(frameEnded);
+        if (frameEnded) {
+            frames++;
+            endFrame();
+        }
+    }
+    
+    apu.flushSamples();
+    return frames;
+}
+
+int GameBoy::runUntilAudioFill(int level) {
+    apu.flushSamples();
+    int missing = level - apu.getOutputRing().readable();
+    return missing > 0 ? runForSamples(missing) : 0;
+}
+
+bool GameBoy::setThreadedRendering(bool enabled) {
+    if (enabled == (renderThread != nullptr)) {
+        return true;
+    }
+    
+    if (!enabled) {
+        ppu.setRenderThread(nullptr);
+        renderThread.reset();
+        return true;
+    }
+    
+    if (!ppu.isVideoOutputEnabled()) {
+        return false;
+    }
+    
+    auto thread = std::make_unique<RenderThread>();
+    if (!thread->start()) {
+        return false;
+    }
+    renderThread = std::move(thread);
+    ppu.setRenderThread(renderThread.get());
+    return true;
+}
+
+void GameBoy::setHeadless(bool headless) {
+    if (headless) {
+        setThreadedRendering(false);
+        ppu.setVideoOutputEnabled(false);
+        apu.releaseOutput();
+    } else {
+        ppu.setVideoOutputEnabled(true);
+        apu.setOutputEnabled(true);
+    }
+}
+
+GameBoy::MemoryUsage GameBoy::getMemoryUsage() const {
+    MemoryUsage usage;
+    usage.machine = sizeof(GameBoy);
+    usage.memory = mmu.getMemoryUsage();
+    usage.video = ppu.getMemoryUsage() + (renderThread ? sizeof(RenderThread) : 0);
+    usage.audio = apu.getMemoryUsage();
+    usage.history = rewindRegisters.capacity() + speculationRegisters.capacity() +
+                    speculationMemory.capacity() + movieStateBuffer.capacity() + loadBackup.capacity();
+    if (rewind) {
+        usage.history += sizeof(RewindBuffer) + rewind->getMemoryUsage();
+    }
+    usage.total = usage.machine + usage.memory + usage.video + usage.audio + usage.history;
+    return usage;
+}
+
+size_t GameBoy::getStateSize() const {
+    StateWriter state(nullptr, 0);
+    writeSections(state);
+    return STATE_HEADER_SIZE + state.size();
+}
+
+size_t GameBoy::saveState(uint8_t* buffer, size_t capacity) const {
+    size_t size = getStateSize();
+    if (!buffer || capacity < size) return 0;
+    
+    StateWriter state(buffer, capacity);
+    state.write(STATE_MAGIC);
+    state.write(STATE_VERSION);
+    state.write(static_cast<uint32_t>(size));
+    state.write(mmu.getROMChecksum());
+    writeSections(state);
+    return state.ok() ? state.size() : 0;
+}
+
+bool GameBoy::loadState(const uint8_t* data, size_t size) {
+    stopMovie();
+    return restoreState(data, size);
+}
+
+bool GameBoy::restoreState(const uint8_t* data, size_t size) {
+    if (!data || size != getStateSize()) return false;
+    
+    StateReader header(data, STATE_HEADER_SIZE);
+    if (header.get<uint32_t>() != STATE_MAGIC ||
+        header.get<uint32_t>() != STATE_VERSION ||
+        header.get<uint32_t>() != size ||
+        header.get<uint32_t>() != mmu.getROMChecksum()) {
+        return false;
+    }
+    
+    // Lines logged so far belong to the old state
+    if (ppu.hasPendingLines()) {
+        ppu.flushPendingLines();
+    }
+    
+    loadBackup.resize(size);
+    saveState(loadBackup.data(), loadBackup.size());
+    
+    StateReader state(data + STATE_HEADER_SIZE, size - STATE_HEADER_SIZE);
+    if (!readSections(state)) {
+        StateReader backup(loadBackup.data() + STATE_HEADER_SIZE, size - STATE_HEADER_SIZE);
+        readSections(backup);
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<GameBoy> GameBoy::fork() const {
+    auto child = std::make_unique<GameBoy>(isHeadless());
+    child->mmu.shareMemory(mmu);
+    
+    // Everything else through the save-state sections
+    StateWriter measure(nullptr, 0);
+    writeSections(measure, false);
+    std::vector<uint8_t> registers(measure.size());
+    StateWriter state(registers.data(), registers.size());
+    writeSections(state, false);
+    
+    StateReader reader(registers.data(), registers.size());
+    child->readSections(reader);
+    return child;
+}
+
+void GameBoy::writeSections(StateWriter& state, bool includeMemory) const {
+    state.beginSection(makeStateTag('C', 'P', 'U', ' '));
+    cpu.saveState(state);
+    state.endSection();
+    
+    state.beginSection(makeStateTag('T', 'I', 'M', 'R'));
+    timer.saveState(state);
+    state.endSection();
+    
+    state.beginSection(makeStateTag('M', 'M', 'U', ' '));
+    mmu.saveState(state);
+    state.endSection();
+    
+    if (includeMemory) {
+        state.beginSection(makeStateTag('M', 'E', 'M', ' '));
+        mmu.saveMemory(state);
+        state.endSection();
+    }
+    
+    state.beginSection(makeStateTag('P', 'P', 'U', ' '));
+    ppu.saveState(state);
+    state.endSection();
+    
+    state.beginSection(makeStateTag('A', 'P', 'U', ' '));
+    apu.saveState(state);
+    state.endSection();
+    
+    state.beginSection(makeStateTag('G', 'B', ' ', ' '));
+    state.write(buttons);
+    state.write(dpad);
+    state.write(frameCycles);
+    state.write(totalCycles);
+    state.endSection();
+}
+
+bool GameBoy::readSections(StateReader& state) {
+    if (state.beginSection(makeStateTag('C', 'P', 'U', ' '))) {
+        cpu.loadState(state);
+        state.endSection();
+    }
+    
+    if (state.beginSection(makeStateTag('T', 'I', 'M', 'R'))) {
+        timer.loadState(state);
+        state.endSection();
+    }
+    
+    if (state.beginSection(makeStateTag('M', 'M', 'U', ' '))) {
+        mmu.loadState(state);
+        state.endSection();
+    }
+    
+    // Absent from rewind frames
+    if (state.peekSection() == makeStateTag('M', 'E', 'M', ' ')) {
+        state.beginSection(makeStateTag('M', 'E', 'M', ' '));
+        mmu.loadMemory(state);
+        state.endSection();
+    }
+    
+    if (state.beginSection(makeStateTag('P', 'P', 'U', ' '))) {
+        ppu.loadState(state);
+        state.endSection();
+    }
+    
+    if (state.beginSection(makeStateTag('A', 'P', 'U', ' '))) {
+        apu.loadState(state);
+        state.endSection();
+    }
+    
+    if (state.beginSection(makeStateTag('G', 'B', ' ', ' '))) {
+        state.read(buttons);
+        state.read(dpad);
+        state.read(frameCycles);
+        state.read(totalCycles);
+        state.endSection();
+    }
+    
+    return state.ok() && state.remaining() == 0;
+}
+
+void GameBoy::setRewind(int seconds, size_t budgetBytes) {
+    if (seconds <= 0) {
+        rewind.reset();
+        rewindRegisters.clear();
+        rewindRegisters.shrink_to_fit();
+        return;
+    }
+    
+    rewind = std::make_unique<RewindBuffer>(mmu, seconds * 60, budgetBytes);
+    StateWriter measure(nullptr, 0);
+    writeSections(measure, false);
+    rewindRegisters.resize(measure.size());
+}
+
+void GameBoy::captureRewindFrame() {
+    StateWriter state(rewindRegisters.data(), rewindRegisters.size());
+    writeSections(state, false);
+    rewind->capture(rewindRegisters.data(), state.size());
+}
+
+bool GameBoy::rewindFrame() {
+    if (!rewind) return false;
+    
+    // Lines logged so far belong to the frame being dropped
+    if (ppu.hasPendingLines()) {
+        ppu.flushPendingLines();
+    }
+    
+    const std::vector<uint8_t>* registers = rewind->stepBack();
+    if (!registers) return false;
+    
+    StateReader state(registers->data(), registers->size());
+    readSections(state);
+    mmu.invalidateMirrors();
+    
+    // Keep the movie consistent with the rewound timeline
+    if (movieMode == MOVIE_RECORDING) {
+        movie->truncate(totalCycles);
+        uint64_t lastKeyframe = movie->keyframes.empty() ? movie->startCycle : movie->keyframes.back().cycle;
+        nextKeyframeCycle = keyframeInterval ? lastKeyframe + keyframeInterval : UINT64_MAX;
+    } else if (movieMode == MOVIE_PLAYING) {
+        syncMovieCursors();
+    }
+    return true;
+}
+
+void GameBoy::frameCompleted() {
+    if (speculating) return;
+    
+    if (movieMode != MOVIE_NONE) {
+        updateMovie();
+    }
+    if (rewind) {
+        captureRewindFrame();
+    }
+}
+
+bool GameBoy::startMovieRecording() {
+    stopMovie();
+    finishKeyframes();
+    
+    auto recording = std::make_unique<Movie>();
+    recording->initialState.resize(getStateSize());
+    if (saveState(recording->initialState.data(), recording->initialState.size()) == 0) {
+        return false;
+    }
+    recording->romHash = mmu.getROMHash();
+    recording->startCycle = totalCycles;
+    recording->endCycle = totalCycles;
+    recording->keyframeInterval = keyframeInterval;
+    
+    movie = std::move(recording);
+    movieMode = MOVIE_RECORDING;
+    movieFrames = 0;
+    movieFinished = false;
+    movieDesynced = false;
+    nextKeyframeCycle = keyframeInterval ? totalCycles + keyframeInterval : UINT64_MAX;
+    movieRTCBase = mmu.getRTCCycleBase(totalCycles);
+    mmu.setRTCCycleClock(&totalCycles, movieRTCBase);
+    return true;
+}
+
+bool GameBoy::startMoviePlayback(const uint8_t* data, size_t size) {
+    auto playback = std::make_unique<Movie>();
+    if (!data || !playback->deserialize(data, size) || playback->romHash != mmu.getROMHash()) {
+        return false;
+    }
+    if (!loadState(playback->initialState.data(), playback->initialState.size())) {
+        return false;
+    }
+    finishKeyframes();
+    
+    movie = std::move(playback);
+    movieMode = MOVIE_PLAYING;
+    movieFinished = false;
+    movieDesynced = false;
+    movieDesyncCycle = 0;
+    syncMovieCursors();
+    movieRTCBase = mmu.getRTCCycleBase(totalCycles);
+    mmu.setRTCCycleClock(&totalCycles, movieRTCBase);
+    return true;
+}
+
+void GameBoy::stopMovie() {
+    if (movieMode == MOVIE_RECORDING) {
+        movie->endCycle = totalCycles;
         
-        if (ppu.step(cycles)) {
-            // Frame complete
-            break;
+        // Compress the keyframes off the emulation thread
+#if GBEMU_HAS_THREADS
+        int threads = static_cast<int>(std::min(std::max(std::thread::hardware_concurrency(), 1u), 3u));
+        Movie* recording = movie.get();
+        keyframeWorker = std::thread([recording, threads] { recording->compressKeyframes(threads); });
+#else
+        movie->compressKeyframes(1);
+#endif
+    }
+    if (movieMode != MOVIE_NONE) {
+        mmu.setRTCCycleClock(nullptr, 0);
+    }
+    movieMode = MOVIE_NONE;
+    nextInputCycle = UINT64_MAX;
+}
+
+size_t GameBoy::saveMovie(uint8_t* buffer, size_t capacity) {
+    if (!movie) return 0;
+    
+    // While recording, the keyframes so far are written uncompressed
+    finishKeyframes();
+    if (movieMode == MOVIE_RECORDING) {
+        movie->endCycle = totalCycles;
+    }
+    return movie->serialize(buffer, capacity);
+}
+
+GameBoy::MovieStatus GameBoy::getMovieStatus() const {
+    MovieStatus status = MovieStatus();
+    status.mode = movieMode;
+    if (!movie) return status;
+    
+    bool recording = movieMode == MOVIE_RECORDING;
+    bool played = movieMode == MOVIE_PLAYING || movieFinished;
+    status.totalInputs = static_cast<uint32_t>(movie->inputs.size());
+    status.inputs = played ? static_cast<uint32_t>(movieInputIndex) : status.totalInputs;
+    status.checkpoints = static_cast<uint32_t>(played ? movieCheckpointIndex : movie->checkpoints.size());
+    status.cycle = movieMode != MOVIE_NONE ? totalCycles - movie->startCycle : 0;
+    status.length = (recording ? totalCycles : movie->endCycle) - movie->startCycle;
+    status.finished = movieFinished;
+    status.desynced = movieDesynced;
+    status.desyncCycle = movieDesyncCycle;
+    return status;
+}
+
+void GameBoy::setMovieKeyframeInterval(int seconds) {
+    keyframeInterval = static_cast<uint64_t>(std::max(seconds, 0)) * APU::CLOCK_RATE;
+}
+
+bool GameBoy::seekMovie(uint64_t cycle) {
+    if (!movie || (movieMode != MOVIE_PLAYING && !movieFinished)) return false;
+    finishKeyframes();
+    
+    uint64_t target = movie->startCycle + std::min(cycle, movie->endCycle - movie->startCycle);
+    
+    // Emulating on from the current position beats loading a keyframe that
+    // is not ahead of it
+    const Movie::Keyframe* keyframe = movie->findKeyframe(target);
+    bool ahead = movieMode == MOVIE_PLAYING && totalCycles <= target &&
+                 (!keyframe || keyframe->cycle <= totalCycles);
+    if (!ahead) {
+        bool loaded = keyframe && keyframe->stateSize == getStateSize() &&
+                      Movie::expandKeyframe(*keyframe, movieStateBuffer) &&
+                      restoreState(movieStateBuffer.data(), movieStateBuffer.size());
+        if (!loaded && !restoreState(movie->initialState.data(), movie->initialState.size())) {
+            return false;
+        }
+    }
+    
+    movieMode = MOVIE_PLAYING;
+    movieFinished = false;
+    syncMovieCursors();
+    mmu.setRTCCycleClock(&totalCycles, movieRTCBase);
+    
+    // Silent and undrawn up to the frame that reaches the target
+    bool audio = apu.isOutputEnabled();
+    bool skipped = ppu.isRenderingSkipped();
+    apu.setOutputEnabled(false);
+    while (movieMode == MOVIE_PLAYING && totalCycles < target) {
+        ppu.setRenderingSkipped(skipped || target - totalCycles > CYCLES_PER_FRAME);
+        runSingleFrame();
+    }
+    ppu.setRenderingSkipped(skipped);
+    apu.setOutputEnabled(audio);
+    return true;
+}
+
+void GameBoy::finishKeyframes() {
+#if GBEMU_HAS_THREADS
+    if (keyframeWorker.joinable()) {
+        keyframeWorker.join();
+    }
+#endif
+}
+
+void GameBoy::playMovieInputs() {
+    const std::vector<Movie::InputEvent>& inputs = movie->inputs;
+    while (movieInputIndex < inputs.size() && inputs[movieInputIndex].cycle <= totalCycles) {
+        applyButton(inputs[movieInputIndex].button, inputs[movieInputIndex].pressed);
+        movieInputIndex++;
+    }
+    nextInputCycle = movieInputIndex < inputs.size() ? inputs[movieInputIndex].cycle : UINT64_MAX;
+}
+
+void GameBoy::syncMovieCursors() {
+    // Events at the current cycle have not been applied yet, checkpoints at
+    // it have been checked
+    const std::vector<Movie::InputEvent>& inputs = movie->inputs;
+    movieInputIndex = std::lower_bound(inputs.begin(), inputs.end(), totalCycles,
+        [](const Movie::InputEvent& event, uint64_t cycle) { return event.cycle < cycle; }) - inputs.begin();
+    nextInputCycle = movieInputIndex < inputs.size() ? inputs[movieInputIndex].cycle : UINT64_MAX;
+    
+    const std::vector<Movie::Checkpoint>& checkpoints = movie->checkpoints;
+    movieCheckpointIndex = std::upper_bound(checkpoints.begin(), checkpoints.end(), totalCycles,
+        [](uint64_t cycle, const Movie::Checkpoint& checkpoint) { return cycle < checkpoint.cycle; }) - checkpoints.begin();
+}
+
+void GameBoy::updateMovie() {
+    if (movieMode == MOVIE_RECORDING) {
+        if (++movieFrames >= Movie::CHECKPOINT_INTERVAL) {
+            movieFrames = 0;
+            movie->checkpoints.push_back({ totalCycles, hashState() });
         }
         
-        cyclesThisFrame += cycles;
+        // Raw for now, compressed once recording stops
+        if (totalCycles >= nextKeyframeCycle) {
+            nextKeyframeCycle = totalCycles + keyframeInterval;
+            Movie::Keyframe keyframe;
+            keyframe.cycle = totalCycles;
+            keyframe.compressed = false;
+            keyframe.data.resize(getStateSize());
+            keyframe.stateSize = static_cast<uint32_t>(saveState(keyframe.data.data(), keyframe.data.size()));
+            movie->keyframes.push_back(std::move(keyframe));
+        }
+        return;
+    }
+    
+    // Playback: a checkpoint is due at a frame end that the recording also
+    // reached; one that falls between frame ends means the timing diverged
+    std::vector<Movie::Checkpoint>& checkpoints = movie->checkpoints;
+    while (movieCheckpointIndex < checkpoints.size() && checkpoints[movieCheckpointIndex].cycle <= totalCycles) {
+        const Movie::Checkpoint& checkpoint = checkpoints[movieCheckpointIndex++];
+        if (!movieDesynced && (checkpoint.cycle != totalCycles || checkpoint.stateHash != hashState())) {
+            movieDesynced = true;
+            movieDesyncCycle = checkpoint.cycle - movie->startCycle;
+        }
     }
+    
+    if (totalCycles >= movie->endCycle) {
+        movieFinished = true;
+        stopMovie();
+    }
+}
+
+uint64_t GameBoy::hashState() {
+    movieStateBuffer.resize(getStateSize());
+    size_t size = saveState(movieStateBuffer.data(), movieStateBuffer.size());
+    return Movie::hash(movieStateBuffer.data(), size);
 }
 
 void GameBoy::setButton(int button, bool pressed) {
+    // The movie owns the joypad during playback
+    if (movieMode == MOVIE_PLAYING) return;
+    
+    if (movieMode == MOVIE_RECORDING) {
+        // Releasing a released button changes nothing; a press always
+        // requests the joypad interrupt, so it is recorded even if held
+        uint8_t mask = 1 << (button & 0x03);
+        bool held = !((button < 4 ? buttons : dpad) & mask);
+        if (pressed || held) {
+            movie->inputs.push_back({ totalCycles, static_cast<uint8_t>(button), pressed });
+        }
+    }
+    
+    applyButton(button, pressed);
+}
+
+void GameBoy::applyButton(int button, bool pressed) {
     // Buttons are active LOW
     uint8_t mask = 1 << (button & 0x03);
     
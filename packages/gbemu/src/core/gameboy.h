@@ -1,12 +1,18 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "cpu.h"
 #include "mmu.h"
 #include "ppu.h"
 #include "timer.h"
 #include "apu.h"
+#include "render_thread.h"
+#include "rewind.h"
+#include "movie.h"
+#include "state.h"
 
 /**
  * GameBoy - Main emulator class
@@ -15,29 +21,189 @@
  */
 class GameBoy {
 public:
-    GameBoy();
+    // A headless machine is built without video and audio output buffers
+    // (see setHeadless)
+    explicit GameBoy(bool headless = false);
+    ~GameBoy();
     
     // Load ROM from buffer
     bool loadROM(const uint8_t* data, size_t size);
     
-    // Run one frame (~70224 cycles)
+    // Load a ROM image already in memory without copying it (InstancePool)
+    bool loadROM(const MMU::ROMImage& image);
+    
+    // Run one frame (~70224 cycles), or `turbo` frames in fast-forward
     void runFrame();
     
-    // Run single CPU step (with PPU/timer update)
+    // Fast-forward: each runFrame emulates `factor` frames (1-16), drawing
+    // only the last one and time-stretching the audio to the original pitch
+    void setTurbo(int factor);
+    int getTurbo() const { return turboFactor; }
+    
+    // Run-ahead: each runFrame runs the real frame without drawing it, then
+    // speculates `frames` (0-8) more with the current input and audio
+    // suspended, draws the last of them and restores the real state. Hides
+    // that many frames of the game's own input lag. Ignored in turbo.
+    void setRunAhead(int frames);
+    int getRunAhead() const { return runAheadFrames; }
+    
+    // Mean wall-clock cost per host frame since the last reset; the price of
+    // run-ahead is (speculation + snapshot) per frame, roughly K real frames
+    struct RunAheadStats {
+        int frames;                 // Host frames run with run-ahead
+        double frameMicros;         // The real frame
+        double speculationMicros;   // All speculative frames together
+        double snapshotMicros;      // Snapshot plus restore
+    };
+    RunAheadStats getRunAheadStats() const;
+    void resetRunAheadStats();
+    
+    // Run until `count` more scanlines have elapsed (456 cycles each) or the
+    // frame completes. Returns true on frame completion. Lets a presenter
+    // race the beam by emulating a frame in slices.
+    bool runLines(int count);
+    
+    // Audio-paced execution: run exactly long enough to generate `count`
+    // more output samples, or until the audio ring holds `level` frames.
+    // Returns the number of frames completed meanwhile. With audio output
+    // disabled the equivalent number of cycles is run instead.
+    int runForSamples(int count);
+    int runUntilAudioFill(int level);
+    
+    // Run single CPU step (with PPU/timer update), completing the frame if
+    // it ends one; returns the cycles taken
     int step();
     
+    // One instruction of runFrame's loop (no turbo or run-ahead); returns
+    // true when it completed the frame. Lets linked machines and lockstep
+    // lanes interleave instruction by instruction with runFrame's results.
+    bool stepFrame();
+    
     // Run single CPU instruction only (for tracing)
     int stepCPU();
     
     // Reset emulator
     void reset();
     
+    // Back to the state of a newly constructed machine with this ROM:
+    // unlike reset(), memory, cartridge RAM and I/O registers are cleared
+    // too. Host-side settings are kept. Allocates nothing.
+    void powerCycle();
+    
+    // Save states: a versioned, sectioned binary snapshot of the machine
+    // (see state.h). The framebuffer and host audio buffers are not part of
+    // it. saveState returns the bytes written, or 0 if `capacity` is too
+    // small. loadState rejects states from another ROM or format version
+    // and leaves the machine untouched on any error.
+    size_t getStateSize() const;
+    size_t saveState(uint8_t* buffer, size_t capacity) const;
+    bool loadState(const uint8_t* data, size_t size);
+    
+    // Copy-on-write fork for search: a new machine in exactly this state.
+    // It shares the ROM and the WRAM/cartridge RAM pages with this one
+    // until either side writes a page (256 bytes), so forking costs
+    // microseconds and memory grows with divergence, not with the number
+    // of forks. Host-side settings (audio output, rendering modes, rewind,
+    // movies, run-ahead) are not inherited, except that headless machines
+    // fork headless, and the framebuffer starts blank until the child
+    // completes a frame. The parent and its forks may then run on
+    // different threads; fork() itself runs on the parent's.
+    std::unique_ptr<GameBoy> fork() const;
+    
+    // Rewind: record every frame, keeping up to `seconds` of history within
+    // `budgetBytes` of memory. seconds <= 0 disables it and frees the history.
+    void setRewind(int seconds, size_t budgetBytes);
+    bool isRewindEnabled() const { return rewind != nullptr; }
+    
+    // Step back one frame; returns false when no older frame is recorded
+    bool rewindFrame();
+    int getRewindFrames() const { return rewind ? rewind->getFrameCount() : 0; }
+    size_t getRewindMemoryUsage() const { return rewind ? rewind->getMemoryUsage() : 0; }
+    
+    // Input movies (see movie.h). Recording starts from a snapshot of the
+    // current state and logs every joypad change with its exact cycle;
+    // saveMovie writes the movie so far (null buffer: size needed). Playback
+    // loads the movie's initial state and injects its inputs at their
+    // recorded cycles, ignoring live input, and checks the periodic state
+    // hashes to detect a desync. While a movie is active the RTC runs on
+    // emulated time. Loading a state or resetting stops it.
+    //
+    // Recordings keep a keyframe (full state) every `seconds` (default 5,
+    // 0 = none), compressed in the background when recording stops.
+    // seekMovie jumps a playing or finished movie to `cycle` (cycles since
+    // its start, MovieStatus::cycle): it loads the latest keyframe before
+    // the target when that is closer than the current position, then
+    // emulates the rest silently and undrawn except for the last frame,
+    // ending at the first frame end at or after the target.
+    enum MovieMode {
+        MOVIE_NONE = 0,
+        MOVIE_RECORDING = 1,
+        MOVIE_PLAYING = 2
+    };
+    struct MovieStatus {
+        int mode;                   // MovieMode
+        uint32_t inputs;            // Recorded, or played back so far
+        uint32_t totalInputs;       // Events in the movie
+        uint32_t checkpoints;       // Written, or verified so far
+        uint64_t cycle;             // Cycles since the movie started
+        uint64_t length;            // Movie length in cycles
+        bool finished;              // Playback reached the end
+        bool desynced;              // A state hash differed (or was skipped)
+        uint64_t desyncCycle;       // Cycles since the start at the first one
+    };
+    bool startMovieRecording();
+    bool startMoviePlayback(const uint8_t* data, size_t size);
+    void stopMovie();
+    size_t saveMovie(uint8_t* buffer, size_t capacity);
+    MovieStatus getMovieStatus() const;
+    void setMovieKeyframeInterval(int seconds);
+    bool seekMovie(uint64_t cycle);
+    
+    // Cycles emulated since the ROM was loaded (part of the save state)
+    uint64_t getTotalCycles() const { return totalCycles; }
+    static constexpr int CYCLES_PER_FRAME = 70224;
+    
     // Input handling
     void setButton(int button, bool pressed);
     
+    // Rasterise the frame in one pass at VBlank instead of per scanline
+    void setDeferredRendering(bool enabled) { ppu.setDeferredRendering(enabled); }
+    
+    // Rasterise on a dedicated render thread so runFrame returns as soon as
+    // the CPU side of the frame is done. Returns false without thread support
+    // or without video output.
+    bool setThreadedRendering(bool enabled);
+    bool isThreadedRendering() const { return renderThread != nullptr; }
+    
+    // Publish each scanline as soon as its pixels are final
+    void setScanlineCallback(PPU::ScanlineCallback callback, void* user) {
+        ppu.setScanlineCallback(callback, user);
+    }
+    
     // Get framebuffer for rendering
     const uint32_t* getFramebuffer() const { return ppu.getFramebuffer(); }
     
+    // Headless machines (training, search, servers) keep no framebuffer,
+    // render thread or audio buffers: nothing is drawn or synthesised and
+    // getFramebuffer shows a blank frame. Emulation is unchanged. Turning it
+    // off allocates video and audio output again. For output into memory
+    // of the caller's, see PPU::setFramebuffer and AudioRing::attach.
+    void setHeadless(bool headless);
+    bool isHeadless() const { return !ppu.isVideoOutputEnabled() && apu.isOutputReleased(); }
+    
+    // Bytes held by this machine alone, to budget many per host. The ROM
+    // image (shared by machines running it) and input movies are not
+    // counted.
+    struct MemoryUsage {
+        size_t machine;     // The GameBoy object itself
+        size_t memory;      // VRAM/OAM/HRAM and unshared WRAM/cartridge RAM pages
+        size_t video;       // Framebuffer and render thread
+        size_t audio;       // Synthesis buffers, time stretch and output ring
+        size_t history;     // Rewind, run-ahead and save-state scratch buffers
+        size_t total;
+    };
+    MemoryUsage getMemoryUsage() const;
+    
     // Screen dimensions
     static constexpr int SCREEN_WIDTH = PPU::SCREEN_WIDTH;
     static constexpr int SCREEN_HEIGHT = PPU::SCREEN_HEIGHT;
@@ -67,9 +233,102 @@ private:
     Timer timer;
     APU apu;
     
+    // Render thread (only while threaded rendering is enabled)
+    std::unique_ptr<RenderThread> renderThread;
+    
+    // Frame history (only while rewind is enabled)
+    std::unique_ptr<RewindBuffer> rewind;
+    std::vector<uint8_t> rewindRegisters;
+    void captureRewindFrame();
+    
+    // Cycles into the current frame, to end frames while the LCD is off
+    int frameCycles;
+    uint64_t totalCycles;
+    
+    // Movie being recorded or played back (kept after recording stops for
+    // saveMovie). Run loops call playMovieInputs once totalCycles reaches
+    // nextInputCycle, which is UINT64_MAX unless playing.
+    std::unique_ptr<Movie> movie;
+    MovieMode movieMode;
+    size_t movieInputIndex;
+    size_t movieCheckpointIndex;
+    uint64_t nextInputCycle;
+    int movieFrames;
+    bool movieFinished;
+    bool movieDesynced;
+    uint64_t movieDesyncCycle;
+    std::vector<uint8_t> movieStateBuffer;
+    uint64_t movieRTCBase;          // See MMU::setRTCCycleClock
+    uint64_t keyframeInterval;      // Cycles
+    uint64_t nextKeyframeCycle;
+#if GBEMU_HAS_THREADS
+    // Compresses a stopped recording's keyframes; joined before the movie
+    // is touched again
+    std::thread keyframeWorker;
+#endif
+    void finishKeyframes();
+    void playMovieInputs();
+    void syncMovieCursors();
+    void updateMovie();
+    uint64_t hashState();
+    
+    // One instruction and the hardware time it takes, shared by every run
+    // loop. Returns the cycles; frameEnded is set when the instruction ended
+    // a frame: VBlank or, with the LCD off, a frame's worth of cycles.
+    int tick(bool& frameEnded);
+    
+    // tick() after the CPU: the hardware time of an instruction that has
+    // executed. Returns true when it ended a frame.
+    bool advance(int cycles);
+    
+    // Close the frame tick() ended: draw logged lines, then frameCompleted
+    void endFrame();
+    
+    // Bookkeeping at the end of every (non-speculative) frame
+    void frameCompleted();
+    
+    int turboFactor;
+    
+    // Run-ahead: the register block and a shadow copy of every memory page
+    // at the last snapshot. Only pages written since (per MMU epoch) are
+    // copied in either direction.
+    int runAheadFrames;
+    bool speculating;
+    std::vector<uint8_t> speculationRegisters;
+    std::vector<uint8_t> speculationMemory;
+    uint32_t speculationEpoch;
+    RunAheadStats runAheadTotals;
+    void runFrameAhead();
+    void saveSpeculationPoint();
+    void restoreSpeculationPoint();
+    
+    void runSingleFrame();
+    
+    // setButton without the movie handling
+    void applyButton(int button, bool pressed);
+    
     // Joypad state (active low)
     uint8_t buttons;  // A, B, Select, Start
     uint8_t dpad;     // Right, Left, Up, Down
     
-    static constexpr int CYCLES_PER_FRAME = 70224;
+    // Save-state body (everything after the header). Rewind frames leave out
+    // the memory section; the rewind buffer tracks memory pages itself.
+    void writeSections(StateWriter& state, bool includeMemory = true) const;
+    bool readSections(StateReader& state);
+    
+    // loadState without stopping the movie (seeking loads keyframes)
+    bool restoreState(const uint8_t* data, size_t size);
+    
+    // Snapshot taken before loading, to roll back a state that turns out to
+    // be corrupt halfway through. Allocated on first load.
+    std::vector<uint8_t> loadBackup;
+    
+    static constexpr uint32_t STATE_MAGIC = makeStateTag('G', 'B', 'S', 'T');
+    static constexpr uint32_t STATE_VERSION = 2;
+    static constexpr size_t STATE_HEADER_SIZE = 16;  // Magic, version, size, ROM checksum
+    
+    static constexpr int CYCLES_PER_LINE = 456;
+    static constexpr int DEFAULT_KEYFRAME_SECONDS = 5;
+    
+    friend class LockstepGroup;
 };
@@ -0,0 +1,205 @@
+#include "instance_pool.h"
+#include <algorithm>
+#include <new>
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#define GBEMU_HAS_MMAP 1
+#else
+#define GBEMU_HAS_MMAP 0
+#endif
+
+namespace {
+
+constexpr size_t CACHE_LINE = 64;
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// WRAM and the largest cartridge RAM, in MMU pages, each with the
+// shared_ptr control block allocated alongside it
+constexpr size_t PAGES_PER_MACHINE = 0x20 + MMU::MAX_ERAM_SIZE / MMU::MEMORY_PAGE_SIZE;
+constexpr size_t PAGE_ALLOCATION = MMU::MEMORY_PAGE_SIZE + 64;
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+InstancePool::InstancePool(int capacity, bool hugePages, bool headless)
+    : capacity(std::max(capacity, 0))
+    , arena(nullptr)
+    , arenaSize(0)
+    , arenaUsed(0)
+    , arenaMapped(false)
+    , hugePagesUsed(false)
+    , headless(headless)
+    , slotSize(alignUp(sizeof(GameBoy), std::max(CACHE_LINE, alignof(GameBoy))))
+{
+    arenaSize = alignUp(this->capacity * (slotSize + PAGES_PER_MACHINE * PAGE_ALLOCATION), HUGE_PAGE_SIZE);
+
+#if GBEMU_HAS_MMAP
+    if (hugePages) {
+        void* mapping = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED) {
+            arena = static_cast<uint8_t*>(mapping);
+            hugePagesUsed = true;
+        }
+    }
+    if (!arena) {
+        void* mapping = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping != MAP_FAILED) {
+            arena = static_cast<uint8_t*>(mapping);
+#ifdef MADV_HUGEPAGE
+            // No reserved huge pages: let the kernel use transparent ones
+            if (hugePages && madvise(mapping, arenaSize, MADV_HUGEPAGE) == 0) {
+                hugePagesUsed = true;
+            }
+#endif
+        }
+    }
+    arenaMapped = arena != nullptr;
+#endif
+    if (!arena) {
+        arena = static_cast<uint8_t*>(::operator new(arenaSize, std::align_val_t(CACHE_LINE)));
+    }
+    
+    // Machines first, then their memory pages
+    arenaUsed = this->capacity * slotSize;
+    freeSlots.reserve(this->capacity);
+    for (int slot = 0; slot < this->capacity; slot++) {
+        GameBoy* gb = new (machine(slot)) GameBoy(headless);
+        reservePages(*gb);
+        freeSlots.push_back(this->capacity - 1 - slot);
+    }
+}
+
+InstancePool::~InstancePool() {
+    for (int slot = 0; slot < capacity; slot++) {
+        machine(slot)->~GameBoy();
+    }
+#if GBEMU_HAS_MMAP
+    if (arenaMapped) {
+        munmap(arena, arenaSize);
+        return;
+    }
+#endif
+    ::operator delete(arena, std::align_val_t(CACHE_LINE));
+}
+
+int InstancePool::addROM(const uint8_t* data, size_t size) {
+    if (!data || size < 0x150) return -1;
+    
+    auto image = std::make_shared<const std::vector<uint8_t>>(data, data + size);
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+    roms.push_back(std::move(image));
+    return static_cast<int>(roms.size()) - 1;
+}
+
+GameBoy* InstancePool::acquire(int rom) {
+    MMU::ROMImage image;
+    int slot;
+    {
+#if GBEMU_HAS_THREADS
+        std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+        if (rom < 0 || rom >= static_cast<int>(roms.size()) || freeSlots.empty()) {
+            return nullptr;
+        }
+        image = roms[rom];
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    
+    GameBoy* gb = machine(slot);
+    gb->loadROM(image);
+    reservePages(*gb);
+    gb->powerCycle();
+    return gb;
+}
+
+void InstancePool::release(GameBoy* gb) {
+    int slot = slotOf(gb);
+    if (slot < 0) return;
+    
+    restoreDefaults(*gb);
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+    freeSlots.push_back(slot);
+}
+
+bool InstancePool::swapROM(GameBoy* gb, int rom) {
+    if (slotOf(gb) < 0) return false;
+    
+    MMU::ROMImage image;
+    {
+#if GBEMU_HAS_THREADS
+        std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+        if (rom < 0 || rom >= static_cast<int>(roms.size())) return false;
+        image = roms[rom];
+    }
+    gb->loadROM(image);
+    reservePages(*gb);
+    gb->powerCycle();
+    return true;
+}
+
+int InstancePool::getAvailable() const {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+    return static_cast<int>(freeSlots.size());
+}
+
+void InstancePool::reservePages(GameBoy& gb) {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+    gb.getMMU().reservePages(Allocator<uint8_t>(this));
+}
+
+int InstancePool::slotOf(const GameBoy* gb) const {
+    const uint8_t* address = reinterpret_cast<const uint8_t*>(gb);
+    if (address < arena || address >= arena + capacity * slotSize) return -1;
+    
+    size_t offset = address - arena;
+    return offset % slotSize == 0 ? static_cast<int>(offset / slotSize) : -1;
+}
+
+void InstancePool::restoreDefaults(GameBoy& gb) {
+    gb.stopMovie();
+    gb.setRewind(0, 0);
+    gb.setRunAhead(0);
+    gb.setTurbo(1);
+    gb.setThreadedRendering(false);
+    gb.setDeferredRendering(false);
+    gb.setScanlineCallback(nullptr, nullptr);
+    gb.getMMU().setSerialCallback(nullptr, nullptr);
+    gb.getPPU().setRenderingSkipped(false);
+    gb.setHeadless(headless);
+    if (!headless) {
+        gb.getPPU().setFramebuffer(nullptr);
+    }
+    gb.getAPU().setChannelMask(0x0F);
+}
+
+void* InstancePool::allocate(size_t size, size_t alignment) {
+    size_t start = alignUp(arenaUsed, alignment);
+    if (start + size <= arenaSize) {
+        arenaUsed = start + size;
+        return arena + start;
+    }
+    return ::operator new(size);
+}
+
+void InstancePool::deallocate(void* pointer, size_t size) {
+    // Arena memory goes with the arena
+    uint8_t* address = static_cast<uint8_t*>(pointer);
+    if (address >= arena && address < arena + arenaSize) return;
+    ::operator delete(pointer, size);
+}
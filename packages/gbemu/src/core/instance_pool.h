@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "gameboy.h"
+#include "threads.h"
+
+/**
+ * InstancePool - Pre-allocated GameBoys for services that start and end
+ * sessions at a high rate
+ *
+ * All machines are constructed up front in one arena (a single mapping,
+ * optionally of huge pages), together with their WRAM pages; cartridge RAM
+ * pages are taken from it when a ROM that has them is first acquired, and
+ * stay with the machine. Since every page is reserved before it is
+ * written, emulation never allocates. ROM images are registered once with
+ * addROM and shared by every machine running them.
+ *
+ * acquire() powers a free machine on with a ROM in place and release()
+ * returns it; swapROM hot-swaps a running machine to another ROM. None of
+ * them touch the heap. Released machines get the default host-side
+ * settings back (no rewind, run-ahead, turbo, callbacks or render thread).
+ *
+ * A headless pool's machines have no framebuffer or audio buffers (see
+ * GameBoy::setHeadless), which leaves them well under 64KB each.
+ *
+ * acquire and release may be called from any thread; a machine itself is
+ * used by one thread at a time as usual. Forks of pooled machines must not
+ * outlive the pool.
+ */
+class InstancePool {
+public:
+    // `capacity` machines; `hugePages` asks for a huge-page backed arena
+    // and falls back to normal pages when none are available
+    explicit InstancePool(int capacity, bool hugePages = false, bool headless = false);
+    ~InstancePool();
+    
+    InstancePool(const InstancePool&) = delete;
+    InstancePool& operator=(const InstancePool&) = delete;
+    
+    // Register a ROM image (copied once); returns its id, or -1 if invalid
+    int addROM(const uint8_t* data, size_t size);
+    
+    // A machine powered on with ROM `rom`, or null if none is free
+    GameBoy* acquire(int rom);
+    void release(GameBoy* gb);
+    
+    // Power-cycle an acquired machine with another ROM
+    bool swapROM(GameBoy* gb, int rom);
+    
+    int getCapacity() const { return capacity; }
+    int getAvailable() const;
+    size_t getArenaSize() const { return arenaSize; }
+    bool isUsingHugePages() const { return hugePagesUsed; }
+    bool isHeadless() const { return headless; }
+    
+    // Bump allocation from the arena, for MMU::reservePages. Memory is
+    // never handed back individually; requests beyond the arena go to the
+    // heap.
+    template <typename T>
+    struct Allocator {
+        using value_type = T;
+        
+        explicit Allocator(InstancePool* pool) : pool(pool) {}
+        template <typename U>
+        Allocator(const Allocator<U>& other) : pool(other.pool) {}
+        
+        T* allocate(size_t count) {
+            return static_cast<T*>(pool->allocate(count * sizeof(T), alignof(T)));
+        }
+        void deallocate(T* pointer, size_t count) {
+            pool->deallocate(pointer, count * sizeof(T));
+        }
+        
+        template <typename U>
+        bool operator==(const Allocator<U>& other) const { return pool == other.pool; }
+        template <typename U>
+        bool operator!=(const Allocator<U>& other) const { return pool != other.pool; }
+        
+        InstancePool* pool;
+    };
+
+private:
+    int capacity;
+    uint8_t* arena;
+    size_t arenaSize;
+    size_t arenaUsed;
+    bool arenaMapped;
+    bool hugePagesUsed;
+    bool headless;
+    
+    size_t slotSize;                    // Bytes per GameBoy in the arena
+    std::vector<MMU::ROMImage> roms;
+    std::vector<int> freeSlots;         // Stack of free machine indices
+#if GBEMU_HAS_THREADS
+    mutable std::mutex poolMutex;
+#endif
+    
+    GameBoy* machine(int slot) { return reinterpret_cast<GameBoy*>(arena + slot * slotSize); }
+    int slotOf(const GameBoy* gb) const;
+    void restoreDefaults(GameBoy& gb);
+    
+    // Arena pages for the machine's WRAM and its ROM's cartridge RAM
+    void reservePages(GameBoy& gb);
+    
+    void* allocate(size_t size, size_t alignment);
+    void deallocate(void* pointer, size_t size);
+};
@@ -0,0 +1,47 @@
+#include "link_cable.h"
+
+LinkCable::LinkCable(GameBoy& first, GameBoy& second)
+    : first(first)
+    , second(second)
+    , maxLag(DEFAULT_MAX_LAG)
+    , transfers(0)
+    , firstStart(first.getTotalCycles())
+    , secondStart(second.getTotalCycles())
+{
+    first.getMMU().setSerialCallback(firstClocked, this);
+    second.getMMU().setSerialCallback(secondClocked, this);
+}
+
+LinkCable::~LinkCable() {
+    first.getMMU().setSerialCallback(nullptr, nullptr);
+    second.getMMU().setSerialCallback(nullptr, nullptr);
+}
+
+void LinkCable::runFrame() {
+    bool frameDone = false;
+    while (!frameDone) {
+        // First runs ahead by up to maxLag...
+        uint64_t limit = second.getTotalCycles() - secondStart + maxLag;
+        while (!frameDone && first.getTotalCycles() - firstStart < limit) {
+            frameDone = first.stepFrame();
+        }
+        
+        // ...then second catches up
+        uint64_t target = first.getTotalCycles() - firstStart;
+        while (second.getTotalCycles() - secondStart < target) {
+            second.stepFrame();
+        }
+    }
+}
+
+uint8_t LinkCable::firstClocked(void* user, uint8_t out) {
+    LinkCable* cable = static_cast<LinkCable*>(user);
+    cable->transfers++;
+    return cable->second.getMMU().receiveSerial(out);
+}
+
+uint8_t LinkCable::secondClocked(void* user, uint8_t out) {
+    LinkCable* cable = static_cast<LinkCable*>(user);
+    cable->transfers++;
+    return cable->first.getMMU().receiveSerial(out);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include "gameboy.h"
+
+/**
+ * LinkCable - Two in-process GameBoys connected through their link ports
+ *
+ * Whichever side clocks a transfer (internal clock) exchanges SB bytes with
+ * the other at the cycle its transfer completes; the other side's
+ * transfer, armed with the external clock, completes at that moment too
+ * (see MMU::receiveSerial).
+ *
+ * Instead of alternating every cycle, the machines take turns in slices:
+ * the first runs until it is `maxLag` cycles ahead of the second, then the
+ * second catches up to it. At any exchange the two are at most `maxLag`
+ * cycles apart, well inside the 4096-cycle byte time by default. Larger
+ * slices are cheaper; smaller ones model the peer's timing more closely.
+ *
+ * runFrame() runs until the first machine completes a frame; the second
+ * runs alongside it and completes its own frames on its own schedule.
+ * Neither machine may be run by anything else while connected.
+ */
+class LinkCable {
+public:
+    static constexpr int DEFAULT_MAX_LAG = 1024;  // Cycles
+    
+    LinkCable(GameBoy& first, GameBoy& second);
+    ~LinkCable();
+    
+    LinkCable(const LinkCable&) = delete;
+    LinkCable& operator=(const LinkCable&) = delete;
+    
+    void setMaxLag(int cycles) { maxLag = cycles < 4 ? 4 : cycles; }
+    int getMaxLag() const { return maxLag; }
+    
+    void runFrame();
+    
+    // Bytes exchanged since connecting
+    uint64_t getTransfers() const { return transfers; }
+
+private:
+    GameBoy& first;
+    GameBoy& second;
+    int maxLag;
+    uint64_t transfers;
+    
+    // Cycle counts when connected; both clocks are taken relative to them
+    uint64_t firstStart;
+    uint64_t secondStart;
+    
+    static uint8_t firstClocked(void* user, uint8_t out);
+    static uint8_t secondClocked(void* user, uint8_t out);
+};
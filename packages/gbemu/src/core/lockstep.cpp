@@ -0,0 +1,349 @@
+#include "lockstep.h"
+
+namespace {
+
+constexpr int REG_F = 6;
+constexpr int REG_A = 7;
+
+// Bytes and cycles of an opcode the lane-parallel path executes, or a
+// length of 0 if it needs the scalar CPU. Taken branches add 4 cycles.
+struct VectorOp {
+    int length;
+    int cycles;
+};
+
+VectorOp vectorOp(uint8_t opcode) {
+    int high = (opcode >> 3) & 7;
+    int low = opcode & 7;
+    switch (opcode) {
+        case 0x00: case 0x2F: case 0x37: case 0x3F: return {1, 4};  // NOP, CPL, SCF, CCF
+        case 0x03: case 0x13: case 0x23:                            // INC rr
+        case 0x0B: case 0x1B: case 0x2B: return {1, 8};             // DEC rr
+        case 0x18: return {2, 8};                                   // JR r8
+        case 0x20: case 0x28: case 0x30: case 0x38: return {2, 8};  // JR cc,r8
+        case 0xC3: return {3, 12};                                  // JP a16
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: return {3, 12};  // JP cc,a16
+    }
+    if (opcode < 0x40) {
+        if (high == 6) return {0, 0};
+        if (low == 4 || low == 5) return {1, 4};  // INC r, DEC r
+        if (low == 6) return {2, 8};              // LD r,d8
+        return {0, 0};
+    }
+    if (opcode < 0x80) return {high != 6 && low != 6 ? 1 : 0, 4};  // LD r,r'
+    if (opcode < 0xC0) return {low != 6 ? 1 : 0, 4};                // ALU A,r
+    return {low == 6 ? 2 : 0, 8};                                   // ALU A,d8
+}
+
+}
+
+LockstepGroup::LockstepGroup()
+    : laneCount(0)
+    , rendering(false)
+    , regs{}
+    , pcs{}
+    , opcodes{}
+    , operands{}
+    , operandsHigh{}
+    , laneMask{}
+    , laneCycles{}
+{
+    resetStats();
+}
+
+bool LockstepGroup::loadROM(const uint8_t* data, size_t size, int lanes) {
+    if (lanes < 1 || lanes > MAX_LANES) return false;
+    
+    GameBoy prototype;
+    if (!prototype.loadROM(data, size)) return false;
+    
+    for (auto& machine : machines) {
+        machine.reset();
+    }
+    laneCount = lanes;
+    for (int i = 0; i < laneCount; i++) {
+        machines[i] = prototype.fork();
+        machines[i]->getAPU().setOutputEnabled(false);
+        machines[i]->getPPU().setRenderingSkipped(!rendering);
+    }
+    return true;
+}
+
+void LockstepGroup::setRendering(bool enabled) {
+    rendering = enabled;
+    for (int i = 0; i < laneCount; i++) {
+        machines[i]->getPPU().setRenderingSkipped(!enabled);
+    }
+}
+
+void LockstepGroup::runFrames(int frames) {
+    for (int i = 0; i < frames; i++) {
+        runFrame();
+    }
+}
+
+void LockstepGroup::gather(int lane) {
+    const CPU& cpu = machines[lane]->cpu;
+    regs[0][lane] = cpu.b;
+    regs[1][lane] = cpu.c;
+    regs[2][lane] = cpu.d;
+    regs[3][lane] = cpu.e;
+    regs[4][lane] = cpu.h;
+    regs[5][lane] = cpu.l;
+    regs[REG_F][lane] = cpu.f;
+    regs[REG_A][lane] = cpu.a;
+    pcs[lane] = cpu.pc;
+}
+
+void LockstepGroup::scatter(int lane) {
+    CPU& cpu = machines[lane]->cpu;
+    cpu.b = regs[0][lane];
+    cpu.c = regs[1][lane];
+    cpu.d = regs[2][lane];
+    cpu.e = regs[3][lane];
+    cpu.h = regs[4][lane];
+    cpu.l = regs[5][lane];
+    cpu.f = regs[REG_F][lane];
+    cpu.a = regs[REG_A][lane];
+    cpu.pc = pcs[lane];
+}
+
+int LockstepGroup::fetch(int lane) {
+    GameBoy& gb = *machines[lane];
+    const CPU& cpu = gb.cpu;
+    
+    // Whatever CPU::step does before fetching must not apply
+    if (gb.totalCycles >= gb.nextInputCycle) return 0;
+    if (cpu.imeScheduled || cpu.halted || cpu.stopped || cpu.haltBug) return 0;
+    if (cpu.ime && (gb.mmu.read(0xFF0F) & gb.mmu.read(0xFFFF) & 0x1F)) return 0;
+    
+    uint16_t pc = pcs[lane];
+    uint8_t opcode = gb.mmu.read(pc);
+    int length = vectorOp(opcode).length;
+    if (length == 0) return 0;
+    
+    opcodes[lane] = opcode;
+    if (length >= 2) {
+        operands[lane] = gb.mmu.read(static_cast<uint16_t>(pc + 1));
+    }
+    if (length == 3) {
+        operandsHigh[lane] = gb.mmu.read(static_cast<uint16_t>(pc + 2));
+    }
+    return length;
+}
+
+void LockstepGroup::runFrame() {
+    uint32_t active = laneCount == 32 ? ~0u : (1u << laneCount) - 1;
+    for (int lane = 0; lane < laneCount; lane++) {
+        gather(lane);
+    }
+    
+    while (active) {
+        // Step the lanes the lane-parallel path can't run; collect the rest
+        uint32_t pending = 0;
+        for (int lane = 0; lane < laneCount; lane++) {
+            uint32_t bit = 1u << lane;
+            if (!(active & bit)) continue;
+            if (fetch(lane)) {
+                pending |= bit;
+                continue;
+            }
+            scatter(lane);
+            bool frameEnded = machines[lane]->stepFrame();
+            gather(lane);
+            if (frameEnded) {
+                active &= ~bit;
+            }
+            instructions++;
+        }
+        
+        // Execute each distinct opcode once for all lanes that fetched it
+        while (pending) {
+            uint8_t opcode = opcodes[__builtin_ctz(pending)];
+            uint32_t group = 0;
+            laneMask = LaneBytes{};
+            for (uint32_t lanes = pending; lanes; lanes &= lanes - 1) {
+                int lane = __builtin_ctz(lanes);
+                if (opcodes[lane] == opcode) {
+                    group |= 1u << lane;
+                    laneMask[lane] = 0xFF;
+                }
+            }
+            
+            execute(opcode);
+            
+            for (uint32_t lanes = group; lanes; lanes &= lanes - 1) {
+                int lane = __builtin_ctz(lanes);
+                GameBoy& gb = *machines[lane];
+                if (gb.advance(laneCycles[lane])) {
+                    scatter(lane);
+                    gb.endFrame();
+                    active &= ~(1u << lane);
+                }
+                instructions++;
+                vectorInstructions++;
+            }
+            pending &= ~group;
+            dispatches++;
+        }
+        
+        rounds++;
+    }
+}
+
+void LockstepGroup::execute(uint8_t opcode) {
+    typedef int8_t SignedBytes __attribute__((vector_size(MAX_LANES)));
+    typedef int16_t SignedWords __attribute__((vector_size(MAX_LANES * 2)));
+    
+    // Comparisons give -1 or 0 per lane; results are merged in as
+    // (value & mask) | (old & keep)
+    LaneBytes mask = laneMask;
+    LaneBytes keep = ~mask;
+    
+    VectorOp op = vectorOp(opcode);
+    LaneBytes& a = regs[REG_A];
+    LaneBytes& f = regs[REG_F];
+    laneCycles = LaneBytes{} + static_cast<uint8_t>(op.cycles);
+    pcs += __builtin_convertvector(mask & static_cast<uint8_t>(op.length), LaneWords);
+    
+    if (opcode == 0x00) return;  // NOP
+    
+    if (opcode == 0x2F) {  // CPL: N and H set
+        a = (~a & mask) | (a & keep);
+        f = ((f | 0x60) & mask) | (f & keep);
+        return;
+    }
+    if (opcode == 0x37) {  // SCF: N and H cleared
+        f = (((f & 0x9F) | 0x10) & mask) | (f & keep);
+        return;
+    }
+    if (opcode == 0x3F) {  // CCF: N and H cleared
+        f = (((f & 0x9F) ^ 0x10) & mask) | (f & keep);
+        return;
+    }
+    
+    // Branches: bit 4 of the opcode picks Z or C, bit 3 the expected value.
+    // Each lane's PC is past the operands already.
+    if (opcode == 0x18 || opcode == 0xC3 || (opcode & 0xE7) == 0x20 || (opcode & 0xE7) == 0xC2) {
+        LaneBytes taken = mask;
+        if (opcode != 0x18 && opcode != 0xC3) {
+            uint8_t flag = opcode & 0x10 ? 0x10 : 0x80;
+            uint8_t expected = opcode & 0x08 ? flag : 0;
+            taken &= (LaneBytes)((f & flag) == expected);
+        }
+        LaneWords target;
+        if (opcode < 0x40) {
+            target = pcs + (LaneWords)__builtin_convertvector((SignedBytes)operands, SignedWords);
+        } else {
+            target = __builtin_convertvector(operands, LaneWords) |
+                     (__builtin_convertvector(operandsHigh, LaneWords) << 8);
+        }
+        LaneWords takenWords = (LaneWords)__builtin_convertvector((SignedBytes)taken, SignedWords);
+        pcs = (target & takenWords) | (pcs & ~takenWords);
+        laneCycles += taken & 4;
+        return;
+    }
+    
+    int high = (opcode >> 3) & 7;
+    int low = opcode & 7;
+    
+    if (opcode < 0x40) {
+        if ((opcode & 0x07) == 0x03) {  // INC rr / DEC rr on BC, DE, HL
+            LaneBytes& pairHigh = regs[(opcode >> 4) * 2];
+            LaneBytes& pairLow = regs[(opcode >> 4) * 2 + 1];
+            LaneWords pair = (__builtin_convertvector(pairHigh, LaneWords) << 8) |
+                             __builtin_convertvector(pairLow, LaneWords);
+            pair = opcode & 0x08 ? pair - 1 : pair + 1;
+            pairHigh = (__builtin_convertvector(pair >> 8, LaneBytes) & mask) | (pairHigh & keep);
+            pairLow = (__builtin_convertvector(pair & 0xFF, LaneBytes) & mask) | (pairLow & keep);
+            return;
+        }
+        
+        LaneBytes& reg = regs[high];
+        if (low == 6) {  // LD r,d8
+            reg = (operands & mask) | (reg & keep);
+            return;
+        }
+        
+        // INC r / DEC r: C kept
+        LaneBytes value = low == 4 ? reg + 1 : reg - 1;
+        LaneBytes halfBits = low == 4 ? LaneBytes{} : LaneBytes{} + 0x0F;
+        LaneBytes flags = (f & 0x1F) | ((LaneBytes)(value == 0) & 0x80) |
+                          ((LaneBytes)((value & 0x0F) == halfBits) & 0x20);
+        if (low == 5) {
+            flags |= 0x40;
+        }
+        reg = (value & mask) | (reg & keep);
+        f = (flags & mask) | (f & keep);
+        return;
+    }
+    
+    LaneBytes source = opcode >= 0xC0 ? operands : regs[low];
+    if (opcode < 0x80) {  // LD r,r'
+        regs[high] = (source & mask) | (regs[high] & keep);
+        return;
+    }
+    
+    // ALU A,r / A,d8. Flags as in CPU::add8 and friends; bits 0-3 of F kept.
+    LaneBytes carry = high == 1 || high == 3 ? (f >> 4) & 1 : LaneBytes{};
+    LaneBytes result;
+    LaneBytes flags = f & 0x0F;
+    switch (high) {
+        case 0:  // ADD
+        case 1: {  // ADC
+            LaneBytes sum = a + source;
+            result = sum + carry;
+            flags |= ((LaneBytes)(result == 0) & 0x80) |
+                     ((LaneBytes)((a & 0x0F) + (source & 0x0F) + carry > 0x0F) & 0x20) |
+                     ((LaneBytes)(sum < a) & 0x10) | ((LaneBytes)(result < sum) & 0x10);
+            break;
+        }
+        case 2:  // SUB
+        case 3:  // SBC
+        case 7: {  // CP
+            LaneBytes difference = a - source;
+            LaneBytes full = difference - carry;
+            result = high == 7 ? a : full;
+            flags |= 0x40 | ((LaneBytes)(full == 0) & 0x80) |
+                     ((LaneBytes)((a & 0x0F) < (source & 0x0F) + carry) & 0x20) |
+                     ((LaneBytes)(a < source) & 0x10) | ((LaneBytes)(difference < carry) & 0x10);
+            break;
+        }
+        case 4:  // AND: H set
+            result = a & source;
+            flags |= 0x20 | ((LaneBytes)(result == 0) & 0x80);
+            break;
+        case 5:  // XOR
+            result = a ^ source;
+            flags |= (LaneBytes)(result == 0) & 0x80;
+            break;
+        default:  // OR
+            result = a | source;
+            flags |= (LaneBytes)(result == 0) & 0x80;
+            break;
+    }
+    a = (result & mask) | (a & keep);
+    f = (flags & mask) | (f & keep);
+}
+
+LockstepGroup::Stats LockstepGroup::getStats() const {
+    Stats stats = {};
+    stats.instructions = instructions;
+    stats.vectorInstructions = vectorInstructions;
+    stats.dispatches = dispatches;
+    stats.rounds = rounds;
+    if (instructions > 0) {
+        stats.vectorShare = static_cast<double>(vectorInstructions) / instructions;
+    }
+    if (dispatches > 0) {
+        stats.occupancy = static_cast<double>(vectorInstructions) / dispatches;
+    }
+    return stats;
+}
+
+void LockstepGroup::resetStats() {
+    instructions = 0;
+    vectorInstructions = 0;
+    dispatches = 0;
+    rounds = 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <memory>
+
+#include "gameboy.h"
+
+/**
+ * LockstepGroup - Experimental lockstep execution of one ROM on many lanes
+ *
+ * Up to MAX_LANES machines (8, 16 or 32 in practice) forked from one
+ * prototype, sharing the ROM image. Their CPU registers are held in
+ * structure-of-arrays form, one vector per register with a byte per lane,
+ * and every lane advances one instruction per round.
+ *
+ * Lanes that fetch the same register-only opcode (NOP, LD r,r', LD r,d8,
+ * INC/DEC r and rr, ALU A,r and A,d8, CPL, SCF, CCF, JR and JP with or
+ * without a condition) execute it together: every lane's result is
+ * computed in vector registers and a lane mask merges it in. A branch is
+ * taken per lane. Each of those lanes then runs its own hardware for the
+ * instruction's cycles. Everything else - memory operands, calls, the
+ * stack, interrupts, HALT, movie playback - falls back to the lane's
+ * scalar CPU. Lanes that branch apart simply fetch different opcodes and
+ * rejoin as soon as they fetch the same one again. A lane that finishes
+ * its frame is masked out of the remaining rounds.
+ *
+ * Results are identical to calling runFrame on each lane without turbo or
+ * run-ahead. Lanes may be used directly (getLane) between runFrames calls.
+ */
+class LockstepGroup {
+public:
+    static constexpr int MAX_LANES = 32;
+    
+    struct Stats {
+        uint64_t instructions;          // Instructions executed, all lanes together
+        uint64_t vectorInstructions;    // Of which executed by the lane-parallel path
+        uint64_t dispatches;            // Lane-parallel executions of one opcode
+        uint64_t rounds;                // One instruction per active lane
+        double vectorShare;             // vectorInstructions / instructions
+        double occupancy;               // Mean lanes per dispatch
+    };
+    
+    LockstepGroup();
+    
+    // Replace the group with `lanes` (1-MAX_LANES) fresh instances of this ROM
+    bool loadROM(const uint8_t* data, size_t size, int lanes);
+    
+    int getLaneCount() const { return laneCount; }
+    GameBoy& getLane(int lane) { return *machines[lane]; }
+    
+    // Draw every frame (default off)
+    void setRendering(bool enabled);
+    
+    // Run every lane `frames` frames
+    void runFrames(int frames);
+    
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    std::array<std::unique_ptr<GameBoy>, MAX_LANES> machines;
+    int laneCount;
+    bool rendering;
+    
+    // One byte or word per lane in a GCC/Clang vector: each operation
+    // covers every lane at once, in SIMD registers where the target has them
+    typedef uint8_t LaneBytes __attribute__((vector_size(MAX_LANES)));
+    typedef uint16_t LaneWords __attribute__((vector_size(MAX_LANES * 2)));
+    
+    // Lane registers, indexed like an opcode's register field: B, C, D, E,
+    // H, L, -, A. Field 6 is (HL), which the lane-parallel path never
+    // executes, so that row holds F. Only current while a frame runs; a
+    // lane's CPU is brought up to date whenever the lane leaves the round.
+    std::array<LaneBytes, 8> regs;
+    LaneWords pcs;
+    
+    // Per round: each lane's opcode and immediate operand bytes, the lanes
+    // (0xFF) executing the current dispatch and the cycles each one took
+    LaneBytes opcodes;
+    LaneBytes operands;
+    LaneBytes operandsHigh;
+    LaneBytes laneMask;
+    LaneBytes laneCycles;
+    
+    uint64_t instructions;
+    uint64_t vectorInstructions;
+    uint64_t dispatches;
+    uint64_t rounds;
+    
+    void runFrame();
+    
+    // Copy a lane's registers from its CPU, or back to it
+    void gather(int lane);
+    void scatter(int lane);
+    
+    // Fetch the lane's next instruction if the lane-parallel path can run
+    // it; returns its length in bytes, or 0 to step the lane's CPU instead
+    int fetch(int lane);
+    
+    // Execute `opcode` on the lanes in laneMask
+    void execute(uint8_t opcode);
+};
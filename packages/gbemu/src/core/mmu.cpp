@@ -1,63 +1,43 @@
 #include "mmu.h"
 #include "apu.h"
 #include "timer.h"
+#include "ppu.h"
+#include "state.h"
+#include <algorithm>
 #include <cstring>
 #include <ctime>
 
 MMU::MMU() 
-    : vram(0x2000, 0)
-    , eram(0x8000, 0)  // Max 32KB external RAM
-    , wram(0x2000, 0)
+    : rom(nullptr)
+    , romSize(0)
+    , vram(0x2000, 0)
     , oam(0xA0, 0)
     , hram(0x7F, 0)
+    , eramSize(0)       // Sized from the ROM header
     , mbcType(0)
-    , romBank(1)
-    , ramBank(0)
-    , ramEnabled(false)
-    , mbcMode(0)
-    , rtc{}
-    , rtcLatched{}
-    , rtcLatchState(0xFF)
-    , rtcSelected(false)
-    , joypadReg(0xCF)
-    , joypadButtons(0x0F)
-    , joypadDpad(0x0F)
-    , div(0)
-    , tima(0)
-    , tma(0)
-    , tac(0)
-    , sb(0)
-    , sc(0)
-    , serialCycles(0)
-    , serialActive(false)
-    , interruptFlag(0xE1)
-    , interruptEnable(0)
-    , lcdc(0x91)
-    , stat(0x85)
-    , scy(0)
-    , scx(0)
-    , ly(0)
-    , lyc(0)
-    , dma(0)
-    , bgp(0xFC)
-    , obp0(0xFF)
-    , obp1(0xFF)
-    , wy(0)
-    , wx(0)
-    , ppuMode(0)
-    , dmaActive(false)
-    , dmaSource(0)
-    , dmaCyclesLeft(0)
-    , dmaIndex(0)
+    , serialCallback(nullptr)
+    , serialUser(nullptr)
+    , memoryEpoch(0)
 {
-    // Initialize RTC with current time
-    rtc.lastTime = static_cast<uint64_t>(std::time(nullptr));
+    ownedPages.fill(false);
+    
+    // Cartridge RAM past the current ROM's size stays blank until a ROM uses it
+    std::fill(sharedPages.begin() + ERAM_PAGE, sharedPages.begin() + ERAM_PAGE + MAX_ERAM_PAGES, blankPage());
+    reset();
 }
 
 bool MMU::loadROM(const uint8_t* data, size_t size) {
     if (size < 0x150) return false;  // Minimum ROM size (header)
     
-    rom.assign(data, data + size);
+    return attachROM(std::make_shared<const std::vector<uint8_t>>(data, data + size));
+}
+
+bool MMU::attachROM(const ROMImage& image) {
+    if (!image || image->size() < 0x150) return false;
+    
+    romImage = image;
+    rom = image->data();
+    romSize = image->size();
     detectMBC();
     romBank = 1;
     ramBank = 0;
@@ -66,9 +46,69 @@ bool MMU::loadROM(const uint8_t* data, size_t size) {
     return true;
 }
 
+void MMU::reset() {
+    std::fill(vram.begin(), vram.end(), 0);
+    std::fill(oam.begin(), oam.end(), 0);
+    std::fill(hram.begin(), hram.end(), 0);
+    for (int page = WRAM_PAGE; page < getMemoryPageCount(); page++) {
+        if (page == OAM_PAGE || page == HRAM_PAGE) continue;
+        if (ownedPages[page]) {
+            sharedPages[page]->fill(0);
+        } else {
+            sharedPages[page] = blankPage();
+        }
+    }
+    
+    romBank = 1;
+    ramBank = 0;
+    ramEnabled = false;
+    mbcMode = 0;
+    rtc = {};
+    rtcLatched = {};
+    rtcLatchState = 0xFF;
+    rtcSelected = false;
+    rtc.lastTime = static_cast<uint64_t>(std::time(nullptr));
+    
+    joypadReg = 0xCF;
+    joypadButtons = 0x0F;
+    joypadDpad = 0x0F;
+    div = 0;
+    tima = 0;
+    tma = 0;
+    tac = 0;
+    sb = 0;
+    sc = 0;
+    serialCycles = 0;
+    serialActive = false;
+    interruptFlag = 0xE1;
+    interruptEnable = 0;
+    lcdc = 0x91;
+    stat = 0x85;
+    scy = 0;
+    scx = 0;
+    ly = 0;
+    lyc = 0;
+    dma = 0;
+    bgp = 0xFC;
+    obp0 = 0xFF;
+    obp1 = 0xFF;
+    wy = 0;
+    wx = 0;
+    ppuMode = 0;
+    dmaActive = false;
+    dmaSource = 0;
+    dmaCyclesLeft = 0;
+    dmaIndex = 0;
+    
+    vramDirtyPages = ~0u;
+    oamDirty = true;
+    touchAllMemory();
+}
+
 void MMU::detectMBC() {
-    if (rom.size() < 0x148) {
+    if (romSize < 0x150) {
         mbcType = 0;
+        eramSize = 0;
         return;
     }
     
@@ -82,6 +122,16 @@ void MMU::detectMBC() {
         case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E: mbcType = 5; break;  // MBC5
         default: mbcType = 0; break;
     }
+    
+    // Only the RAM the cartridge has is part of the machine (and its save
+    // states); MBC2's built-in 512x4 bits are not declared in the header
+    static const uint32_t ramSizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+    uint8_t ramCode = rom[0x149];
+    eramSize = ramCode < 6 ? ramSizes[ramCode] : 0;
+    if (mbcType == 2) {
+        eramSize = 0x200;
+    }
+    eramSize = std::min(eramSize, MAX_ERAM_SIZE);
 }
 
 void MMU::handleMBCWrite(uint16_t addr, uint8_t val) {
@@ -174,13 +224,13 @@ uint32_t MMU::getROMOffset(uint16_t addr) {
     } else {
         // Switchable bank
         uint32_t offset = (romBank << 14) | (addr & 0x3FFF);
-        return offset % rom.size();
+        return offset % romSize;
     }
 }
 
 uint16_t MMU::getRAMOffset(uint16_t addr) {
     uint32_t offset = (ramBank << 13) | (addr & 0x1FFF);
-    return offset % eram.size();
+    return offset % eramSize;
 }
 
 void MMU::setJoypad(uint8_t buttons, uint8_t dpad) {
@@ -188,6 +238,12 @@ void MMU::setJoypad(uint8_t buttons, uint8_t dpad) {
     joypadDpad = dpad;
 }
 
+void MMU::flushPendingLines() {
+    if (ppu && ppu->hasPendingLines()) {
+        ppu->flushPendingLines();
+    }
+}
+
 void MMU::startDMATransfer(uint8_t val) {
     // Start DMA transfer - takes 160 M-cycles (640 T-cycles)
     dmaSource = val << 8;
@@ -199,6 +255,8 @@ void MMU::startDMATransfer(uint8_t val) {
 void MMU::stepDMA(int cycles) {
     if (!dmaActive) return;
     
+    flushPendingLines();
+    
     // Transfer one byte per M-cycle
     while (cycles > 0 && dmaIndex < 0xA0) {
         // Read from source and write to OAM
@@ -208,21 +266,23 @@ void MMU::stepDMA(int cycles) {
         
         // Read from source based on address range
         if (srcAddr < 0x4000) {
-            val = (srcAddr < rom.size()) ? rom[getROMOffset(srcAddr)] : 0xFF;
+            val = (srcAddr < romSize) ? rom[getROMOffset(srcAddr)] : 0xFF;
         } else if (srcAddr < 0x8000) {
             uint32_t offset = getROMOffset(srcAddr);
-            val = (offset < rom.size()) ? rom[offset] : 0xFF;
+            val = (offset < romSize) ? rom[offset] : 0xFF;
         } else if (srcAddr < 0xA000) {
             val = vram[srcAddr - 0x8000];
         } else if (srcAddr < 0xC000) {
-            val = ramEnabled ? eram[getRAMOffset(srcAddr)] : 0xFF;
+            val = (ramEnabled && eramSize) ? readERAM(getRAMOffset(srcAddr)) : 0xFF;
         } else if (srcAddr < 0xE000) {
-            val = wram[srcAddr - 0xC000];
+            val = readWRAM(srcAddr - 0xC000);
         } else if (srcAddr < 0xFE00) {
-            val = wram[srcAddr - 0xE000];  // Echo RAM
+            val = readWRAM(srcAddr - 0xE000);  // Echo RAM
         }
         
         oam[dmaIndex] = val;
+        oamDirty = true;
+        touchMemoryPage(OAM_PAGE);
         dmaIndex++;
         cycles--;
         dmaCyclesLeft--;
@@ -242,7 +302,7 @@ uint8_t MMU::read(uint16_t addr) {
     
     // ROM Bank 0
     if (addr < 0x4000) {
-        if (addr < rom.size()) {
+        if (addr < romSize) {
             return rom[getROMOffset(addr)];
         }
         return 0xFF;
@@ -251,7 +311,7 @@ uint8_t MMU::read(uint16_t addr) {
     // ROM Bank 1-N
     if (addr < 0x8000) {
         uint32_t offset = getROMOffset(addr);
-        if (offset < rom.size()) {
+        if (offset < romSize) {
             return rom[offset];
         }
         return 0xFF;
@@ -269,23 +329,23 @@ uint8_t MMU::read(uint16_t addr) {
         if (!ramEnabled) return 0xFF;
         // MBC2 has built-in 512x4 bit RAM (only lower 4 bits valid)
         if (mbcType == 2) {
-            return eram[addr & 0x1FF] | 0xF0;  // Upper 4 bits always 1
+            return readERAM(addr & 0x1FF) | 0xF0;  // Upper 4 bits always 1
         }
         // MBC3 RTC register access
         if (mbcType == 3 && rtcSelected) {
             return readRTC(ramBank);
         }
-        return eram[getRAMOffset(addr)];
+        return eramSize ? readERAM(getRAMOffset(addr)) : 0xFF;
     }
     
     // WRAM
     if (addr < 0xE000) {
-        return wram[addr - 0xC000];
+        return readWRAM(addr - 0xC000);
     }
     
     // Echo RAM
     if (addr < 0xFE00) {
-        return wram[addr - 0xE000];
+        return readWRAM(addr - 0xE000);
     }
     
     // OAM
@@ -358,6 +418,20 @@ uint8_t MMU::read(uint16_t addr) {
     return interruptEnable;
 }
 
+uint8_t MMU::peek(uint16_t addr) {
+    if (addr >= 0xC000 && addr < 0xFE00) {
+        return readWRAM((addr - 0xC000) & 0x1FFF);
+    }
+    if (addr >= 0xFF80 && addr < 0xFFFF) {
+        return hram[addr - 0xFF80];
+    }
+    if (addr >= 0xA000 && addr < 0xC000 && !(mbcType == 3 && rtcSelected)) {
+        if (mbcType == 2) return readERAM(addr & 0x1FF) | 0xF0;
+        return eramSize ? readERAM(getRAMOffset(addr)) : 0xFF;
+    }
+    return read(addr);
+}
+
 void MMU::write(uint16_t addr, uint8_t val) {
     // During DMA, only HRAM (0xFF80-0xFFFE) and I/O registers (0xFF00-0xFF7F) are accessible
     if (dmaActive && addr < 0xFF00) {
@@ -373,7 +447,10 @@ void MMU::write(uint16_t addr, uint8_t val) {
     // VRAM
     if (addr < 0xA000) {
         if (ppuMode != 3) {
+            flushPendingLines();
             vram[addr - 0x8000] = val;
+            vramDirtyPages |= 1u << ((addr - 0x8000) >> 8);
+            touchMemoryPage(VRAM_PAGE + ((addr - 0x8000) >> 8));
         }
         return;
     }
@@ -383,12 +460,12 @@ void MMU::write(uint16_t addr, uint8_t val) {
         if (ramEnabled) {
             // MBC2 has built-in 512x4 bit RAM (only lower 4 bits stored)
             if (mbcType == 2) {
-                eram[addr & 0x1FF] = val & 0x0F;
+                writeERAM(addr & 0x1FF, val & 0x0F);
             } else if (mbcType == 3 && rtcSelected) {
                 // MBC3 RTC register write
                 writeRTC(ramBank, val);
-            } else {
-                eram[getRAMOffset(addr)] = val;
+            } else if (eramSize) {
+                writeERAM(getRAMOffset(addr), val);
             }
         }
         return;
@@ -396,20 +473,23 @@ void MMU::write(uint16_t addr, uint8_t val) {
     
     // WRAM
     if (addr < 0xE000) {
-        wram[addr - 0xC000] = val;
+        writeWRAM(addr - 0xC000, val);
         return;
     }
     
     // Echo RAM
     if (addr < 0xFE00) {
-        wram[addr - 0xE000] = val;
+        writeWRAM(addr - 0xE000, val);
         return;
     }
     
     // OAM
     if (addr < 0xFEA0) {
         if (ppuMode < 2) {
+            flushPendingLines();
             oam[addr - 0xFE00] = val;
+            oamDirty = true;
+            touchMemoryPage(OAM_PAGE);
         }
         return;
     }
@@ -429,7 +509,7 @@ void MMU::write(uint16_t addr, uint8_t val) {
                 // Start serial transfer if bit 7 set (transfer start) and bit 0 set (internal clock)
                 if ((val & 0x81) == 0x81) {
                     serialActive = true;
-                    serialCycles = 512;  // 8 bits at 8192 Hz = 512 T-cycles
+                    serialCycles = SERIAL_TRANSFER_CYCLES;
                 }
                 break;
             case 0xFF04:  // Writing any value resets DIV
@@ -474,6 +554,7 @@ void MMU::write(uint16_t addr, uint8_t val) {
     // HRAM
     if (addr < 0xFFFF) {
         hram[addr - 0xFF80] = val;
+        touchMemoryPage(HRAM_PAGE);
         return;
     }
     
@@ -485,7 +566,7 @@ void MMU::updateRTC() {
     // Only update if RTC is not halted
     if (rtc.daysHigh & 0x40) return;
     
-    uint64_t currentTime = static_cast<uint64_t>(std::time(nullptr));
+    uint64_t currentTime = getRTCTime();
     uint64_t elapsed = currentTime - rtc.lastTime;
     rtc.lastTime = currentTime;
     
@@ -537,7 +618,7 @@ void MMU::writeRTC(uint8_t reg, uint8_t val) {
     }
     
     // Reset time base after write
-    rtc.lastTime = static_cast<uint64_t>(std::time(nullptr));
+    rtc.lastTime = getRTCTime();
 }
 
 void MMU::stepSerial(int cycles) {
@@ -549,7 +630,271 @@ void MMU::stepSerial(int cycles) {
         // Transfer complete
         serialActive = false;
         sc &= 0x7F;  // Clear transfer flag (bit 7)
-        sb = 0xFF;   // No external device, receive 0xFF
+        sb = serialCallback ? serialCallback(serialUser, sb) : 0xFF;  // 0xFF: no external device
         interruptFlag |= 0x08;  // Request serial interrupt
     }
 }
+
+void MMU::setSerialCallback(SerialCallback callback, void* user) {
+    serialCallback = callback;
+    serialUser = user;
+}
+
+uint8_t MMU::receiveSerial(uint8_t in) {
+    uint8_t out = sb;
+    sb = in;
+    
+    // Transfer armed with external clock (bit 7 set, bit 0 clear)
+    if ((sc & 0x81) == 0x80) {
+        sc &= 0x7F;
+        interruptFlag |= 0x08;
+    }
+    return out;
+}
+
+uint32_t MMU::getROMChecksum() const {
+    if (romSize < 0x150) return 0;
+    return (rom[0x14D] << 16) | (rom[0x14E] << 8) | rom[0x14F];
+}
+
+uint64_t MMU::getROMHash() const {
+    // FNV-1a 64
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < romSize; i++) {
+        hash ^= rom[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void MMU::setRTCCycleClock(const uint64_t* cycles, uint64_t base) {
+    rtcCycles = cycles;
+    rtcCycleBase = base;
+}
+
+uint64_t MMU::getRTCTime() const {
+    if (rtcCycles) {
+        return rtcCycleBase + *rtcCycles / CYCLES_PER_SECOND;
+    }
+    return static_cast<uint64_t>(std::time(nullptr));
+}
+
+void MMU::saveState(StateWriter& state) const {
+    const RTC* clocks[2] = { &rtc, &rtcLatched };
+    
+    // MBC and RTC
+    state.write(romBank);
+    state.write(ramBank);
+    state.write(ramEnabled);
+    state.write(mbcMode);
+    for (const RTC* clock : clocks) {
+        state.write(clock->seconds);
+        state.write(clock->minutes);
+        state.write(clock->hours);
+        state.write(clock->daysLow);
+        state.write(clock->daysHigh);
+        state.write(clock->lastTime);
+    }
+    state.write(rtcLatchState);
+    state.write(rtcSelected);
+    
+    // I/O registers
+    state.write(joypadReg);
+    state.write(joypadButtons);
+    state.write(joypadDpad);
+    state.write(div);
+    state.write(tima);
+    state.write(tma);
+    state.write(tac);
+    state.write(sb);
+    state.write(sc);
+    state.write(serialCycles);
+    state.write(serialActive);
+    state.write(interruptFlag);
+    state.write(interruptEnable);
+    state.write(lcdc);
+    state.write(stat);
+    state.write(scy);
+    state.write(scx);
+    state.write(ly);
+    state.write(lyc);
+    state.write(dma);
+    state.write(bgp);
+    state.write(obp0);
+    state.write(obp1);
+    state.write(wy);
+    state.write(wx);
+    state.write(ppuMode);
+    
+    // DMA
+    state.write(dmaActive);
+    state.write(dmaSource);
+    state.write(dmaCyclesLeft);
+    state.write(dmaIndex);
+}
+
+void MMU::loadState(StateReader& state) {
+    RTC* clocks[2] = { &rtc, &rtcLatched };
+    
+    state.read(romBank);
+    state.read(ramBank);
+    state.read(ramEnabled);
+    state.read(mbcMode);
+    for (RTC* clock : clocks) {
+        state.read(clock->seconds);
+        state.read(clock->minutes);
+        state.read(clock->hours);
+        state.read(clock->daysLow);
+        state.read(clock->daysHigh);
+        state.read(clock->lastTime);
+    }
+    state.read(rtcLatchState);
+    state.read(rtcSelected);
+    
+    state.read(joypadReg);
+    state.read(joypadButtons);
+    state.read(joypadDpad);
+    state.read(div);
+    state.read(tima);
+    state.read(tma);
+    state.read(tac);
+    state.read(sb);
+    state.read(sc);
+    state.read(serialCycles);
+    state.read(serialActive);
+    state.read(interruptFlag);
+    state.read(interruptEnable);
+    state.read(lcdc);
+    state.read(stat);
+    state.read(scy);
+    state.read(scx);
+    state.read(ly);
+    state.read(lyc);
+    state.read(dma);
+    state.read(bgp);
+    state.read(obp0);
+    state.read(obp1);
+    state.read(wy);
+    state.read(wx);
+    state.read(ppuMode);
+    
+    state.read(dmaActive);
+    state.read(dmaSource);
+    state.read(dmaCyclesLeft);
+    state.read(dmaIndex);
+}
+
+void MMU::saveMemory(StateWriter& state) const {
+    state.writeBytes(vram.data(), vram.size());
+    for (int page = WRAM_PAGE; page < OAM_PAGE; page++) {
+        state.writeBytes(sharedPages[page]->data(), MEMORY_PAGE_SIZE);
+    }
+    state.writeBytes(oam.data(), oam.size());
+    state.writeBytes(hram.data(), hram.size());
+    state.write(eramSize);
+    for (int page = ERAM_PAGE; page < getMemoryPageCount(); page++) {
+        int size;
+        const uint8_t* bytes = getMemoryPage(page, size);
+        state.writeBytes(bytes, size);
+    }
+}
+
+void MMU::loadMemory(StateReader& state) {
+    state.readBytes(vram.data(), vram.size());
+    for (int page = WRAM_PAGE; page < OAM_PAGE; page++) {
+        state.readBytes(writableSharedPage(page), MEMORY_PAGE_SIZE);
+    }
+    state.readBytes(oam.data(), oam.size());
+    state.readBytes(hram.data(), hram.size());
+    if (state.get<uint32_t>() != eramSize) {
+        state.fail();
+        return;
+    }
+    for (int page = ERAM_PAGE; page < getMemoryPageCount(); page++) {
+        int size;
+        uint8_t* bytes = getWritableMemoryPage(page, size);
+        state.readBytes(bytes, size);
+    }
+    
+    // Everything may have changed under the render thread's mirror
+    vramDirtyPages = ~0u;
+    oamDirty = true;
+    touchAllMemory();
+}
+
+int MMU::getMemoryPageCount() const {
+    return ERAM_PAGE + static_cast<int>(eramSize + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+}
+
+size_t MMU::getMemoryUsage() const {
+    size_t bytes = vram.capacity() + oam.capacity() + hram.capacity();
+    for (int page = WRAM_PAGE; page < ERAM_PAGE + MAX_ERAM_PAGES; page++) {
+        if (ownedPages[page]) {
+            bytes += sizeof(MemoryPage);
+        }
+    }
+    return bytes;
+}
+
+const uint8_t* MMU::getMemoryPage(int page, int& size) const {
+    size = MEMORY_PAGE_SIZE;
+    if (page < WRAM_PAGE) return &vram[(page - VRAM_PAGE) * MEMORY_PAGE_SIZE];
+    if (page < OAM_PAGE) return sharedPages[page]->data();
+    if (page == OAM_PAGE) {
+        size = static_cast<int>(oam.size());
+        return oam.data();
+    }
+    if (page == HRAM_PAGE) {
+        size = static_cast<int>(hram.size());
+        return hram.data();
+    }
+    
+    size_t offset = static_cast<size_t>(page - ERAM_PAGE) * MEMORY_PAGE_SIZE;
+    size = static_cast<int>(std::min<size_t>(MEMORY_PAGE_SIZE, eramSize - offset));
+    return sharedPages[page]->data();
+}
+
+uint8_t* MMU::getWritableMemoryPage(int page, int& size) {
+    getMemoryPage(page, size);
+    if (page < WRAM_PAGE) return &vram[(page - VRAM_PAGE) * MEMORY_PAGE_SIZE];
+    if (page == OAM_PAGE) return oam.data();
+    if (page == HRAM_PAGE) return hram.data();
+    return writableSharedPage(page);
+}
+
+std::shared_ptr<MMU::MemoryPage> MMU::blankPage() {
+    static const std::shared_ptr<MemoryPage> page = std::make_shared<MemoryPage>();
+    return page;
+}
+
+void MMU::unsharePage(int page) {
+    // Other holders keep the original
+    sharedPages[page] = std::make_shared<MemoryPage>(*sharedPages[page]);
+    ownedPages[page] = true;
+}
+
+void MMU::shareMemory(const MMU& parent) {
+    romImage = parent.romImage;
+    rom = parent.rom;
+    romSize = parent.romSize;
+    mbcType = parent.mbcType;
+    eramSize = parent.eramSize;
+    
+    vram = parent.vram;
+    oam = parent.oam;
+    hram = parent.hram;
+    sharedPages = parent.sharedPages;
+    ownedPages.fill(false);
+    
+    // Only pages the parent still owns are written, so forking a parent
+    // that has already given them up is read-only and may run concurrently
+    for (int page = 0; page < MAX_MEMORY_PAGES; page++) {
+        if (parent.ownedPages[page]) {
+            parent.ownedPages[page] = false;
+        }
+    }
+    
+    vramDirtyPages = ~0u;
+    oamDirty = true;
+    touchAllMemory();
+}
@@ -1,11 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <array>
+#include <memory>
 #include <vector>
 
 // Forward declarations
 class APU;
 class Timer;
+class PPU;
+class StateWriter;
+class StateReader;
 
 /**
  * Memory Management Unit - Handles GameBoy's 64KB address space
@@ -31,8 +36,86 @@ public:
     uint8_t read(uint16_t addr);
     void write(uint16_t addr, uint8_t val);
     
-    // ROM loading
+    // Read for tools (reward functions, cheats): WRAM, HRAM and cartridge
+    // RAM as stored, regardless of DMA or the RAM enable; anything else as
+    // read() sees it
+    uint8_t peek(uint16_t addr);
+    
+    // ROM loading. attachROM takes an image already in memory and shares it
+    // instead of copying (forks and InstancePool do this).
+    using ROMImage = std::shared_ptr<const std::vector<uint8_t>>;
     bool loadROM(const uint8_t* data, size_t size);
+    bool attachROM(const ROMImage& image);
+    
+    // Power-on state: I/O and MBC registers as at construction, VRAM, WRAM
+    // and cartridge RAM cleared. The ROM stays attached. Pages this MMU
+    // owns alone are cleared in place, so nothing is allocated.
+    void reset();
+    
+    // Give every WRAM and cartridge RAM page storage of its own from
+    // `allocator` up front, so later writes never allocate (see
+    // InstancePool). Pages shared with a fork are copied. Cartridge RAM is
+    // reserved as far as the attached ROM has it.
+    template <typename Allocator>
+    void reservePages(const Allocator& allocator) {
+        for (int page = WRAM_PAGE; page < getMemoryPageCount(); page++) {
+            if (page == OAM_PAGE || page == HRAM_PAGE) continue;
+            if (!ownedPages[page]) {
+                sharedPages[page] = std::allocate_shared<MemoryPage>(allocator, *sharedPages[page]);
+                ownedPages[page] = true;
+            }
+        }
+    }
+    
+    // Cartridge header checksums, identifies the ROM a save state belongs to
+    uint32_t getROMChecksum() const;
+    
+    // Hash of the whole ROM image, identifies the ROM an input movie belongs to
+    uint64_t getROMHash() const;
+    
+    // Save-state serialisation (see state.h): registers/MBC/RTC/DMA/serial,
+    // and the RAM contents as a separate section
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+    void saveMemory(StateWriter& state) const;
+    void loadMemory(StateReader& state);
+    
+    // Memory as 256-byte pages for incremental snapshots (rewind, run-ahead):
+    // VRAM, WRAM, OAM, HRAM, then cartridge RAM. Every write stamps its page
+    // with the current epoch. A snapshot owner starts a new epoch whenever it
+    // syncs, and later asks which pages were written since.
+    static constexpr int MEMORY_PAGE_SIZE = 0x100;
+    static constexpr int MAX_MEMORY_PAGES = 256;
+    int getMemoryPageCount() const;
+    
+    // Cartridge RAM as declared by the ROM header (0x149; 512 bytes for
+    // MBC2), up to MAX_ERAM_SIZE. Zero before a ROM is loaded.
+    static constexpr uint32_t MAX_ERAM_SIZE = 0x8000;
+    uint32_t getERAMSize() const { return eramSize; }
+    
+    // Bytes held by this MMU alone: VRAM/OAM/HRAM and the WRAM and
+    // cartridge RAM pages not shared with a fork (or the blank page). The
+    // ROM image is shared and not counted.
+    size_t getMemoryUsage() const;
+    const uint8_t* getMemoryPage(int page, int& size) const;
+    uint8_t* getWritableMemoryPage(int page, int& size);
+    uint32_t beginMemoryEpoch() { return ++memoryEpoch; }
+    bool isMemoryPageWritten(int page, uint32_t sinceEpoch) const { return pageEpochs[page] >= sinceEpoch; }
+    void touchMemoryPage(int page) { pageEpochs[page] = memoryEpoch; }
+    void touchAllMemory() { pageEpochs.fill(memoryEpoch); }
+    
+    // Copy-on-write fork: take `parent`'s ROM and cartridge type, share its
+    // WRAM and cartridge RAM pages (copied by whichever side writes one
+    // first) and copy VRAM/OAM/HRAM. Registers are transferred separately.
+    // Afterwards neither side writes the shared pages in place, so the two
+    // may run on different threads. Only writes to `parent` when it still
+    // owns pages, so forks of a parent that already has none may be taken
+    // on several threads at once.
+    void shareMemory(const MMU& parent);
+    
+    // Memory was rewritten behind the MMU's back: resend VRAM/OAM to the
+    // render thread
+    void invalidateMirrors() { vramDirtyPages = ~0u; oamDirty = true; }
     
     // Direct VRAM access for PPU
     uint8_t* getVRAM() { return vram.data(); }
@@ -66,21 +149,76 @@ public:
     // Serial transfer
     void stepSerial(int cycles);
     
+    // Link port. When a transfer clocked by this side (internal clock)
+    // completes, the callback gets the byte shifted out and returns the
+    // byte shifted in; without one the port reads 0xFF as with nothing
+    // attached. receiveSerial is the other direction: a peer clocked a
+    // byte in, which completes a transfer waiting on the external clock
+    // (and otherwise only shifts SB). Returns the byte shifted out.
+    using SerialCallback = uint8_t (*)(void* user, uint8_t out);
+    void setSerialCallback(SerialCallback callback, void* user);
+    uint8_t receiveSerial(uint8_t in);
+    static constexpr int SERIAL_TRANSFER_CYCLES = 4096;  // 8 bits at 8192 Hz
+    
     // APU reference for audio register access
     void setAPU(APU* apuPtr) { apu = apuPtr; }
     
     // Timer reference for DIV write callback
     void setTimer(Timer* timerPtr) { timer = timerPtr; }
     
+    // PPU reference for flushing deferred scanlines before VRAM/OAM writes
+    void setPPU(PPU* ppuPtr) { ppu = ppuPtr; }
+    
+    // Drive the MBC3 RTC from emulated time instead of the host clock, for
+    // reproducible movies: the time is `base` plus *cycles in seconds, where
+    // `cycles` is the machine's running cycle count. Null switches back to
+    // the host clock. getRTCCycleBase gives the base that continues the
+    // clock from its current time.
+    void setRTCCycleClock(const uint64_t* cycles, uint64_t base);
+    uint64_t getRTCCycleBase(uint64_t cycles) const { return rtc.lastTime - cycles / CYCLES_PER_SECOND; }
+    
 private:
     // Memory regions
-    std::vector<uint8_t> rom;           // Cartridge ROM
+    ROMImage romImage;                  // Cartridge ROM, shared by forks
+    const uint8_t* rom;                 // romImage data
+    size_t romSize;
     std::vector<uint8_t> vram;          // Video RAM (8KB)
-    std::vector<uint8_t> eram;          // External/Cartridge RAM (up to 32KB)
-    std::vector<uint8_t> wram;          // Work RAM (8KB)
     std::vector<uint8_t> oam;           // Sprite Attribute Table (160 bytes)
     std::vector<uint8_t> hram;          // High RAM (127 bytes)
     
+    // Work RAM (8KB) and external/cartridge RAM (up to 32KB) are kept in
+    // reference-counted pages, indexed by page number, so forks can share
+    // them. A page held elsewhere is copied before it is written; untouched
+    // pages all share one blank page.
+    using MemoryPage = std::array<uint8_t, MEMORY_PAGE_SIZE>;
+    std::array<std::shared_ptr<MemoryPage>, MAX_MEMORY_PAGES> sharedPages;
+    
+    // Pages this MMU made itself and has never shared, the only ones
+    // written in place. Ownership is explicit rather than use_count() == 1,
+    // which would not order a write against a fork on another thread still
+    // copying the page. Cleared on both sides by shareMemory (hence mutable).
+    mutable std::array<bool, MAX_MEMORY_PAGES> ownedPages;
+    uint32_t eramSize;
+    static std::shared_ptr<MemoryPage> blankPage();
+    void unsharePage(int page);
+    
+    uint8_t* writableSharedPage(int page) {
+        if (!ownedPages[page]) {
+            unsharePage(page);
+        }
+        return sharedPages[page]->data();
+    }
+    uint8_t readWRAM(uint16_t offset) const { return (*sharedPages[WRAM_PAGE + (offset >> 8)])[offset & 0xFF]; }
+    uint8_t readERAM(uint16_t offset) const { return (*sharedPages[ERAM_PAGE + (offset >> 8)])[offset & 0xFF]; }
+    void writeWRAM(uint16_t offset, uint8_t val) {
+        writableSharedPage(WRAM_PAGE + (offset >> 8))[offset & 0xFF] = val;
+        touchMemoryPage(WRAM_PAGE + (offset >> 8));
+    }
+    void writeERAM(uint16_t offset, uint8_t val) {
+        writableSharedPage(ERAM_PAGE + (offset >> 8))[offset & 0xFF] = val;
+        touchMemoryPage(ERAM_PAGE + (offset >> 8));
+    }
+    
     // MBC (Memory Bank Controller) state
     uint8_t mbcType;
     uint8_t romBank;
@@ -118,6 +256,8 @@ private:
     uint8_t sc;             // 0xFF02 - Serial control
     int serialCycles;       // Cycles remaining for serial transfer
     bool serialActive;      // True during serial transfer
+    SerialCallback serialCallback;
+    void* serialUser;
     
     // Interrupt registers
     uint8_t interruptFlag;  // 0xFF0F - IF
@@ -152,6 +292,35 @@ private:
     // Timer reference for DIV write callback
     Timer* timer = nullptr;
     
+    // PPU reference for deferred rendering
+    PPU* ppu = nullptr;
+    
+    // Emulated RTC time source: seconds = base + *cycles / clock rate
+    const uint64_t* rtcCycles = nullptr;
+    uint64_t rtcCycleBase = 0;
+    uint64_t getRTCTime() const;
+    static constexpr uint64_t CYCLES_PER_SECOND = 4194304;
+    
+    // VRAM pages (256 bytes, bit N = page N) and OAM written since the PPU
+    // last published them to its render thread
+    uint32_t vramDirtyPages;
+    bool oamDirty;
+    
+    // Epoch of the last write to each memory page (32 bits: years of frames)
+    uint32_t memoryEpoch;
+    std::array<uint32_t, MAX_MEMORY_PAGES> pageEpochs;
+    
+    // First page of each region in the page numbering above
+    static constexpr int VRAM_PAGE = 0;
+    static constexpr int WRAM_PAGE = 0x20;
+    static constexpr int OAM_PAGE = 0x40;
+    static constexpr int HRAM_PAGE = 0x41;
+    static constexpr int ERAM_PAGE = 0x42;
+    static constexpr int MAX_ERAM_PAGES = MAX_ERAM_SIZE / MEMORY_PAGE_SIZE;
+    
+    // Rasterise deferred scanlines before VRAM/OAM they were logged against changes
+    void flushPendingLines();
+    
     // MBC handling
     void handleMBCWrite(uint16_t addr, uint8_t val);
     uint32_t getROMOffset(uint16_t addr);
@@ -0,0 +1,202 @@
+#include "movie.h"
+#include "packbits.h"
+#include "state.h"
+#include "threads.h"
+#include <algorithm>
+
+static constexpr uint32_t MOVIE_MAGIC = makeStateTag('G', 'B', 'M', 'V');
+static constexpr uint32_t TAG_HEADER = makeStateTag('H', 'E', 'A', 'D');
+static constexpr uint32_t TAG_INITIAL = makeStateTag('I', 'N', 'I', 'T');
+static constexpr uint32_t TAG_INPUTS = makeStateTag('I', 'N', 'P', 'T');
+static constexpr uint32_t TAG_HASHES = makeStateTag('H', 'A', 'S', 'H');
+static constexpr uint32_t TAG_KEYFRAMES = makeStateTag('K', 'E', 'Y', 'S');
+
+size_t Movie::serialize(uint8_t* buffer, size_t capacity) const {
+    StateWriter movie(buffer, capacity);
+    movie.write(MOVIE_MAGIC);
+    movie.write(FORMAT_VERSION);
+    
+    movie.beginSection(TAG_HEADER);
+    movie.write(romHash);
+    movie.write(startCycle);
+    movie.write(endCycle);
+    movie.endSection();
+    
+    movie.beginSection(TAG_INITIAL);
+    movie.writeBytes(initialState.data(), initialState.size());
+    movie.endSection();
+    
+    movie.beginSection(TAG_INPUTS);
+    movie.write(static_cast<uint32_t>(inputs.size()));
+    for (const InputEvent& event : inputs) {
+        movie.write(event.cycle);
+        movie.write(event.button);
+        movie.write(event.pressed);
+    }
+    movie.endSection();
+    
+    movie.beginSection(TAG_HASHES);
+    movie.write(static_cast<uint32_t>(checkpoints.size()));
+    for (const Checkpoint& checkpoint : checkpoints) {
+        movie.write(checkpoint.cycle);
+        movie.write(checkpoint.stateHash);
+    }
+    movie.endSection();
+    
+    movie.beginSection(TAG_KEYFRAMES);
+    movie.write(keyframeInterval);
+    movie.write(static_cast<uint32_t>(keyframes.size()));
+    for (const Keyframe& keyframe : keyframes) {
+        movie.write(keyframe.cycle);
+        movie.write(keyframe.compressed);
+        movie.write(keyframe.stateSize);
+        movie.write(static_cast<uint32_t>(keyframe.data.size()));
+        movie.writeBytes(keyframe.data.data(), keyframe.data.size());
+    }
+    movie.endSection();
+    
+    return movie.ok() ? movie.size() : 0;
+}
+
+bool Movie::deserialize(const uint8_t* data, size_t size) {
+    StateReader movie(data, size);
+    if (movie.get<uint32_t>() != MOVIE_MAGIC || movie.get<uint32_t>() != FORMAT_VERSION) {
+        return false;
+    }
+    
+    if (movie.beginSection(TAG_HEADER)) {
+        movie.read(romHash);
+        movie.read(startCycle);
+        movie.read(endCycle);
+        movie.endSection();
+    }
+    
+    // The initial state is the whole section payload
+    if (movie.beginSection(TAG_INITIAL)) {
+        initialState.resize(movie.sectionRemaining());
+        movie.readBytes(initialState.data(), initialState.size());
+        movie.endSection();
+    }
+    
+    if (movie.beginSection(TAG_INPUTS)) {
+        uint32_t count = movie.get<uint32_t>();
+        if (count > movie.remaining() / 10) movie.fail();
+        inputs.resize(movie.ok() ? count : 0);
+        for (InputEvent& event : inputs) {
+            movie.read(event.cycle);
+            movie.read(event.button);
+            movie.read(event.pressed);
+        }
+        movie.endSection();
+    }
+    
+    if (movie.beginSection(TAG_HASHES)) {
+        uint32_t count = movie.get<uint32_t>();
+        if (count > movie.remaining() / 16) movie.fail();
+        checkpoints.resize(movie.ok() ? count : 0);
+        for (Checkpoint& checkpoint : checkpoints) {
+            movie.read(checkpoint.cycle);
+            movie.read(checkpoint.stateHash);
+        }
+        movie.endSection();
+    }
+    
+    // Optional: movies without keyframes seek from the initial state
+    keyframeInterval = 0;
+    keyframes.clear();
+    if (movie.peekSection() == TAG_KEYFRAMES && movie.beginSection(TAG_KEYFRAMES)) {
+        movie.read(keyframeInterval);
+        uint32_t count = movie.get<uint32_t>();
+        if (count > movie.remaining() / 17) movie.fail();
+        keyframes.resize(movie.ok() ? count : 0);
+        for (Keyframe& keyframe : keyframes) {
+            movie.read(keyframe.cycle);
+            movie.read(keyframe.compressed);
+            movie.read(keyframe.stateSize);
+            uint32_t length = movie.get<uint32_t>();
+            if (length > movie.remaining()) {
+                movie.fail();
+                break;
+            }
+            keyframe.data.resize(length);
+            movie.readBytes(keyframe.data.data(), length);
+        }
+        movie.endSection();
+    }
+    
+    // Sections added by later versions
+    while (movie.ok() && movie.remaining() > 0) {
+        movie.skipSection();
+    }
+    
+    return movie.ok();
+}
+
+void Movie::truncate(uint64_t cycle) {
+    auto inputEnd = std::lower_bound(inputs.begin(), inputs.end(), cycle,
+        [](const InputEvent& event, uint64_t value) { return event.cycle < value; });
+    inputs.erase(inputEnd, inputs.end());
+    
+    auto checkpointEnd = std::upper_bound(checkpoints.begin(), checkpoints.end(), cycle,
+        [](uint64_t value, const Checkpoint& checkpoint) { return value < checkpoint.cycle; });
+    checkpoints.erase(checkpointEnd, checkpoints.end());
+    
+    auto keyframeEnd = std::upper_bound(keyframes.begin(), keyframes.end(), cycle,
+        [](uint64_t value, const Keyframe& keyframe) { return value < keyframe.cycle; });
+    keyframes.erase(keyframeEnd, keyframes.end());
+}
+
+void Movie::compressKeyframes(int threads) {
+    // Keyframes are independent; thread i takes every threads-th one
+    auto compress = [this](size_t first, size_t step) {
+        std::vector<uint8_t> packed;
+        for (size_t i = first; i < keyframes.size(); i += step) {
+            Keyframe& keyframe = keyframes[i];
+            if (keyframe.compressed) continue;
+            
+            packed.resize(packBitsBound(keyframe.data.size()));
+            packed.resize(packBits(keyframe.data.data(), keyframe.data.size(), packed.data()));
+            keyframe.data.assign(packed.begin(), packed.end());
+            keyframe.compressed = true;
+        }
+    };
+    
+#if GBEMU_HAS_THREADS
+    size_t count = std::max<size_t>(1, std::min<size_t>(threads, keyframes.size()));
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < count; i++) {
+        workers.emplace_back(compress, i, count);
+    }
+    compress(0, count);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+#else
+    (void)threads;
+    compress(0, 1);
+#endif
+}
+
+const Movie::Keyframe* Movie::findKeyframe(uint64_t cycle) const {
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), cycle,
+        [](uint64_t value, const Keyframe& keyframe) { return value < keyframe.cycle; });
+    return next == keyframes.begin() ? nullptr : &*(next - 1);
+}
+
+bool Movie::expandKeyframe(const Keyframe& keyframe, std::vector<uint8_t>& state) {
+    if (!keyframe.compressed) {
+        state = keyframe.data;
+        return state.size() == keyframe.stateSize;
+    }
+    state.resize(keyframe.stateSize);
+    return unpackBits(keyframe.data.data(), keyframe.data.size(), state.data(), state.size());
+}
+
+uint64_t Movie::hash(const uint8_t* data, size_t size) {
+    uint64_t value = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        value ^= data[i];
+        value *= 1099511628211ull;
+    }
+    return value;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Movie - Deterministic input recording
+ *
+ * A movie is the machine state at the start of the recording plus every
+ * joypad event, tagged with the exact emulated cycle it happened at. Playing
+ * it back from the same state with the events injected at the same cycles
+ * reproduces the run bit for bit, independent of host timing.
+ *
+ * Every CHECKPOINT_INTERVAL frames the recorder also stores a hash of the
+ * full machine state, so playback can tell the first point where it
+ * diverged (desync) instead of silently drifting.
+ *
+ * Every few seconds it also keeps a full save state (keyframe). Seeking
+ * loads the latest keyframe before the target and only emulates the rest,
+ * so any point of a long movie is reached in well under a second. States
+ * are snapshotted raw while recording (a memcpy) and PackBits-compressed
+ * in parallel once recording stops.
+ *
+ * File format (sections as in state.h, little-endian):
+ *   magic 'GBMV', format version
+ *   'HEAD'  ROM hash (FNV-1a 64 of the whole ROM), start and end cycle
+ *   'INIT'  initial save state
+ *   'INPT'  event count, then per event: cycle (u64), button, pressed
+ *   'HASH'  checkpoint count, then per checkpoint: cycle (u64), state hash (u64)
+ *   'KEYS'  interval (u64 cycles), keyframe count, then per keyframe: cycle
+ *           (u64), compressed flag, state size (u32), data length (u32), data
+ * Unknown sections after these are skipped.
+ */
+class Movie {
+public:
+    struct InputEvent {
+        uint64_t cycle;     // GameBoy::getTotalCycles() when the event happened
+        uint8_t button;     // GameBoy::Button
+        bool pressed;
+    };
+    
+    struct Checkpoint {
+        uint64_t cycle;
+        uint64_t stateHash;
+    };
+    
+    struct Keyframe {
+        uint64_t cycle;
+        uint32_t stateSize;         // Size of the save state
+        bool compressed;
+        std::vector<uint8_t> data;
+    };
+    
+    static constexpr int CHECKPOINT_INTERVAL = 60;  // Frames
+    
+    uint64_t romHash = 0;
+    uint64_t startCycle = 0;    // Cycle count in the initial state
+    uint64_t endCycle = 0;      // Cycle count when recording stopped
+    std::vector<uint8_t> initialState;
+    std::vector<InputEvent> inputs;
+    std::vector<Checkpoint> checkpoints;
+    uint64_t keyframeInterval = 0;  // Cycles
+    std::vector<Keyframe> keyframes;
+    
+    // Write the movie to `buffer`, returns bytes written (0 if it does not
+    // fit). With a null buffer returns the size needed.
+    size_t serialize(uint8_t* buffer, size_t capacity) const;
+    
+    // Replace the contents from a serialized movie; false if malformed
+    bool deserialize(const uint8_t* data, size_t size);
+    
+    // Rewound recording: drop the events at or after `cycle` (they had not
+    // happened yet in the state at `cycle`) and the checkpoints and
+    // keyframes after it
+    void truncate(uint64_t cycle);
+    
+    // Compress the keyframes that are still raw, spread over up to
+    // `threads` threads (the calling one included)
+    void compressKeyframes(int threads);
+    
+    // Latest keyframe at or before `cycle`, or null
+    const Keyframe* findKeyframe(uint64_t cycle) const;
+    
+    // Save state held by a keyframe; false if the data is corrupt
+    static bool expandKeyframe(const Keyframe& keyframe, std::vector<uint8_t>& state);
+    
+    // FNV-1a 64, as MMU::getROMHash; used for the checkpoint state hashes
+    static uint64_t hash(const uint8_t* data, size_t size);
+    
+    static constexpr uint32_t FORMAT_VERSION = 1;
+};
@@ -0,0 +1,232 @@
+#include "netplay.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Type, frame (32-bit little-endian), buttons
+constexpr uint8_t MSG_INPUT = 1;
+constexpr size_t MESSAGE_SIZE = 6;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+}
+
+NetplaySession::NetplaySession(GameBoy& first, GameBoy& second, Transport& transport, int localPlayer)
+    : first(first)
+    , second(second)
+    , transport(transport)
+    , cable(first, second)
+    , localPlayer(localPlayer ? 1 : 0)
+    , maxRollback(DEFAULT_MAX_ROLLBACK)
+    , inputDelay(0)
+    , states(DEFAULT_MAX_ROLLBACK + 1)
+    , held({ { 0, 0 } })
+    , localButtons(0)
+    , lastRemote(0)
+    , frame(0)
+    , confirmedFrame(0)
+    , nextLocalFrame(0)
+    , rollbackFrame(UINT32_MAX)
+{
+    for (FrameInput& input : inputs) {
+        input = FrameInput();
+        input.frame = UINT32_MAX;
+    }
+    for (SavedFrame& saved : states) {
+        saved.frame = UINT32_MAX;
+    }
+    resetStats();
+    
+    // Input is applied as changes from here on: start with nothing held
+    for (int button = 0; button < 8; button++) {
+        first.setButton(button, false);
+        second.setButton(button, false);
+    }
+}
+
+void NetplaySession::setMaxRollback(int frames) {
+    maxRollback = std::max(1, std::min(frames, MAX_ROLLBACK_LIMIT));
+    
+    // Keep the saved frames that still fit, at their new positions
+    std::vector<SavedFrame> resized(maxRollback + 1);
+    for (SavedFrame& saved : resized) {
+        saved.frame = UINT32_MAX;
+    }
+    for (SavedFrame& saved : states) {
+        if (saved.frame != UINT32_MAX && saved.frame + resized.size() > frame) {
+            resized[saved.frame % resized.size()] = std::move(saved);
+        }
+    }
+    states = std::move(resized);
+}
+
+void NetplaySession::setInputDelay(int frames) {
+    // Input already sent stays; a shorter delay takes effect as the
+    // frames catch up with it
+    inputDelay = std::max(0, std::min(frames, MAX_INPUT_DELAY));
+}
+
+bool NetplaySession::runFrame() {
+    Clock::time_point began = Clock::now();
+    
+    poll();
+    sendLocalInput();
+    
+    // Never predict further than the saved frames reach back
+    if (transport.isConnected() && frame >= confirmedFrame + maxRollback) {
+        stats.stalls++;
+        return false;
+    }
+    
+    stats.lastRollbackFrames = 0;
+    stats.lastResimSeconds = 0;
+    if (rollbackFrame != UINT32_MAX) {
+        rollback();
+    }
+    
+    simulate(frame);
+    frame++;
+    
+    stats.frames++;
+    stats.lastFrameSeconds = secondsSince(began);
+    stats.maxFrameSeconds = std::max(stats.maxFrameSeconds, stats.lastFrameSeconds);
+    return true;
+}
+
+NetplaySession::Stats NetplaySession::getStats() const {
+    Stats result = stats;
+    result.resimFrameSeconds = stats.resimulatedFrames ? stats.resimSeconds / stats.resimulatedFrames : 0.0;
+    return result;
+}
+
+void NetplaySession::resetStats() {
+    stats = Stats();
+}
+
+NetplaySession::FrameInput& NetplaySession::inputFor(uint32_t index) {
+    FrameInput& input = inputs[index % INPUT_RING];
+    if (input.frame != index) {
+        input = FrameInput();
+        input.frame = index;
+    }
+    return input;
+}
+
+void NetplaySession::poll() {
+    while (transport.receive(message)) {
+        if (message.size() != MESSAGE_SIZE || message[0] != MSG_INPUT) continue;
+        
+        uint32_t index = message[1] | (message[2] << 8) | (message[3] << 16) |
+                         (static_cast<uint32_t>(message[4]) << 24);
+        uint8_t buttons = message[5];
+        
+        // Inputs arrive in order; anything outside the ring is stale
+        if (index < confirmedFrame || index >= frame + INPUT_RING / 2) continue;
+        
+        FrameInput& input = inputFor(index);
+        input.remote = buttons;
+        input.remoteKnown = true;
+        if (index < frame && input.used != buttons) {
+            stats.mispredictions++;
+            rollbackFrame = std::min(rollbackFrame, index);
+        }
+        while (inputFor(confirmedFrame).remoteKnown) {
+            lastRemote = inputFor(confirmedFrame).remote;
+            confirmedFrame++;
+        }
+    }
+}
+
+void NetplaySession::sendLocalInput() {
+    while (nextLocalFrame <= frame + inputDelay) {
+        FrameInput& input = inputFor(nextLocalFrame);
+        input.local = localButtons;
+        input.localKnown = true;
+        
+        uint8_t data[MESSAGE_SIZE] = {
+            MSG_INPUT,
+            static_cast<uint8_t>(nextLocalFrame),
+            static_cast<uint8_t>(nextLocalFrame >> 8),
+            static_cast<uint8_t>(nextLocalFrame >> 16),
+            static_cast<uint8_t>(nextLocalFrame >> 24),
+            localButtons
+        };
+        transport.send(data, sizeof(data));
+        nextLocalFrame++;
+    }
+}
+
+void NetplaySession::rollback() {
+    Clock::time_point began = Clock::now();
+    uint32_t target = rollbackFrame;
+    rollbackFrame = UINT32_MAX;
+    
+    const SavedFrame& saved = states[target % states.size()];
+    if (saved.frame != target) return;  // Older than the ring; cannot happen while paced
+    first.loadState(saved.first.data(), saved.first.size());
+    second.loadState(saved.second.data(), saved.second.size());
+    held = saved.held;
+    
+    // Re-simulate to the present without drawing or synthesising audio
+    bool firstAudio = first.getAPU().isOutputEnabled();
+    bool secondAudio = second.getAPU().isOutputEnabled();
+    bool firstSkipped = first.getPPU().isRenderingSkipped();
+    bool secondSkipped = second.getPPU().isRenderingSkipped();
+    first.getAPU().setOutputEnabled(false);
+    second.getAPU().setOutputEnabled(false);
+    first.getPPU().setRenderingSkipped(true);
+    second.getPPU().setRenderingSkipped(true);
+    for (uint32_t index = target; index < frame; index++) {
+        simulate(index);
+    }
+    first.getPPU().setRenderingSkipped(firstSkipped);
+    second.getPPU().setRenderingSkipped(secondSkipped);
+    first.getAPU().setOutputEnabled(firstAudio);
+    second.getAPU().setOutputEnabled(secondAudio);
+    
+    int depth = static_cast<int>(frame - target);
+    double seconds = secondsSince(began);
+    stats.rollbacks++;
+    stats.resimulatedFrames += depth;
+    stats.lastRollbackFrames = depth;
+    stats.maxRollbackFrames = std::max(stats.maxRollbackFrames, depth);
+    stats.lastResimSeconds = seconds;
+    stats.resimSeconds += seconds;
+}
+
+void NetplaySession::simulate(uint32_t index) {
+    Clock::time_point began = Clock::now();
+    SavedFrame& saved = states[index % states.size()];
+    saved.frame = index;
+    saved.held = held;
+    saved.first.resize(first.getStateSize());
+    saved.first.resize(first.saveState(saved.first.data(), saved.first.size()));
+    saved.second.resize(second.getStateSize());
+    saved.second.resize(second.saveState(saved.second.data(), saved.second.size()));
+    stats.saveSeconds += secondsSince(began);
+    
+    FrameInput& input = inputFor(index);
+    input.used = input.remoteKnown ? input.remote : lastRemote;
+    uint8_t local = input.localKnown ? input.local : 0;
+    applyInput(localPlayer, local);
+    applyInput(1 - localPlayer, input.used);
+    
+    cable.runFrame();
+}
+
+void NetplaySession::applyInput(int player, uint8_t buttons) {
+    // Only changes: a repeated press would request the joypad interrupt again
+    GameBoy& gb = player == 0 ? first : second;
+    uint8_t changed = buttons ^ held[player];
+    for (int button = 0; button < 8; button++) {
+        if (changed & (1 << button)) {
+            gb.setButton(button, (buttons >> button) & 1);
+        }
+    }
+    held[player] = buttons;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+
+#include "gameboy.h"
+#include "link_cable.h"
+#include "transport.h"
+
+/**
+ * NetplaySession - Two-player rollback netplay over a Transport
+ *
+ * Both peers emulate the same system: player 1's and player 2's GameBoys,
+ * connected by a LinkCable, each peer loaded with the same ROMs and
+ * started from the same state. Only joypad input crosses the network, one
+ * message per frame, so the two copies stay identical as long as both see
+ * the same input on the same frames.
+ *
+ * Each frame runs at once with the remote player's input predicted (their
+ * last known input). The state of both machines is saved at the start of
+ * every frame into a ring covering `maxRollback` frames. When a remote
+ * input arrives that differs from the prediction used, the session loads
+ * the state of that frame and re-simulates up to the present, undrawn and
+ * unheard, before running the new frame. runFrame stalls (returns false
+ * without running) rather than predict more than maxRollback frames.
+ *
+ * Local input can be delayed by a few frames: input given now applies
+ * `inputDelay` frames later, hiding that much latency without rollbacks.
+ * Both peers must use the same delay.
+ *
+ * getStats() reports the rollback depth and re-simulation time of the last
+ * frame along with totals, to judge whether the core re-simulates fast
+ * enough for deep rollbacks within a 16.7 ms frame.
+ */
+class NetplaySession {
+public:
+    static constexpr int DEFAULT_MAX_ROLLBACK = 8;    // Frames
+    static constexpr int MAX_ROLLBACK_LIMIT = 16;
+    static constexpr int MAX_INPUT_DELAY = 8;
+    
+    struct Stats {
+        uint64_t frames;                // Frames run (not counting re-runs)
+        uint64_t stalls;                // runFrame calls that waited for input
+        uint64_t mispredictions;        // Remote inputs that differed
+        uint64_t rollbacks;
+        uint64_t resimulatedFrames;
+        int lastRollbackFrames;         // Last frame's rollback depth (0 = none)
+        int maxRollbackFrames;
+        double lastResimSeconds;        // Last frame's re-simulation time
+        double resimSeconds;            // Total
+        double resimFrameSeconds;       // Mean cost of one re-simulated frame
+        double saveSeconds;             // Total spent saving frame states
+        double lastFrameSeconds;        // Wall time of the last runFrame
+        double maxFrameSeconds;
+    };
+    
+    // `first` is player 1's machine, `second` player 2's, on both peers.
+    // `localPlayer` is 0 or 1.
+    NetplaySession(GameBoy& first, GameBoy& second, Transport& transport, int localPlayer);
+    
+    NetplaySession(const NetplaySession&) = delete;
+    NetplaySession& operator=(const NetplaySession&) = delete;
+    
+    void setMaxRollback(int frames);
+    int getMaxRollback() const { return maxRollback; }
+    void setInputDelay(int frames);
+    int getInputDelay() const { return inputDelay; }
+    
+    // Buttons held by the local player (bit N = GameBoy::Button N) from
+    // now on
+    void setLocalInput(uint8_t buttons) { localButtons = buttons; }
+    
+    // Run one frame. Returns false, having run nothing, while waiting for
+    // the remote player's input; call again (after a short wait).
+    bool runFrame();
+    
+    // Frames run so far; the next frame to run
+    uint32_t getFrame() const { return frame; }
+    
+    // Remote input is known for every frame before this one
+    uint32_t getConfirmedFrame() const { return confirmedFrame; }
+    
+    bool isConnected() const { return transport.isConnected(); }
+    
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    static constexpr int INPUT_RING = 64;  // Frames of input kept
+    
+    struct FrameInput {
+        uint32_t frame;
+        uint8_t local;
+        uint8_t remote;
+        uint8_t used;           // Remote input the frame ran with
+        bool localKnown;
+        bool remoteKnown;
+    };
+    
+    // Both machines at the start of a frame
+    struct SavedFrame {
+        uint32_t frame;
+        std::array<uint8_t, 2> held;
+        std::vector<uint8_t> first;
+        std::vector<uint8_t> second;
+    };
+    
+    GameBoy& first;
+    GameBoy& second;
+    Transport& transport;
+    LinkCable cable;
+    int localPlayer;
+    int maxRollback;
+    int inputDelay;
+    
+    std::array<FrameInput, INPUT_RING> inputs;
+    std::vector<SavedFrame> states;
+    std::array<uint8_t, 2> held;    // Buttons currently applied, per player
+    uint8_t localButtons;
+    uint8_t lastRemote;             // Prediction: the latest remote input
+    
+    uint32_t frame;
+    uint32_t confirmedFrame;
+    uint32_t nextLocalFrame;        // First frame whose local input is unsent
+    uint32_t rollbackFrame;         // Earliest frame to re-run; UINT32_MAX = none
+    std::vector<uint8_t> message;
+    
+    Stats stats;
+    
+    FrameInput& inputFor(uint32_t index);
+    void poll();
+    void sendLocalInput();
+    void rollback();
+    
+    // Save the frame's starting state, then run it with its inputs
+    void simulate(uint32_t index);
+    void applyInput(int player, uint8_t buttons);
+};
@@ -0,0 +1,56 @@
+#include "packbits.h"
+#include <cstring>
+
+size_t packBits(const uint8_t* in, size_t size, uint8_t* out) {
+    size_t length = 0;
+    size_t i = 0;
+    
+    while (i < size) {
+        size_t run = 1;
+        while (i + run < size && run < 130 && in[i + run] == in[i]) {
+            run++;
+        }
+        
+        if (run >= 3) {
+            out[length++] = static_cast<uint8_t>(run + 125);
+            out[length++] = in[i];
+            i += run;
+            continue;
+        }
+        
+        // Literals up to the next run of three or more
+        size_t start = i;
+        while (i < size && i - start < 128) {
+            if (i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+            i++;
+        }
+        out[length++] = static_cast<uint8_t>(i - start - 1);
+        std::memcpy(out + length, in + start, i - start);
+        length += i - start;
+    }
+    
+    return length;
+}
+
+bool unpackBits(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize) {
+    const uint8_t* end = in + inSize;
+    
+    for (size_t i = 0; i < outSize; ) {
+        if (in == end) return false;
+        uint8_t control = *in++;
+        if (control < 128) {
+            size_t count = control + 1;
+            if (count > static_cast<size_t>(end - in) || count > outSize - i) return false;
+            std::memcpy(out + i, in, count);
+            in += count;
+            i += count;
+        } else {
+            size_t count = control - 125;
+            if (in == end || count > outSize - i) return false;
+            std::memset(out + i, *in++, count);
+            i += count;
+        }
+    }
+    
+    return in == end;
+}
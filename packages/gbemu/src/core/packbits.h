@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * PackBits run-length coding, for rewind pages and movie keyframes
+ *
+ * A control byte n < 128 is followed by n + 1 literal bytes, n >= 128 by one
+ * byte to repeat n - 125 times (3..130). Emulator memory is mostly runs of
+ * zeros or fill bytes, which this shrinks several times over at memcpy-like
+ * speed.
+ */
+
+// Largest possible output for `size` input bytes
+constexpr size_t packBitsBound(size_t size) {
+    return size + (size + 127) / 128;
+}
+
+// Compress `size` bytes into `out` (at least packBitsBound(size) bytes),
+// returns the compressed length
+size_t packBits(const uint8_t* in, size_t size, uint8_t* out);
+
+// Decompress exactly `outSize` bytes; false if the input is malformed
+bool unpackBits(const uint8_t* in, size_t inSize, uint8_t* out, size_t outSize);
@@ -1,20 +1,86 @@
 #include "ppu.h"
 #include "mmu.h"
+#include "render_thread.h"
+#include "state.h"
+#include <algorithm>
 
-PPU::PPU(MMU& mmu) : mmu(mmu) {
+namespace {
+
+// What getFramebuffer shows without video output
+const uint32_t* blankFrame() {
+    static const std::vector<uint32_t> frame(PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT, PPU::COLORS[0]);
+    return frame.data();
+}
+
+}
+
+PPU::PPU(MMU& mmu, bool videoOutput)
+    : mmu(mmu)
+    , framebuffer(nullptr)
+    , ownFramebuffer(videoOutput ? SCREEN_WIDTH * SCREEN_HEIGHT : 0)
+    , skipRendering(false)
+    , deferredRendering(false)
+    , renderThread(nullptr)
+    , scanlineCallback(nullptr)
+    , scanlineUser(nullptr)
+{
+    if (videoOutput) {
+        framebuffer = ownFramebuffer.data();
+    }
     reset();
 }
 
 void PPU::reset() {
-    framebuffer.fill(COLORS[0]);
+    if (framebuffer) {
+        std::fill(framebuffer, framebuffer + SCREEN_WIDTH * SCREEN_HEIGHT, COLORS[0]);
+    }
     ly = 0;
     modeClock = 0;
     mode = 2;
     windowLine = false;
     windowLineCounter = 0;
     mode3Duration = 172;
+    pendingLineStart = 0;
+    pendingLineEnd = 0;
     mmu.ly = 0;
     mmu.stat = (mmu.stat & 0xFC) | 2;
+    
+    if (renderThread) {
+        publishPendingLines(true, true);
+    }
+}
+
+const uint32_t* PPU::getFramebuffer() const {
+    if (renderThread) return renderThread->acquireFrame();
+    return framebuffer ? framebuffer : blankFrame();
+}
+
+void PPU::setFramebuffer(uint32_t* pixels) {
+    flushPendingLines();
+    
+    const uint32_t* picture = framebuffer ? framebuffer : blankFrame();
+    if (pixels) {
+        if (pixels != framebuffer) {
+            std::copy(picture, picture + SCREEN_WIDTH * SCREEN_HEIGHT, pixels);
+        }
+        framebuffer = pixels;
+        std::vector<uint32_t>().swap(ownFramebuffer);
+    } else if (framebuffer != ownFramebuffer.data() || ownFramebuffer.empty()) {
+        ownFramebuffer.assign(picture, picture + SCREEN_WIDTH * SCREEN_HEIGHT);
+        framebuffer = ownFramebuffer.data();
+    }
+}
+
+void PPU::setVideoOutputEnabled(bool enabled) {
+    if (enabled == isVideoOutputEnabled()) return;
+    
+    if (enabled) {
+        setFramebuffer(nullptr);
+    } else {
+        flushPendingLines();
+        framebuffer = nullptr;
+        std::vector<uint32_t>().swap(ownFramebuffer);
+    }
 }
 
 void PPU::setMode(uint8_t newMode) {
@@ -61,7 +127,20 @@ bool PPU::step(int cycles) {
         case 3:
             if (modeClock >= mode3Duration) {
                 modeClock -= mode3Duration;
-                renderScanline();
+                // Captured even when skipping: it advances the window line counter
+                lineLog[ly] = captureLineState();
+                if (skipRendering || !framebuffer) {
+                    // Render elision: leave the framebuffer as it is
+                } else if (deferredRendering || renderThread) {
+                    if (!hasPendingLines()) pendingLineStart = ly;
+                    pendingLineEnd = ly + 1;
+                } else {
+                    uint32_t* row = &framebuffer[ly * SCREEN_WIDTH];
+                    renderScanline(lineLog[ly], ly, mmu.getVRAM(), mmu.getOAM(), row);
+                    if (scanlineCallback) {
+                        scanlineCallback(scanlineUser, ly, row);
+                    }
+                }
                 setMode(0);
             }
             break;
@@ -81,6 +160,9 @@ bool PPU::step(int cycles) {
                 }
                 
                 if (ly == 144) {
+                    if ((!skipRendering && framebuffer) || hasPendingLines()) {
+                        flushPendingLines(true);
+                    }
                     setMode(1);
                     mmu.setIF(mmu.getIF() | 0x01);
                     frameComplete = true;
@@ -118,39 +200,154 @@ bool PPU::step(int cycles) {
     return frameComplete;
 }
 
-void PPU::renderScanline() {
-    for (int x = 0; x < SCREEN_WIDTH; x++) {
-        framebuffer[ly * SCREEN_WIDTH + x] = COLORS[0];
-        bgColorIndices[x] = 0;  // Default BG color index is 0
+void PPU::setDeferredRendering(bool enabled) {
+    if (!enabled) {
+        flushPendingLines();
+    }
+    deferredRendering = enabled;
+}
+
+void PPU::flushPendingLines(bool frameEnd) {
+    if (renderThread) {
+        publishPendingLines(frameEnd, false);
+        return;
     }
     
-    if (mmu.lcdc & 0x01) {
-        renderBackground();
+    const uint8_t* vram = mmu.getVRAM();
+    const uint8_t* oam = mmu.getOAM();
+    
+    for (int line = pendingLineStart; line < pendingLineEnd; line++) {
+        uint32_t* row = &framebuffer[line * SCREEN_WIDTH];
+        renderScanline(lineLog[line], line, vram, oam, row);
+        if (scanlineCallback) {
+            scanlineCallback(scanlineUser, line, row);
+        }
     }
     
-    if ((mmu.lcdc & 0x20) && (mmu.lcdc & 0x01)) {
-        renderWindow();
+    pendingLineStart = 0;
+    pendingLineEnd = 0;
+}
+
+void PPU::setScanlineCallback(ScanlineCallback callback, void* user) {
+    if (renderThread) {
+        renderThread->waitIdle();
+        renderThread->setScanlineCallback(callback, user);
     }
+    scanlineCallback = callback;
+    scanlineUser = user;
+}
+
+void PPU::setRenderThread(RenderThread* thread) {
+    flushPendingLines();
     
-    if (mmu.lcdc & 0x02) {
-        renderSprites();
+    // Carry the last drawn frame across so lines not redrawn keep their pixels
+    if (!renderThread && thread) {
+        thread->waitIdle();
+        thread->setCanvas(framebuffer ? framebuffer : blankFrame());
+        thread->setScanlineCallback(scanlineCallback, scanlineUser);
+    }
+    if (renderThread && !thread) {
+        renderThread->waitIdle();
+        if (framebuffer) renderThread->getCanvas(framebuffer);
+    }
+    
+    renderThread = thread;
+    
+    // The render thread mirror starts empty, send everything with the next batch
+    mmu.vramDirtyPages = ~0u;
+    mmu.oamDirty = true;
+}
+
+void PPU::publishPendingLines(bool frameEnd, bool clear) {
+    RenderThread::Batch& batch = renderThread->beginBatch();
+    
+    batch.firstLine = pendingLineStart;
+    batch.lastLine = pendingLineEnd;
+    batch.frameEnd = frameEnd;
+    batch.clear = clear;
+    std::copy(lineLog.begin() + pendingLineStart, lineLog.begin() + pendingLineEnd,
+              batch.lines.begin() + pendingLineStart);
+    
+    // Only VRAM pages and OAM written since the previous batch travel along
+    const uint8_t* vram = mmu.getVRAM();
+    batch.vramPages = mmu.vramDirtyPages;
+    for (uint32_t pages = mmu.vramDirtyPages; pages; pages &= pages - 1) {
+        int offset = __builtin_ctz(pages) * RenderThread::VRAM_PAGE_SIZE;
+        std::copy(vram + offset, vram + offset + RenderThread::VRAM_PAGE_SIZE,
+                  batch.vram.begin() + offset);
+    }
+    batch.oamChanged = mmu.oamDirty;
+    if (mmu.oamDirty) {
+        std::copy(mmu.getOAM(), mmu.getOAM() + 0xA0, batch.oam.begin());
     }
+    mmu.vramDirtyPages = 0;
+    mmu.oamDirty = false;
+    
+    renderThread->commitBatch();
+    
+    pendingLineStart = 0;
+    pendingLineEnd = 0;
 }
 
-void PPU::renderBackground() {
-    uint16_t tileData = (mmu.lcdc & 0x10) ? 0x8000 : 0x8800;
-    bool signedIndex = !(mmu.lcdc & 0x10);
+PPU::LineState PPU::captureLineState() {
+    LineState state;
+    state.lcdc = mmu.lcdc;
+    state.scx = mmu.scx;
+    state.scy = mmu.scy;
+    state.wx = mmu.wx;
+    state.wy = mmu.wy;
+    state.bgp = mmu.bgp;
+    state.obp0 = mmu.obp0;
+    state.obp1 = mmu.obp1;
+    
+    // Window line counter only advances on lines where the window is drawn
+    state.windowVisible = (mmu.lcdc & 0x20) && (mmu.lcdc & 0x01) &&
+                          ly >= mmu.wy && mmu.wx <= 166;
+    state.windowLine = static_cast<uint8_t>(windowLineCounter);
+    if (state.windowVisible) {
+        windowLineCounter++;
+    }
+    
+    return state;
+}
+
+void PPU::renderScanline(const LineState& state, int line,
+                         const uint8_t* vram, const uint8_t* oam,
+                         uint32_t* row) {
+    // Background color indices for this scanline (for sprite priority)
+    uint8_t bgIndices[SCREEN_WIDTH];
+    
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        row[x] = COLORS[0];
+        bgIndices[x] = 0;  // Default BG color index is 0
+    }
+    
+    if (state.lcdc & 0x01) {
+        renderBackground(state, line, vram, row, bgIndices);
+    }
+    
+    if (state.windowVisible) {
+        renderWindow(state, vram, row, bgIndices);
+    }
     
-    uint16_t tileMap = (mmu.lcdc & 0x08) ? 0x9C00 : 0x9800;
+    if (state.lcdc & 0x02) {
+        renderSprites(state, line, vram, oam, row, bgIndices);
+    }
+}
+
+void PPU::renderBackground(const LineState& state, int line, const uint8_t* vram,
+                           uint32_t* row, uint8_t* bgIndices) {
+    uint16_t tileData = (state.lcdc & 0x10) ? 0x8000 : 0x8800;
+    bool signedIndex = !(state.lcdc & 0x10);
     
-    uint8_t scrollY = mmu.scy;
-    uint8_t scrollX = mmu.scx;
+    uint16_t tileMap = (state.lcdc & 0x08) ? 0x9C00 : 0x9800;
     
-    uint8_t* vram = mmu.getVRAM();
+    uint8_t scrollY = state.scy;
+    uint8_t scrollX = state.scx;
     
     for (int x = 0; x < SCREEN_WIDTH; x++) {
         uint8_t bgX = (scrollX + x) & 0xFF;
-        uint8_t bgY = (scrollY + ly) & 0xFF;
+        uint8_t bgY = (scrollY + line) & 0xFF;
         
         uint16_t tileMapAddr = tileMap + (bgY / 8) * 32 + (bgX / 8);
         uint8_t tileIndex = vram[tileMapAddr - 0x8000];
@@ -171,33 +368,25 @@ void PPU::renderBackground() {
         uint8_t bit = 7 - tileX;
         uint8_t colorNum = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
         
-        bgColorIndices[x] = colorNum;
-        framebuffer[ly * SCREEN_WIDTH + x] = getColor(mmu.bgp, colorNum);
+        bgIndices[x] = colorNum;
+        row[x] = getColor(state.bgp, colorNum);
     }
 }
 
-void PPU::renderWindow() {
-    if (ly < mmu.wy) return;
-    if (mmu.wx > 166) return;
-    
-    int windowX = mmu.wx - 7;
+void PPU::renderWindow(const LineState& state, const uint8_t* vram,
+                       uint32_t* row, uint8_t* bgIndices) {
+    int windowX = state.wx - 7;
     
-    uint16_t tileData = (mmu.lcdc & 0x10) ? 0x8000 : 0x8800;
-    bool signedIndex = !(mmu.lcdc & 0x10);
+    uint16_t tileData = (state.lcdc & 0x10) ? 0x8000 : 0x8800;
+    bool signedIndex = !(state.lcdc & 0x10);
     
-    uint16_t tileMap = (mmu.lcdc & 0x40) ? 0x9C00 : 0x9800;
-    
-    uint8_t* vram = mmu.getVRAM();
-    
-    bool windowOnThisLine = false;
+    uint16_t tileMap = (state.lcdc & 0x40) ? 0x9C00 : 0x9800;
     
     for (int x = 0; x < SCREEN_WIDTH; x++) {
         if (x < windowX) continue;
         
-        windowOnThisLine = true;
-        
         int winX = x - windowX;
-        int winY = windowLineCounter;
+        int winY = state.windowLine;
         
         uint16_t tileMapAddr = tileMap + (winY / 8) * 32 + (winX / 8);
         uint8_t tileIndex = vram[tileMapAddr - 0x8000];
@@ -218,20 +407,14 @@ void PPU::renderWindow() {
         uint8_t bit = 7 - tileX;
         uint8_t colorNum = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
         
-        bgColorIndices[x] = colorNum;
-        framebuffer[ly * SCREEN_WIDTH + x] = getColor(mmu.bgp, colorNum);
-    }
-    
-    if (windowOnThisLine) {
-        windowLineCounter++;
+        bgIndices[x] = colorNum;
+        row[x] = getColor(state.bgp, colorNum);
     }
 }
 
-void PPU::renderSprites() {
-    uint8_t* oam = mmu.getOAM();
-    uint8_t* vram = mmu.getVRAM();
-    
-    int spriteHeight = (mmu.lcdc & 0x04) ? 16 : 8;
+void PPU::renderSprites(const LineState& state, int line, const uint8_t* vram,
+                        const uint8_t* oam, uint32_t* row, const uint8_t* bgIndices) {
+    int spriteHeight = (state.lcdc & 0x04) ? 16 : 8;
     
     struct Sprite {
         int x, y;
@@ -247,7 +430,7 @@ void PPU::renderSprites() {
         int x = oam[i * 4 + 1] - 8;
         
         // Check if sprite is on this scanline
-        if (ly >= y && ly < y + spriteHeight) {
+        if (line >= y && line < y + spriteHeight) {
             sprites[spriteCount].x = x;
             sprites[spriteCount].y = y;
             sprites[spriteCount].tile = oam[i * 4 + 2];
@@ -274,9 +457,9 @@ void PPU::renderSprites() {
         bool flipX = spr.flags & 0x20;
         bool flipY = spr.flags & 0x40;
         bool priority = spr.flags & 0x80;
-        uint8_t palette = (spr.flags & 0x10) ? mmu.obp1 : mmu.obp0;
+        uint8_t palette = (spr.flags & 0x10) ? state.obp1 : state.obp0;
         
-        int spriteY = ly - spr.y;
+        int spriteY = line - spr.y;
         if (flipY) {
             spriteY = spriteHeight - 1 - spriteY;
         }
@@ -303,11 +486,11 @@ void PPU::renderSprites() {
             
             if (colorNum == 0) continue;
             
-            if (priority && bgColorIndices[screenX] != 0) {
+            if (priority && bgIndices[screenX] != 0) {
                 continue;
             }
             
-            framebuffer[ly * SCREEN_WIDTH + screenX] = getColor(palette, colorNum);
+            row[screenX] = getColor(palette, colorNum);
         }
     }
 }
@@ -347,3 +530,25 @@ int PPU::calculateMode3Duration() {
     
     return duration;
 }
+
+void PPU::saveState(StateWriter& state) const {
+    state.write(ly);
+    state.write(modeClock);
+    state.write(mode);
+    state.write(windowLine);
+    state.write(windowLineCounter);
+    state.write(mode3Duration);
+}
+
+void PPU::loadState(StateReader& state) {
+    state.read(ly);
+    state.read(modeClock);
+    state.read(mode);
+    state.read(windowLine);
+    state.read(windowLineCounter);
+    state.read(mode3Duration);
+    
+    // Lines logged before the load belong to another timeline
+    pendingLineStart = 0;
+    pendingLineEnd = 0;
+}
@@ -1,9 +1,14 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <array>
+#include <vector>
 
 class MMU;
+class RenderThread;
+class StateWriter;
+class StateReader;
 
 /**
  * PPU - Pixel Processing Unit
@@ -23,7 +28,17 @@ public:
     static constexpr int SCREEN_WIDTH = 160;
     static constexpr int SCREEN_HEIGHT = 144;
     
-    PPU(MMU& mmu);
+    // Palette colors (classic green)
+    static constexpr uint32_t COLORS[4] = {
+        0xFF9BBC0F,  // Lightest (00)
+        0xFF8BAC0F,  // Light (01)
+        0xFF306230,  // Dark (10)
+        0xFF0F380F   // Darkest (11)
+    };
+    
+    // Without `videoOutput` no framebuffer is allocated (see
+    // setVideoOutputEnabled)
+    PPU(MMU& mmu, bool videoOutput = true);
     
     // Step PPU by given cycles, returns true if frame complete
     bool step(int cycles);
@@ -31,20 +46,84 @@ public:
     // Reset PPU state
     void reset();
     
+    // Save-state serialisation (see state.h)
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+    
     // Get framebuffer (RGBA format, 160x144)
-    const uint32_t* getFramebuffer() const { return framebuffer.data(); }
+    const uint32_t* getFramebuffer() const;
+    
+    // Draw into caller memory of SCREEN_WIDTH * SCREEN_HEIGHT pixels (kept
+    // alive by the caller) instead of a framebuffer of the PPU's own; the
+    // current picture is carried over. nullptr goes back to an own one. A
+    // render thread still draws into its own canvas.
+    void setFramebuffer(uint32_t* pixels);
+    
+    // Headless: without video output nothing is rasterised and no
+    // framebuffer is held; getFramebuffer returns a blank frame. Timing,
+    // STAT/LY and interrupts stay exact, as with render elision.
+    void setVideoOutputEnabled(bool enabled);
+    bool isVideoOutputEnabled() const { return framebuffer != nullptr; }
+    
+    // Framebuffer bytes owned by the PPU
+    size_t getMemoryUsage() const { return ownFramebuffer.capacity() * sizeof(uint32_t); }
     
     // Get current scanline
     uint8_t getCurrentLine() const { return ly; }
     
+    // Registers a scanline is rasterised from, sampled at the end of Mode 3
+    struct LineState {
+        uint8_t lcdc;
+        uint8_t scx;
+        uint8_t scy;
+        uint8_t wx;
+        uint8_t wy;
+        uint8_t bgp;
+        uint8_t obp0;
+        uint8_t obp1;
+        uint8_t windowLine;   // Window line counter for this scanline
+        bool windowVisible;   // Window drawn on this scanline
+    };
+    
+    // Deferred rendering: log LineState per scanline and rasterise the whole
+    // frame in one pass at VBlank instead of in the middle of the CPU loop
+    void setDeferredRendering(bool enabled);
+    bool isDeferredRendering() const { return deferredRendering; }
+    
+    // Render elision (fast-forward): timing, STAT/LY and interrupts stay
+    // exact but scanlines are not rasterised; the framebuffer keeps the last
+    // drawn picture
+    void setRenderingSkipped(bool skip) { skipRendering = skip; }
+    bool isRenderingSkipped() const { return skipRendering; }
+    
+    // Rasterise logged scanlines that have not been drawn yet. Called at VBlank
+    // and by the MMU before VRAM/OAM change under the pending lines.
+    void flushPendingLines(bool frameEnd = false);
+    bool hasPendingLines() const { return pendingLineStart < pendingLineEnd; }
+    
+    // Called as soon as a scanline's pixels are final, with the 160-pixel row.
+    // Lets a presenter upload partial frames while emulation continues. In
+    // deferred mode lines arrive at flush time; with a render thread the
+    // callback runs on that thread.
+    using ScanlineCallback = void (*)(void* user, int line, const uint32_t* row);
+    void setScanlineCallback(ScanlineCallback callback, void* user);
+    
+    // Hand rasterisation to a render thread (nullptr draws on this thread).
+    // Logged lines are then published to it instead of drawn at flush time.
+    void setRenderThread(RenderThread* thread);
+    
+    // Rasterise one scanline from its logged state into a 160-pixel row
+    static void renderScanline(const LineState& state, int line,
+                               const uint8_t* vram, const uint8_t* oam,
+                               uint32_t* row);
+    
 private:
     MMU& mmu;
     
-    // Framebuffer (RGBA)
-    std::array<uint32_t, SCREEN_WIDTH * SCREEN_HEIGHT> framebuffer;
-    
-    // Background color indices for current scanline (for sprite priority)
-    std::array<uint8_t, SCREEN_WIDTH> bgColorIndices;
+    // Framebuffer (RGBA): ownFramebuffer, caller memory, or null without
+    // video output
+    uint32_t* framebuffer;
+    std::vector<uint32_t> ownFramebuffer;
     
     // PPU state
     uint8_t ly;         // Current scanline (0-153)
@@ -54,17 +133,38 @@ private:
     int windowLineCounter;
     int mode3Duration;  // Variable Mode 3 duration (172-289 cycles)
     
-    // Scanline rendering
-    void renderScanline();
-    void renderBackground();
-    void renderWindow();
-    void renderSprites();
+    bool skipRendering;  // Render elision (see setRenderingSkipped)
+    
+    // Deferred rendering state
+    bool deferredRendering;
+    std::array<LineState, SCREEN_HEIGHT> lineLog;
+    int pendingLineStart;   // First logged line not yet rasterised
+    int pendingLineEnd;     // One past the last logged line
+    RenderThread* renderThread;
+    
+    // Scanline streaming
+    ScanlineCallback scanlineCallback;
+    void* scanlineUser;
+    
+    // Send pending lines plus changed VRAM/OAM to the render thread
+    void publishPendingLines(bool frameEnd, bool clear);
+    
+    // Sample registers for the current scanline (advances window line counter)
+    LineState captureLineState();
+    
+    // Scanline rendering (bgIndices holds BG color indices for sprite priority)
+    static void renderBackground(const LineState& state, int line, const uint8_t* vram,
+                                 uint32_t* row, uint8_t* bgIndices);
+    static void renderWindow(const LineState& state, const uint8_t* vram,
+                             uint32_t* row, uint8_t* bgIndices);
+    static void renderSprites(const LineState& state, int line, const uint8_t* vram,
+                              const uint8_t* oam, uint32_t* row, const uint8_t* bgIndices);
     
     // Calculate Mode 3 duration based on sprites and window
     int calculateMode3Duration();
     
     // Color conversion
-    uint32_t getColor(uint8_t palette, uint8_t colorNum);
+    static uint32_t getColor(uint8_t palette, uint8_t colorNum);
     
     // Tile/sprite fetching
     uint8_t getTilePixel(uint16_t tileAddr, int x, int y);
@@ -73,11 +173,5 @@ private:
     void checkSTATInterrupt();
     void setMode(uint8_t newMode);
     
-    // Palette colors (classic green)
-    static constexpr uint32_t COLORS[4] = {
-        0xFF9BBC0F,  // Lightest (00)
-        0xFF8BAC0F,  // Light (01)
-        0xFF306230,  // Dark (10)
-        0xFF0F380F   // Darkest (11)
-    };
+    friend class RenderThread;
 };
@@ -0,0 +1,174 @@
+#include "render_thread.h"
+#include <cstring>
+
+RenderThread::RenderThread()
+    : queueHead(0)
+    , queueTail(0)
+    , backIndex(0)
+    , frontIndex(1)
+    , middle(2)
+    , running(false)
+    , scanlineCallback(nullptr)
+    , scanlineUser(nullptr)
+#if GBEMU_HAS_THREADS
+    , stopRequested(false)
+    , workerSleeping(false)
+#endif
+{
+    vram.fill(0);
+    oam.fill(0);
+    canvas.fill(PPU::COLORS[0]);
+    for (auto& frame : frames) {
+        frame = canvas;
+    }
+}
+
+RenderThread::~RenderThread() {
+    stop();
+}
+
+bool RenderThread::start() {
+#if GBEMU_HAS_THREADS
+    if (running) return true;
+    
+    queueHead.store(0);
+    queueTail.store(0);
+    stopRequested.store(false);
+    running = true;
+    worker = std::thread(&RenderThread::run, this);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void RenderThread::stop() {
+#if GBEMU_HAS_THREADS
+    if (!running) return;
+    
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopRequested.store(true);
+    }
+    wakeCondition.notify_one();
+    worker.join();
+    running = false;
+#endif
+}
+
+RenderThread::Batch& RenderThread::beginBatch() {
+    uint32_t tail = queueTail.load(std::memory_order_relaxed);
+    
+    // Queue full: wait for the render thread to free a slot
+    while (tail - queueHead.load(std::memory_order_acquire) >= QUEUE_SIZE) {
+#if GBEMU_HAS_THREADS
+        std::this_thread::yield();
+#endif
+    }
+    
+    return queue[tail & (QUEUE_SIZE - 1)];
+}
+
+void RenderThread::commitBatch() {
+    queueTail.store(queueTail.load(std::memory_order_relaxed) + 1);
+
+#if GBEMU_HAS_THREADS
+    // Only take the lock when the render thread is (about to be) asleep
+    if (workerSleeping.load()) {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeCondition.notify_one();
+    }
+#endif
+}
+
+void RenderThread::waitIdle() {
+    while (queueHead.load(std::memory_order_acquire) != queueTail.load(std::memory_order_relaxed)) {
+#if GBEMU_HAS_THREADS
+        std::this_thread::yield();
+#endif
+    }
+}
+
+const uint32_t* RenderThread::acquireFrame() {
+    if (middle.load(std::memory_order_relaxed) & NEW_FRAME) {
+        int previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & ~NEW_FRAME;
+    }
+    return frames[frontIndex].data();
+}
+
+void RenderThread::setCanvas(const uint32_t* pixels) {
+    std::memcpy(canvas.data(), pixels, sizeof(canvas));
+    for (auto& frame : frames) {
+        frame = canvas;
+    }
+}
+
+void RenderThread::getCanvas(uint32_t* pixels) const {
+    std::memcpy(pixels, canvas.data(), sizeof(canvas));
+}
+
+void RenderThread::setScanlineCallback(PPU::ScanlineCallback callback, void* user) {
+    scanlineCallback = callback;
+    scanlineUser = user;
+}
+
+#if GBEMU_HAS_THREADS
+void RenderThread::run() {
+    while (true) {
+        uint32_t head = queueHead.load(std::memory_order_relaxed);
+        
+        if (head != queueTail.load()) {
+            process(queue[head & (QUEUE_SIZE - 1)]);
+            queueHead.store(head + 1, std::memory_order_release);
+            continue;
+        }
+        
+        // Queue empty: sleep until the emulation thread commits a batch
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        workerSleeping.store(true);
+        wakeCondition.wait(lock, [this, head] {
+            return stopRequested.load() || queueTail.load() != head;
+        });
+        workerSleeping.store(false);
+        
+        if (stopRequested.load() && queueTail.load() == head) {
+            break;
+        }
+    }
+}
+#endif
+
+void RenderThread::process(const Batch& batch) {
+    // Bring the VRAM/OAM mirror up to date with the pages sent along
+    for (uint32_t pages = batch.vramPages; pages; pages &= pages - 1) {
+        int page = __builtin_ctz(pages);
+        std::memcpy(&vram[page * VRAM_PAGE_SIZE], &batch.vram[page * VRAM_PAGE_SIZE], VRAM_PAGE_SIZE);
+    }
+    if (batch.oamChanged) {
+        oam = batch.oam;
+    }
+    
+    if (batch.clear) {
+        canvas.fill(PPU::COLORS[0]);
+    }
+    
+    for (int line = batch.firstLine; line < batch.lastLine; line++) {
+        uint32_t* row = &canvas[line * SCREEN_WIDTH];
+        PPU::renderScanline(batch.lines[line], line, vram.data(), oam.data(), row);
+        if (scanlineCallback) {
+            scanlineCallback(scanlineUser, line, row);
+        }
+    }
+    
+    if (batch.frameEnd) {
+        publishFrame();
+    }
+}
+
+void RenderThread::publishFrame() {
+    frames[backIndex] = canvas;
+    int previous = middle.exchange(backIndex | NEW_FRAME, std::memory_order_acq_rel);
+    backIndex = previous & ~NEW_FRAME;
+}
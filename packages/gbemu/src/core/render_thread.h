@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+
+#include "ppu.h"
+#include "threads.h"
+
+/**
+ * RenderThread - Rasterises scanlines off the emulation thread
+ *
+ * The PPU logs per-line register state (see PPU::LineState) and publishes it
+ * in batches together with the VRAM pages and OAM that changed since the
+ * previous batch. Batches travel through a lock-free single-producer/
+ * single-consumer queue; the render thread keeps its own VRAM/OAM mirror,
+ * rasterises into a canvas and hands finished frames to the presenter
+ * through a triple buffer.
+ *
+ * A batch is published whenever the PPU flushes: at VBlank, and before a
+ * VRAM/OAM write would change memory that logged lines still depend on.
+ */
+class RenderThread {
+public:
+    static constexpr int SCREEN_WIDTH = PPU::SCREEN_WIDTH;
+    static constexpr int SCREEN_HEIGHT = PPU::SCREEN_HEIGHT;
+    static constexpr int VRAM_PAGE_SIZE = 0x100;
+    
+    struct Batch {
+        int firstLine;          // First scanline in this batch
+        int lastLine;           // One past the last scanline
+        bool frameEnd;          // Present the canvas after drawing
+        bool clear;             // Clear the canvas before drawing (PPU reset)
+        uint32_t vramPages;     // Bit N set: 256-byte VRAM page N is included
+        bool oamChanged;        // OAM is included
+        std::array<PPU::LineState, SCREEN_HEIGHT> lines;
+        std::array<uint8_t, 0x2000> vram;
+        std::array<uint8_t, 0xA0> oam;
+    };
+    
+    RenderThread();
+    ~RenderThread();
+    
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+    
+    // Start/stop the worker; start() returns false if threads are unavailable
+    bool start();
+    void stop();
+    bool isRunning() const { return running; }
+    
+    // Producer side (emulation thread): fill the returned slot, then commit.
+    // Blocks while the queue is full so no batch is ever dropped.
+    Batch& beginBatch();
+    void commitBatch();
+    
+    // Wait until every committed batch has been rasterised
+    void waitIdle();
+    
+    // Presenter side: latest completed frame (RGBA, 160x144)
+    const uint32_t* acquireFrame();
+    
+    // Canvas access for handing the picture over when rendering moves between
+    // threads. Only valid while idle (after waitIdle).
+    void setCanvas(const uint32_t* pixels);
+    void getCanvas(uint32_t* pixels) const;
+    
+    // Per-scanline completion callback, invoked on the render thread.
+    // Only change while idle (after waitIdle).
+    void setScanlineCallback(PPU::ScanlineCallback callback, void* user);
+
+private:
+    static constexpr int QUEUE_SIZE = 16;  // Power of two
+    
+    std::array<Batch, QUEUE_SIZE> queue;
+    std::atomic<uint32_t> queueHead;  // Next slot to consume
+    std::atomic<uint32_t> queueTail;  // Next slot to produce
+    
+    // Render thread state
+    std::array<uint8_t, 0x2000> vram;
+    std::array<uint8_t, 0xA0> oam;
+    std::array<uint32_t, SCREEN_WIDTH * SCREEN_HEIGHT> canvas;
+    
+    // Triple buffer: render thread owns back, presenter owns front, and the
+    // middle slot is exchanged atomically. NEW_FRAME marks an unread frame.
+    std::array<std::array<uint32_t, SCREEN_WIDTH * SCREEN_HEIGHT>, 3> frames;
+    int backIndex;
+    int frontIndex;
+    std::atomic<int> middle;
+    static constexpr int NEW_FRAME = 4;
+    
+    bool running;
+    
+    PPU::ScanlineCallback scanlineCallback;
+    void* scanlineUser;
+
+#if GBEMU_HAS_THREADS
+    std::thread worker;
+    std::atomic<bool> stopRequested;
+    std::atomic<bool> workerSleeping;
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    
+    void run();
+#endif
+
+    void process(const Batch& batch);
+    void publishFrame();
+};
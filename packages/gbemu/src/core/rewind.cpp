@@ -0,0 +1,244 @@
+#include "rewind.h"
+#include "packbits.h"
+#include <algorithm>
+#include <cstring>
+
+RewindBuffer::RewindBuffer(MMU& mmu, int maxFrames, size_t budgetBytes)
+    : mmu(mmu)
+    , maxFrames(std::max(maxFrames, 1))
+    , budgetBytes(budgetBytes)
+    , firstSerial(0)
+    , nextCompress(0)
+    , nextId(0)
+    , memoryUsed(0)
+    , memoryEpoch(0)
+    , groupFrames(0)
+#if GBEMU_HAS_THREADS
+    , stopRequested(false)
+#endif
+{
+#if GBEMU_HAS_THREADS
+    worker = std::thread(&RewindBuffer::run, this);
+#endif
+}
+
+RewindBuffer::~RewindBuffer() {
+#if GBEMU_HAS_THREADS
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopRequested = true;
+    }
+    wakeCondition.notify_one();
+    worker.join();
+#endif
+}
+
+size_t RewindBuffer::frameBytes(const Frame& frame) {
+    return sizeof(Frame) + frame.registers.capacity() + frame.data.capacity();
+}
+
+void RewindBuffer::capture(const uint8_t* registers, size_t size) {
+    Frame frame;
+    frame.id = nextId++;
+    frame.compressed = false;
+    frame.pages.fill(0);
+    frame.registers.assign(registers, registers + size);
+    
+    // Keyframe when the newest group is full (or there is none)
+    frame.keyframe = groupFrames == 0 || groupFrames >= KEYFRAME_INTERVAL;
+    groupFrames = frame.keyframe ? 1 : groupFrames + 1;
+    
+    int pageCount = mmu.getMemoryPageCount();
+    for (int page = 0; page < pageCount; page++) {
+        if (!frame.keyframe && !mmu.isMemoryPageWritten(page, memoryEpoch)) continue;
+        
+        int pageSize;
+        const uint8_t* bytes = mmu.getMemoryPage(page, pageSize);
+        size_t offset = frame.data.size();
+        frame.data.resize(offset + 3 + pageSize);
+        frame.data[offset] = static_cast<uint8_t>(page);
+        frame.data[offset + 1] = static_cast<uint8_t>(pageSize);
+        frame.data[offset + 2] = static_cast<uint8_t>(pageSize >> 8);
+        std::memcpy(&frame.data[offset + 3], bytes, pageSize);
+        frame.pages[page >> 6] |= 1ull << (page & 63);
+    }
+    memoryEpoch = mmu.beginMemoryEpoch();
+    
+#if GBEMU_HAS_THREADS
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        memoryUsed += frameBytes(frame);
+        frames.push_back(std::move(frame));
+        trim();
+    }
+    wakeCondition.notify_one();
+#else
+    frame.data = compressPages(frame.data);
+    frame.compressed = true;
+    memoryUsed += frameBytes(frame);
+    frames.push_back(std::move(frame));
+    trim();
+#endif
+}
+
+void RewindBuffer::trim() {
+    while (true) {
+        // Frames in the oldest group, if there is a newer one
+        size_t groupSize = 1;
+        while (groupSize < frames.size() && !frames[groupSize].keyframe) {
+            groupSize++;
+        }
+        if (groupSize == frames.size()) break;
+        
+        bool overLength = frames.size() - groupSize >= static_cast<size_t>(maxFrames);
+        if (!overLength && memoryUsed <= budgetBytes) break;
+        
+        for (size_t i = 0; i < groupSize; i++) {
+            memoryUsed -= frameBytes(frames.front());
+            frames.pop_front();
+        }
+        firstSerial += groupSize;
+    }
+}
+
+const std::vector<uint8_t>* RewindBuffer::stepBack() {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    if (frames.size() < 2) return nullptr;
+    
+    // The live machine is the newest frame plus the pages written since
+    PageMask restore = frames.back().pages;
+    int pageCount = mmu.getMemoryPageCount();
+    for (int page = 0; page < pageCount; page++) {
+        if (mmu.isMemoryPageWritten(page, memoryEpoch)) {
+            restore[page >> 6] |= 1ull << (page & 63);
+        }
+    }
+    
+    memoryUsed -= frameBytes(frames.back());
+    frames.pop_back();
+    groupFrames = groupFrames > 1 ? groupFrames - 1 : 0;
+    if (groupFrames == 0) {
+        // Back into the previous group
+        while (groupFrames < static_cast<int>(frames.size()) && !frames[frames.size() - 1 - groupFrames].keyframe) {
+            groupFrames++;
+        }
+        groupFrames++;
+    }
+    nextCompress = std::min(nextCompress, firstSerial + frames.size());
+    
+    // Each page's latest copy at or before the target frame; the group's
+    // keyframe holds every page, so the search always ends there
+    for (int page = 0; page < pageCount; page++) {
+        if (!hasPage(restore, page)) continue;
+        
+        for (size_t i = frames.size(); i-- > 0; ) {
+            if (hasPage(frames[i].pages, page)) {
+                restorePage(frames[i], page);
+                break;
+            }
+        }
+    }
+    memoryEpoch = mmu.beginMemoryEpoch();
+    
+    return &frames.back().registers;
+}
+
+void RewindBuffer::restorePage(const Frame& frame, int page) {
+    const uint8_t* entry = frame.data.data();
+    while (entry[0] != page) {
+        entry += 3 + (entry[1] | (entry[2] << 8));
+    }
+    
+    // Other snapshot owners must see the page as written
+    mmu.touchMemoryPage(page);
+    
+    int pageSize;
+    uint8_t* bytes = mmu.getWritableMemoryPage(page, pageSize);
+    if (frame.compressed) {
+        unpackBits(entry + 3, entry[1] | (entry[2] << 8), bytes, pageSize);
+    } else {
+        std::memcpy(bytes, entry + 3, pageSize);
+    }
+}
+
+std::vector<uint8_t> RewindBuffer::compressPages(const std::vector<uint8_t>& raw) {
+    std::vector<uint8_t> packed(packBitsBound(raw.size()));
+    size_t length = 0;
+    
+    for (size_t offset = 0; offset < raw.size(); ) {
+        int pageSize = raw[offset + 1] | (raw[offset + 2] << 8);
+        size_t packedSize = packBits(&raw[offset + 3], pageSize, &packed[length + 3]);
+        packed[length] = raw[offset];
+        packed[length + 1] = static_cast<uint8_t>(packedSize);
+        packed[length + 2] = static_cast<uint8_t>(packedSize >> 8);
+        length += 3 + packedSize;
+        offset += 3 + pageSize;
+    }
+    
+    packed.resize(length);
+    packed.shrink_to_fit();
+    return packed;
+}
+
+void RewindBuffer::clear() {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    firstSerial += frames.size();
+    nextCompress = firstSerial;
+    frames.clear();
+    memoryUsed = 0;
+    groupFrames = 0;
+}
+
+int RewindBuffer::getFrameCount() const {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    return static_cast<int>(frames.size());
+}
+
+size_t RewindBuffer::getMemoryUsage() const {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(mutex);
+#endif
+    return memoryUsed;
+}
+
+#if GBEMU_HAS_THREADS
+void RewindBuffer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    
+    while (true) {
+        wakeCondition.wait(lock, [this] {
+            return stopRequested || std::max(nextCompress, firstSerial) < firstSerial + frames.size();
+        });
+        if (stopRequested) break;
+        
+        // Compress a copy without holding the lock, then swap it in if the
+        // frame is still there
+        uint64_t serial = std::max(nextCompress, firstSerial);
+        const Frame& frame = frames[serial - firstSerial];
+        uint64_t id = frame.id;
+        std::vector<uint8_t> raw = frame.data;
+        
+        lock.unlock();
+        std::vector<uint8_t> packed = compressPages(raw);
+        lock.lock();
+        
+        if (serial >= firstSerial && serial < firstSerial + frames.size()) {
+            Frame& current = frames[serial - firstSerial];
+            if (current.id == id) {
+                memoryUsed -= frameBytes(current);
+                current.data = std::move(packed);
+                current.compressed = true;
+                memoryUsed += frameBytes(current);
+                nextCompress = serial + 1;
+                trim();
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <deque>
+#include <vector>
+
+#include "mmu.h"
+#include "threads.h"
+
+/**
+ * RewindBuffer - Per-frame history for stepping the emulation backwards
+ *
+ * Every captured frame stores the machine's register block (all save-state
+ * sections except memory, a few hundred bytes) and the 256-byte memory pages
+ * written since the previous capture, as reported by the MMU's page epochs.
+ * Every KEYFRAME_INTERVAL frames all pages are stored, so a page's content at
+ * any frame is its most recent copy at or before that frame, found without
+ * replaying anything.
+ *
+ * Stepping back only restores the pages that differ between the live machine
+ * and the previous frame: those written since the last capture plus those
+ * stored by the frame being dropped. That is a handful of pages per step, so
+ * holding rewind at 60 fps costs next to nothing.
+ *
+ * Pages are PackBits-compressed on a worker thread (inline without thread
+ * support). History is dropped a keyframe group at a time, oldest first, to
+ * stay within the frame limit and the memory budget; the newest group is
+ * always kept.
+ */
+class RewindBuffer {
+public:
+    static constexpr int KEYFRAME_INTERVAL = 60;
+    
+    RewindBuffer(MMU& mmu, int maxFrames, size_t budgetBytes);
+    ~RewindBuffer();
+    
+    RewindBuffer(const RewindBuffer&) = delete;
+    RewindBuffer& operator=(const RewindBuffer&) = delete;
+    
+    // Record the current frame. `registers` is the machine state apart from
+    // memory.
+    void capture(const uint8_t* registers, size_t size);
+    
+    // Drop the newest frame and write the previous frame's memory back into
+    // the MMU. Returns that frame's register block to load, or nullptr when
+    // no older frame is left.
+    const std::vector<uint8_t>* stepBack();
+    
+    // Forget all history (next capture is a keyframe)
+    void clear();
+    
+    int getFrameCount() const;
+    size_t getMemoryUsage() const;
+
+private:
+    using PageMask = std::array<uint64_t, MMU::MAX_MEMORY_PAGES / 64>;
+    
+    struct Frame {
+        uint64_t id;                     // Unique, identifies the frame to the worker
+        bool keyframe;
+        bool compressed;
+        PageMask pages;                  // Pages stored in this frame
+        std::vector<uint8_t> registers;
+        std::vector<uint8_t> data;       // Per page: index (u8), length (u16), bytes
+    };
+    
+    MMU& mmu;
+    int maxFrames;
+    size_t budgetBytes;
+    
+    std::deque<Frame> frames;
+    uint64_t firstSerial;     // Position of frames.front() in the capture sequence
+    uint64_t nextCompress;    // Frames before this position are compressed
+    uint64_t nextId;
+    size_t memoryUsed;
+    uint32_t memoryEpoch;     // MMU epoch at the last capture or restore
+    int groupFrames;          // Frames in the newest keyframe group
+    
+    static bool hasPage(const PageMask& mask, int page) { return (mask[page >> 6] >> (page & 63)) & 1; }
+    static size_t frameBytes(const Frame& frame);
+    
+    void trim();
+    void restorePage(const Frame& frame, int page);
+    static std::vector<uint8_t> compressPages(const std::vector<uint8_t>& raw);
+
+#if GBEMU_HAS_THREADS
+    // Compression worker; the mutex guards the history against it
+    std::thread worker;
+    bool stopRequested;
+    mutable std::mutex mutex;
+    std::condition_variable wakeCondition;
+    
+    void run();
+#endif
+};
@@ -0,0 +1,321 @@
+#include "serial_link.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+enum MessageType : uint8_t {
+    MSG_CLOCK = 1,
+    MSG_REPLY = 2,
+    MSG_CANCEL = 3,
+    MSG_SYNC = 4
+};
+
+// Type, cycle (64-bit little-endian), two bytes of payload
+constexpr size_t MESSAGE_SIZE = 11;
+
+// Check for messages every this many cycles (a quarter of a byte time)
+constexpr uint64_t POLL_CYCLES = 1024;
+
+}
+
+SerialLink::SerialLink(GameBoy& gb, Transport& transport, int windowFrames)
+    : gb(gb)
+    , transport(transport)
+    , start(gb.getTotalCycles())
+    , localCursor(0)
+    , remoteCursor(0)
+    , inputCursor(0)
+    , prediction(0xFF)
+    , snapshots(std::max(windowFrames, 3))
+    , snapshotFirst(0)
+    , snapshotCount(0)
+    , snapshotDue(true)
+    , peerCycle(0)
+    , maxLead(static_cast<uint64_t>(snapshots.size() - 2) * GameBoy::CYCLES_PER_FRAME)
+    , nextPoll(0)
+    , rollbackTarget(UINT64_MAX)
+{
+    resetStats();
+    gb.getMMU().setSerialCallback(clocked, this);
+}
+
+SerialLink::~SerialLink() {
+    gb.getMMU().setSerialCallback(nullptr, nullptr);
+}
+
+bool SerialLink::runFrame() {
+    poll();
+    if (rollbackTarget != UINT64_MAX) {
+        rollback();
+    }
+    
+    // Stay within reach of the peer's corrections
+    if (transport.isConnected() && getCycle() > peerCycle + maxLead) {
+        stats.stalls++;
+        return false;
+    }
+    
+    bool frameDone = false;
+    while (!frameDone) {
+        if (getCycle() >= nextPoll) {
+            poll();
+            if (rollbackTarget != UINT64_MAX) {
+                rollback();
+            }
+            nextPoll = getCycle() + POLL_CYCLES;
+        }
+        frameDone = step();
+    }
+    send(MSG_SYNC, getCycle());
+    return true;
+}
+
+void SerialLink::setButton(int button, bool pressed) {
+    gb.setButton(button, pressed);
+    inputs.push_back({ getCycle(), static_cast<uint8_t>(button), pressed });
+    inputCursor = inputs.size();
+}
+
+SerialLink::Stats SerialLink::getStats() const {
+    return stats;
+}
+
+void SerialLink::resetStats() {
+    stats = Stats();
+}
+
+bool SerialLink::step() {
+    uint64_t now = getCycle();
+    
+    // Input is applied live by setButton; this replays it after a rollback
+    while (inputCursor < inputs.size() && inputs[inputCursor].cycle <= now) {
+        gb.setButton(inputs[inputCursor].button, inputs[inputCursor].pressed);
+        inputCursor++;
+    }
+    
+    // The peer's transfers complete ours as soon as we reach their cycle
+    while (remoteCursor < remoteClocks.size() && remoteClocks[remoteCursor].cycle <= now) {
+        RemoteClock& clock = remoteClocks[remoteCursor++];
+        uint8_t reply = gb.getMMU().receiveSerial(clock.in);
+        if (!clock.replied) {
+            stats.received++;
+        }
+        if (!clock.replied || clock.reply != reply) {
+            clock.reply = reply;
+            clock.replied = true;
+            send(MSG_REPLY, clock.cycle, clock.in, reply);
+        }
+    }
+    
+    // Snapshots hold everything up to and including their cycle
+    if (snapshotDue) {
+        takeSnapshot();
+        snapshotDue = false;
+    }
+    
+    bool frameDone = gb.stepFrame();
+    if (frameDone) {
+        snapshotDue = true;
+    }
+    return frameDone;
+}
+
+void SerialLink::poll() {
+    while (transport.receive(message)) {
+        handleMessage();
+    }
+}
+
+void SerialLink::handleMessage() {
+    if (message.size() != MESSAGE_SIZE) return;
+    
+    uint64_t cycle = 0;
+    for (int i = 0; i < 8; i++) {
+        cycle |= static_cast<uint64_t>(message[1 + i]) << (i * 8);
+    }
+    uint8_t first = message[9];
+    uint8_t second = message[10];
+    
+    switch (message[0]) {
+        case MSG_CLOCK: {
+            auto position = std::upper_bound(remoteClocks.begin(), remoteClocks.end(), cycle,
+                [](uint64_t value, const RemoteClock& clock) { return value < clock.cycle; });
+            size_t index = position - remoteClocks.begin();
+            remoteClocks.insert(position, { cycle, first, 0, false });
+            if (index < remoteCursor) {
+                remoteCursor++;
+            }
+            // Already past it: re-run from before the transfer
+            if (cycle < getCycle()) {
+                requestRollback(cycle);
+            }
+            break;
+        }
+        case MSG_REPLY: {
+            auto position = std::lower_bound(localClocks.begin(), localClocks.end(), cycle,
+                [](const LocalClock& clock, uint64_t value) { return clock.cycle < value; });
+            for (; position != localClocks.end() && position->cycle == cycle; ++position) {
+                if (position->out != first) continue;
+                if (position->in != second) {
+                    stats.mispredictions++;
+                    position->in = second;
+                    requestRollback(cycle);
+                }
+                position->confirmed = true;
+                prediction = second;
+                break;
+            }
+            break;
+        }
+        case MSG_CANCEL: {
+            auto position = std::lower_bound(remoteClocks.begin(), remoteClocks.end(), cycle,
+                [](const RemoteClock& clock, uint64_t value) { return clock.cycle < value; });
+            size_t index = position - remoteClocks.begin();
+            if (index < remoteCursor) {
+                requestRollback(position->cycle);
+                remoteCursor = index;
+            }
+            remoteClocks.erase(position, remoteClocks.end());
+            break;
+        }
+        case MSG_SYNC:
+            peerCycle = std::max(peerCycle, cycle);
+            break;
+    }
+}
+
+void SerialLink::send(uint8_t type, uint64_t cycle, uint8_t first, uint8_t second) {
+    uint8_t data[MESSAGE_SIZE];
+    data[0] = type;
+    for (int i = 0; i < 8; i++) {
+        data[1 + i] = static_cast<uint8_t>(cycle >> (i * 8));
+    }
+    data[9] = first;
+    data[10] = second;
+    transport.send(data, sizeof(data));
+}
+
+void SerialLink::requestRollback(uint64_t cycle) {
+    rollbackTarget = std::min(rollbackTarget, cycle);
+}
+
+void SerialLink::rollback() {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point began = Clock::now();
+    
+    uint64_t target = rollbackTarget;
+    uint64_t now = getCycle();
+    rollbackTarget = UINT64_MAX;
+    
+    // Latest snapshot from before the corrected event
+    size_t kept = snapshotCount;
+    while (kept > 0 && snapshots[(snapshotFirst + kept - 1) % snapshots.size()].cycle >= target) {
+        kept--;
+    }
+    if (kept == 0) {
+        stats.desyncs++;
+        return;
+    }
+    const Snapshot& snapshot = snapshots[(snapshotFirst + kept - 1) % snapshots.size()];
+    if (!gb.loadState(snapshot.state.data(), snapshot.state.size())) {
+        stats.desyncs++;
+        return;
+    }
+    snapshotCount = kept;
+    snapshotDue = false;
+    
+    // Everything after the snapshot happens again
+    uint64_t from = snapshot.cycle;
+    localCursor = std::upper_bound(localClocks.begin(), localClocks.end(), from,
+        [](uint64_t value, const LocalClock& clock) { return value < clock.cycle; }) - localClocks.begin();
+    remoteCursor = std::upper_bound(remoteClocks.begin(), remoteClocks.end(), from,
+        [](uint64_t value, const RemoteClock& clock) { return value < clock.cycle; }) - remoteClocks.begin();
+    inputCursor = std::upper_bound(inputs.begin(), inputs.end(), from,
+        [](uint64_t value, const InputEvent& event) { return value < event.cycle; }) - inputs.begin();
+    
+    // Re-run to where we were, unheard, drawing only the frame in progress
+    APU& apu = gb.getAPU();
+    PPU& ppu = gb.getPPU();
+    bool audio = apu.isOutputEnabled();
+    bool skipped = ppu.isRenderingSkipped();
+    apu.setOutputEnabled(false);
+    while (getCycle() < now) {
+        ppu.setRenderingSkipped(skipped || now - getCycle() > GameBoy::CYCLES_PER_FRAME);
+        step();
+    }
+    ppu.setRenderingSkipped(skipped);
+    apu.setOutputEnabled(audio);
+    
+    // Our own transfers that did not happen again are withdrawn
+    if (localCursor < localClocks.size()) {
+        send(MSG_CANCEL, localClocks[localCursor].cycle);
+        localClocks.resize(localCursor);
+    }
+    
+    uint64_t depth = now - from;
+    stats.rollbacks++;
+    stats.rollbackCycles += depth;
+    stats.maxRollbackCycles = std::max(stats.maxRollbackCycles, depth);
+    stats.resimSeconds += std::chrono::duration<double>(Clock::now() - began).count();
+}
+
+void SerialLink::takeSnapshot() {
+    if (snapshotCount == snapshots.size()) {
+        snapshotFirst = (snapshotFirst + 1) % snapshots.size();
+        snapshotCount--;
+    }
+    Snapshot& snapshot = snapshots[(snapshotFirst + snapshotCount) % snapshots.size()];
+    snapshot.cycle = getCycle();
+    snapshot.state.resize(gb.getStateSize());
+    snapshot.state.resize(gb.saveState(snapshot.state.data(), snapshot.state.size()));
+    snapshotCount++;
+    
+    trimHistory();
+}
+
+void SerialLink::trimHistory() {
+    // Events up to the oldest snapshot can never be re-run
+    uint64_t oldest = snapshots[snapshotFirst].cycle;
+    
+    size_t local = 0;
+    while (local < localClocks.size() && localClocks[local].cycle <= oldest) local++;
+    localClocks.erase(localClocks.begin(), localClocks.begin() + local);
+    localCursor -= local;
+    
+    size_t remote = 0;
+    while (remote < remoteCursor && remoteClocks[remote].cycle <= oldest) remote++;
+    remoteClocks.erase(remoteClocks.begin(), remoteClocks.begin() + remote);
+    remoteCursor -= remote;
+    
+    size_t input = 0;
+    while (input < inputCursor && inputs[input].cycle <= oldest) input++;
+    inputs.erase(inputs.begin(), inputs.begin() + input);
+    inputCursor -= input;
+}
+
+uint8_t SerialLink::clocked(void* user, uint8_t out) {
+    SerialLink* link = static_cast<SerialLink*>(user);
+    if (!link->transport.isConnected()) return 0xFF;
+    
+    uint64_t cycle = link->getCycle();
+    std::vector<LocalClock>& clocks = link->localClocks;
+    
+    // Re-running: the same transfer again keeps its reply
+    if (link->localCursor < clocks.size()) {
+        LocalClock& clock = clocks[link->localCursor];
+        if (clock.cycle == cycle && clock.out == out) {
+            link->localCursor++;
+            return clock.in;
+        }
+        // The re-run went another way; the rest never happened
+        link->send(MSG_CANCEL, clock.cycle);
+        clocks.resize(link->localCursor);
+    }
+    
+    clocks.push_back({ cycle, out, link->prediction, false });
+    link->localCursor++;
+    link->send(MSG_CLOCK, cycle, out);
+    link->stats.transfers++;
+    return link->prediction;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "gameboy.h"
+#include "transport.h"
+
+/**
+ * SerialLink - Link port of one GameBoy connected to a peer over a Transport
+ *
+ * The out-of-process counterpart of LinkCable: each emulator owns one
+ * SerialLink, and the two exchange cycle-timestamped messages instead of
+ * sharing a thread. Cycles count from when each side connected, so both
+ * ends must connect at the same point of their runs (typically power-on).
+ *
+ *   CLOCK   a transfer clocked by this side (internal clock) completed at
+ *           cycle t, shifting out a byte
+ *   REPLY   the byte the receiving side shifted back at cycle t
+ *   CANCEL  clocks at or after cycle t were rolled back and never happened
+ *   SYNC    this side completed a frame at cycle t (for pacing)
+ *
+ * Neither side waits for the network. A clocked transfer completes at once
+ * with a predicted reply (the last byte received); the peer applies the
+ * CLOCK when it reaches cycle t. When the real reply differs from the
+ * prediction, or a CLOCK arrives for a cycle this side has already passed,
+ * the machine rolls back to the last frame snapshot before t and re-runs
+ * to where it was, silently and undrawn, with the corrected byte. Local
+ * input must go through setButton so it is replayed at the same cycle.
+ *
+ * Snapshots are taken at every frame end and kept for `windowFrames`
+ * frames. runFrame stalls (returns false without running) while this side
+ * is more than windowFrames - 2 frames ahead of the peer's last SYNC, so a
+ * rollback never needs an older snapshot; the same bound caps the cost of
+ * one rollback. Without a connection the port behaves as unplugged.
+ */
+class SerialLink {
+public:
+    static constexpr int DEFAULT_WINDOW_FRAMES = 8;
+    
+    struct Stats {
+        uint64_t transfers;         // Bytes clocked out by this side
+        uint64_t received;          // Bytes clocked in by the peer
+        uint64_t mispredictions;    // Replies that differed from the prediction
+        uint64_t rollbacks;
+        uint64_t rollbackCycles;    // Total re-simulated cycles
+        uint64_t maxRollbackCycles; // Deepest single rollback
+        double resimSeconds;        // Wall time spent re-simulating
+        uint64_t stalls;            // runFrame calls that waited for the peer
+        uint64_t desyncs;           // Corrections older than the window
+    };
+    
+    SerialLink(GameBoy& gb, Transport& transport, int windowFrames = DEFAULT_WINDOW_FRAMES);
+    ~SerialLink();
+    
+    SerialLink(const SerialLink&) = delete;
+    SerialLink& operator=(const SerialLink&) = delete;
+    
+    // Run until a frame completes. Returns false, having run nothing, when
+    // the peer is too far behind; call again (after a short wait).
+    bool runFrame();
+    
+    // Joypad input for the linked machine
+    void setButton(int button, bool pressed);
+    
+    bool isConnected() const { return transport.isConnected(); }
+    
+    // Cycles since connecting
+    uint64_t getCycle() const { return gb.getTotalCycles() - start; }
+    
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    // Transfers clocked by this side, in cycle order
+    struct LocalClock {
+        uint64_t cycle;
+        uint8_t out;
+        uint8_t in;         // Reply used: predicted, or the peer's once confirmed
+        bool confirmed;
+    };
+    
+    // Transfers clocked by the peer, in cycle order
+    struct RemoteClock {
+        uint64_t cycle;
+        uint8_t in;
+        uint8_t reply;      // Last reply sent
+        bool replied;
+    };
+    
+    struct InputEvent {
+        uint64_t cycle;
+        uint8_t button;
+        bool pressed;
+    };
+    
+    struct Snapshot {
+        uint64_t cycle;
+        std::vector<uint8_t> state;
+    };
+    
+    GameBoy& gb;
+    Transport& transport;
+    uint64_t start;
+    
+    std::vector<LocalClock> localClocks;
+    std::vector<RemoteClock> remoteClocks;
+    std::vector<InputEvent> inputs;
+    size_t localCursor;     // Next local clock to match while re-running
+    size_t remoteCursor;    // Next remote clock to apply
+    size_t inputCursor;     // Next input to apply while re-running
+    uint8_t prediction;
+    
+    // Ring of frame-end snapshots, oldest first
+    std::vector<Snapshot> snapshots;
+    size_t snapshotFirst;
+    size_t snapshotCount;
+    bool snapshotDue;
+    
+    uint64_t peerCycle;         // Peer's last SYNC
+    uint64_t maxLead;
+    uint64_t nextPoll;
+    uint64_t rollbackTarget;    // Earliest cycle to correct; UINT64_MAX = none
+    std::vector<uint8_t> message;
+    
+    Stats stats;
+    
+    // Execute one instruction, applying due events first
+    bool step();
+    
+    void poll();
+    void handleMessage();
+    void send(uint8_t type, uint64_t cycle, uint8_t first = 0, uint8_t second = 0);
+    
+    void requestRollback(uint64_t cycle);
+    void rollback();
+    void takeSnapshot();
+    void trimHistory();
+    
+    static uint8_t clocked(void* user, uint8_t out);
+};
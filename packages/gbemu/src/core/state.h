@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * Save-state serialisation
+ *
+ * A state is a flat byte stream in host (little-endian) order:
+ *   header:  magic 'GBST', format version, total size, ROM checksum
+ *   sections: tag, payload length, payload   (one per component)
+ *
+ * Fields are written one by one (no struct padding), so identical machine
+ * states always produce identical bytes. Sections carry their length so a
+ * reader can check or skip them individually.
+ *
+ * Both classes never allocate and never throw: running out of space or data
+ * sets a failure flag that the caller checks once at the end (ok()).
+ */
+
+// Section tags
+constexpr uint32_t makeStateTag(char a, char b, char c, char d) {
+    return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) |
+           (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+class StateWriter {
+public:
+    // With a null buffer the writer only measures the state size
+    StateWriter(uint8_t* buffer, size_t capacity)
+        : buffer(buffer)
+        , capacity(buffer ? capacity : SIZE_MAX)
+        , position(0)
+        , sectionStart(0)
+        , failed(false)
+    {
+    }
+    
+    template <typename T>
+    void write(T value) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Write fields individually");
+        writeBytes(&value, sizeof(T));
+    }
+    
+    void write(bool value) {
+        write(static_cast<uint8_t>(value));
+    }
+    
+    void writeBytes(const void* data, size_t size) {
+        if (size > capacity - position) {
+            failed = true;
+            return;
+        }
+        if (buffer) {
+            std::memcpy(buffer + position, data, size);
+        }
+        position += size;
+    }
+    
+    // Sections: tag and length, patched in by endSection()
+    void beginSection(uint32_t tag) {
+        write(tag);
+        sectionStart = position;
+        write(static_cast<uint32_t>(0));
+    }
+    
+    void endSection() {
+        uint32_t length = static_cast<uint32_t>(position - sectionStart - sizeof(uint32_t));
+        if (buffer && !failed) {
+            std::memcpy(buffer + sectionStart, &length, sizeof(length));
+        }
+    }
+    
+    size_t size() const { return position; }
+    bool ok() const { return !failed; }
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t position;
+    size_t sectionStart;
+    bool failed;
+};
+
+class StateReader {
+public:
+    StateReader(const uint8_t* data, size_t size)
+        : data(data)
+        , length(size)
+        , position(0)
+        , sectionEnd(0)
+        , failed(false)
+    {
+    }
+    
+    template <typename T>
+    void read(T& value) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Read fields individually");
+        readBytes(&value, sizeof(T));
+    }
+    
+    void read(bool& value) {
+        uint8_t byte = 0;
+        read(byte);
+        value = byte != 0;
+    }
+    
+    template <typename T>
+    T get() {
+        T value{};
+        read(value);
+        return value;
+    }
+    
+    void readBytes(void* out, size_t size) {
+        if (failed || size > length - position) {
+            failed = true;
+            std::memset(out, 0, size);
+            return;
+        }
+        std::memcpy(out, data + position, size);
+        position += size;
+    }
+    
+    // Enter a section; fails unless the next section has this tag and fits
+    bool beginSection(uint32_t tag) {
+        uint32_t found = get<uint32_t>();
+        uint32_t sectionLength = get<uint32_t>();
+        if (failed || found != tag || sectionLength > length - position) {
+            failed = true;
+            return false;
+        }
+        sectionEnd = position + sectionLength;
+        return true;
+    }
+    
+    // Leave a section; fails unless exactly its payload was consumed
+    void endSection() {
+        if (position != sectionEnd) {
+            failed = true;
+        }
+    }
+    
+    // Tag of the next section without consuming it (0 at the end)
+    uint32_t peekSection() const {
+        uint32_t tag = 0;
+        if (!failed && length - position >= sizeof(tag)) {
+            std::memcpy(&tag, data + position, sizeof(tag));
+        }
+        return tag;
+    }
+    
+    // Skip the next section entirely
+    void skipSection() {
+        get<uint32_t>();
+        uint32_t sectionLength = get<uint32_t>();
+        if (failed || sectionLength > length - position) {
+            failed = true;
+            return;
+        }
+        position += sectionLength;
+    }
+    
+    size_t remaining() const { return length - position; }
+    size_t sectionRemaining() const { return sectionEnd > position ? sectionEnd - position : 0; }
+    bool ok() const { return !failed; }
+    void fail() { failed = true; }
+
+private:
+    const uint8_t* data;
+    size_t length;
+    size_t position;
+    size_t sectionEnd;
+    bool failed;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+// Threads are available natively and in Emscripten builds with -pthread
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define GBEMU_HAS_THREADS 0
+#else
+#define GBEMU_HAS_THREADS 1
+#endif
+
+#if GBEMU_HAS_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
@@ -0,0 +1,148 @@
+#include "time_stretch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+TimeStretch::TimeStretch()
+    : windowLength(0)
+    , hop(0)
+    , tolerance(0)
+    , ratio(1.0)
+    , analysisPos(0.0)
+    , naturalPos(-1)
+    , outputStart(0)
+{
+    setSampleRate(44100);
+}
+
+void TimeStretch::setSampleRate(int rate) {
+    hop = std::max(16, rate / 80);  // 12.5ms, so a window is 25ms
+    windowLength = hop * 2;
+    tolerance = std::max(8, rate / 125);
+    
+    // Periodic Hann: the two overlapping halves sum to exactly one
+    const double pi = 3.14159265358979323846;
+    window.resize(windowLength);
+    for (int i = 0; i < windowLength; i++) {
+        window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2.0 * pi * i / windowLength));
+    }
+    
+    clear();
+}
+
+void TimeStretch::setRatio(double newRatio) {
+    ratio = std::max(MIN_RATIO, std::min(MAX_RATIO, newRatio));
+}
+
+void TimeStretch::clear() {
+    input.clear();
+    output.clear();
+    outputStart = 0;
+    overlap.assign(hop * 2, 0.0f);
+    naturalPos = -1;
+    
+    // Leave room to search backwards from the first segment
+    input.assign(tolerance * 2, 0.0f);
+    analysisPos = tolerance;
+}
+
+void TimeStretch::push(const float* samples, int frames) {
+    input.insert(input.end(), samples, samples + frames * 2);
+    processSegments();
+}
+
+int TimeStretch::pull(float* out, int maxFrames) {
+    int count = std::min(maxFrames, available());
+    std::memcpy(out, output.data() + outputStart * 2, count * 2 * sizeof(float));
+    outputStart += count;
+    
+    // Compact once the consumed part dominates
+    if (outputStart * 2 >= output.size() / 2) {
+        output.erase(output.begin(), output.begin() + outputStart * 2);
+        outputStart = 0;
+    }
+    return count;
+}
+
+void TimeStretch::processSegments() {
+    while (true) {
+        int center = static_cast<int>(analysisPos);
+        int needed = center + tolerance + windowLength;
+        if (naturalPos >= 0) needed = std::max(needed, naturalPos + hop);
+        if (inputFrames() < needed) break;
+        
+        int start = (naturalPos < 0) ? center : findBestStart(center);
+        const float* segment = &input[start * 2];
+        
+        // First half completes the previous segment's fade-out
+        size_t base = output.size();
+        output.resize(base + hop * 2);
+        for (int i = 0; i < hop * 2; i++) {
+            float sample = overlap[i] + segment[i] * window[i / 2];
+            output[base + i] = std::max(-1.0f, std::min(1.0f, sample));
+        }
+        
+        // Second half fades out under the next segment
+        for (int i = 0; i < hop * 2; i++) {
+            overlap[i] = segment[hop * 2 + i] * window[hop + i / 2];
+        }
+        
+        naturalPos = start + hop;
+        analysisPos += hop * ratio;
+    }
+    
+    // Drop input that no future segment or template can reach
+    int consumed = static_cast<int>(analysisPos) - tolerance;
+    if (naturalPos >= 0) consumed = std::min(consumed, naturalPos);
+    if (consumed > 0) {
+        input.erase(input.begin(), input.begin() + consumed * 2);
+        analysisPos -= consumed;
+        if (naturalPos >= 0) naturalPos -= consumed;
+    }
+}
+
+int TimeStretch::findBestStart(int center) const {
+    // Coarse pass over every 4th offset on a decimated signal, then refine
+    constexpr int COARSE = 4;
+    int best = center;
+    double bestScore = -1e30;
+    
+    for (int start = center - tolerance; start <= center + tolerance; start += COARSE) {
+        double score = similarity(start, COARSE);
+        if (score > bestScore) {
+            bestScore = score;
+            best = start;
+        }
+    }
+    
+    int coarseBest = best;
+    int low = std::max(center - tolerance, coarseBest - COARSE + 1);
+    int high = std::min(center + tolerance, coarseBest + COARSE - 1);
+    bestScore = -1e30;
+    for (int start = low; start <= high; start++) {
+        double score = similarity(start, 2);
+        if (score > bestScore) {
+            bestScore = score;
+            best = start;
+        }
+    }
+    
+    return best;
+}
+
+double TimeStretch::similarity(int start, int step) const {
+    // Normalised cross-correlation (mono) between the candidate's first half
+    // and the natural continuation of the previous segment
+    const float* candidate = &input[start * 2];
+    const float* natural = &input[naturalPos * 2];
+    
+    double correlation = 0.0;
+    double energy = 1e-9;
+    for (int i = 0; i < hop; i += step) {
+        float c = candidate[i * 2] + candidate[i * 2 + 1];
+        float n = natural[i * 2] + natural[i * 2 + 1];
+        correlation += c * n;
+        energy += c * c;
+    }
+    return correlation / std::sqrt(energy);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * TimeStretch - WSOLA time-scale modification for fast-forward audio
+ *
+ * Plays stereo input `ratio` times faster at the original pitch and sample
+ * rate. Hann-windowed segments are taken from the input every ratio * hop
+ * frames and overlap-added every hop frames. Each segment's start is searched
+ * within a small tolerance for the best match with the natural continuation
+ * of the previous segment (waveform-similarity overlap-add), so joins stay
+ * phase-coherent instead of producing the usual granular warble.
+ *
+ * Usage: push() interleaved frames as they are produced, pull() the
+ * stretched output. Latency is about one window plus the search tolerance.
+ */
+class TimeStretch {
+public:
+    TimeStretch();
+    
+    // Window and search sizes follow the sample rate (~25ms / ~8ms)
+    void setSampleRate(int rate);
+    
+    // Speed-up factor (1 = unchanged duration, 4 = a quarter as long)
+    void setRatio(double ratio);
+    double getRatio() const { return ratio; }
+    
+    // Drop all buffered input and output
+    void clear();
+    
+    // Append interleaved stereo input frames
+    void push(const float* samples, int frames);
+    
+    // Read up to `maxFrames` stretched frames, returns frames read
+    int pull(float* out, int maxFrames);
+    
+    // Stretched frames ready to pull
+    int available() const { return static_cast<int>(output.size() / 2 - outputStart); }
+    
+    size_t getMemoryUsage() const {
+        return (input.capacity() + window.capacity() + overlap.capacity() + output.capacity()) * sizeof(float);
+    }
+    
+    static constexpr double MIN_RATIO = 0.5;
+    static constexpr double MAX_RATIO = 16.0;
+
+private:
+    int windowLength;       // Segment length in frames (even)
+    int hop;                // Output hop, half a window (50% overlap)
+    int tolerance;          // Search radius around the nominal segment start
+    double ratio;
+    
+    std::vector<float> input;   // Interleaved input not yet consumed
+    double analysisPos;         // Nominal start of the next segment in input
+    int naturalPos;             // Where the previous segment would continue, -1 if none
+    
+    std::vector<float> window;  // Hann window, windowLength taps
+    std::vector<float> overlap; // Windowed second half of the previous segment
+    
+    std::vector<float> output;  // Interleaved stretched frames
+    size_t outputStart;         // Frames of output already pulled
+    
+    int inputFrames() const { return static_cast<int>(input.size() / 2); }
+    
+    void processSegments();
+    int findBestStart(int center) const;
+    double similarity(int start, int step) const;
+};
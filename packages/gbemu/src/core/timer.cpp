@@ -1,5 +1,6 @@
 #include "timer.h"
 #include "mmu.h"
+#include "state.h"
 
 Timer::Timer(MMU& mmu) : mmu(mmu), internalCounter(0), prevTimerBit(false) {
 }
@@ -70,3 +71,13 @@ void Timer::onDivWrite() {
     }
     prevTimerBit = newBit;
 }
+
+void Timer::saveState(StateWriter& state) const {
+    state.write(internalCounter);
+    state.write(prevTimerBit);
+}
+
+void Timer::loadState(StateReader& state) {
+    state.read(internalCounter);
+    state.read(prevTimerBit);
+}
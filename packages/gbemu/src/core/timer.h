@@ -3,6 +3,8 @@
 #include <cstdint>
 
 class MMU;
+class StateWriter;
+class StateReader;
 
 /**
  * Timer - Handles DIV and TIMA registers
@@ -24,6 +26,10 @@ public:
     // Reset timer
     void reset();
     
+    // Save-state serialisation (see state.h)
+    void saveState(StateWriter& state) const;
+    void loadState(StateReader& state);
+    
     // Called when DIV is written (resets to 0, can cause falling edge)
     void onDivWrite();
     
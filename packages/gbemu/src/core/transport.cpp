@@ -0,0 +1,262 @@
+#include "transport.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if GBEMU_HAS_SOCKETS
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#endif
+
+#if GBEMU_HAS_SOCKETS
+// Socket address for "unix:<path>" or "tcp:<port>"
+struct SocketAddress {
+    int family;
+    sockaddr_storage storage;
+    socklen_t length;
+};
+
+static bool parseAddress(const char* address, SocketAddress& out) {
+    std::memset(&out, 0, sizeof(out));
+    if (std::strncmp(address, "unix:", 5) == 0) {
+        sockaddr_un* unixAddress = reinterpret_cast<sockaddr_un*>(&out.storage);
+        const char* path = address + 5;
+        if (std::strlen(path) >= sizeof(unixAddress->sun_path)) return false;
+        unixAddress->sun_family = AF_UNIX;
+        std::strcpy(unixAddress->sun_path, path);
+        out.family = AF_UNIX;
+        out.length = sizeof(sockaddr_un);
+        return true;
+    }
+    if (std::strncmp(address, "tcp:", 4) == 0) {
+        int port = std::atoi(address + 4);
+        if (port <= 0 || port > 65535) return false;
+        sockaddr_in* inetAddress = reinterpret_cast<sockaddr_in*>(&out.storage);
+        inetAddress->sin_family = AF_INET;
+        inetAddress->sin_port = htons(static_cast<uint16_t>(port));
+        inetAddress->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        out.family = AF_INET;
+        out.length = sizeof(sockaddr_in);
+        return true;
+    }
+    return false;
+}
+
+// Non-blocking, no Nagle delay (messages are tiny and latency-critical)
+static void configureSocket(int fd, int family) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (family == AF_INET) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::listen(const char* address, int timeoutMs) {
+    SocketAddress target;
+    if (!parseAddress(address, target)) return nullptr;
+    
+    int server = socket(target.family, SOCK_STREAM, 0);
+    if (server < 0) return nullptr;
+    if (target.family == AF_UNIX) {
+        unlink(reinterpret_cast<sockaddr_un*>(&target.storage)->sun_path);
+    } else {
+        int on = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    
+    int fd = -1;
+    if (bind(server, reinterpret_cast<sockaddr*>(&target.storage), target.length) == 0 &&
+        ::listen(server, 1) == 0) {
+        pollfd waiting = { server, POLLIN, 0 };
+        if (poll(&waiting, 1, timeoutMs) == 1) {
+            fd = accept(server, nullptr, nullptr);
+        }
+    }
+    close(server);
+    if (target.family == AF_UNIX) {
+        unlink(reinterpret_cast<sockaddr_un*>(&target.storage)->sun_path);
+    }
+    
+    if (fd < 0) return nullptr;
+    configureSocket(fd, target.family);
+    return std::unique_ptr<SocketTransport>(new SocketTransport(fd));
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::connect(const char* address, int timeoutMs) {
+    SocketAddress target;
+    if (!parseAddress(address, target)) return nullptr;
+    
+    // The listener may not be up yet: retry until the timeout
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    for (;;) {
+        int fd = socket(target.family, SOCK_STREAM, 0);
+        if (fd < 0) return nullptr;
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&target.storage), target.length) == 0) {
+            configureSocket(fd, target.family);
+            return std::unique_ptr<SocketTransport>(new SocketTransport(fd));
+        }
+        close(fd);
+        if (std::chrono::steady_clock::now() >= deadline) return nullptr;
+        usleep(10000);
+    }
+}
+
+SocketTransport::SocketTransport(int fd)
+    : fd(fd)
+    , incomingStart(0)
+{
+}
+
+SocketTransport::~SocketTransport() {
+    if (fd >= 0) {
+        flush();
+        disconnect();
+    }
+}
+
+bool SocketTransport::send(const uint8_t* data, size_t size) {
+    if (fd < 0 || size > MAX_MESSAGE_SIZE) return false;
+    
+    // Frame: 16-bit little-endian length, then the message
+    outgoing.push_back(static_cast<uint8_t>(size));
+    outgoing.push_back(static_cast<uint8_t>(size >> 8));
+    outgoing.insert(outgoing.end(), data, data + size);
+    return flush();
+}
+
+bool SocketTransport::receive(std::vector<uint8_t>& message) {
+    if (fd >= 0) {
+        flush();
+        
+        // Drain whatever the socket has
+        uint8_t buffer[4096];
+        for (;;) {
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count > 0) {
+                incoming.insert(incoming.end(), buffer, buffer + count);
+                continue;
+            }
+            if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                disconnect();
+            }
+            break;
+        }
+    }
+    
+    // Messages already received are still delivered after a disconnect
+    size_t available = incoming.size() - incomingStart;
+    if (available < 2) return false;
+    size_t size = incoming[incomingStart] | (incoming[incomingStart + 1] << 8);
+    if (available < 2 + size) return false;
+    
+    const uint8_t* start = incoming.data() + incomingStart + 2;
+    message.assign(start, start + size);
+    incomingStart += 2 + size;
+    if (incomingStart == incoming.size() || incomingStart > 65536) {
+        incoming.erase(incoming.begin(), incoming.begin() + incomingStart);
+        incomingStart = 0;
+    }
+    return true;
+}
+
+bool SocketTransport::flush() {
+    size_t sent = 0;
+    while (sent < outgoing.size()) {
+        ssize_t count = ::send(fd, outgoing.data() + sent, outgoing.size() - sent, MSG_NOSIGNAL);
+        if (count > 0) {
+            sent += count;
+        } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else {
+            disconnect();
+            return false;
+        }
+    }
+    outgoing.erase(outgoing.begin(), outgoing.begin() + sent);
+    return true;
+}
+
+void SocketTransport::disconnect() {
+    close(fd);
+    fd = -1;
+    outgoing.clear();
+}
+#endif
+
+void LoopbackTransport::createPair(std::unique_ptr<LoopbackTransport>& first, std::unique_ptr<LoopbackTransport>& second) {
+    auto forward = std::make_shared<Channel>();
+    auto backward = std::make_shared<Channel>();
+    first.reset(new LoopbackTransport(backward, forward));
+    second.reset(new LoopbackTransport(forward, backward));
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<Channel> inbox, std::shared_ptr<Channel> outbox)
+    : inbox(std::move(inbox))
+    , outbox(std::move(outbox))
+{
+}
+
+bool LoopbackTransport::send(const uint8_t* data, size_t size) {
+    if (size > MAX_MESSAGE_SIZE) return false;
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(outbox->mutex);
+#endif
+    outbox->messages.emplace_back(data, data + size);
+    return true;
+}
+
+bool LoopbackTransport::receive(std::vector<uint8_t>& message) {
+#if GBEMU_HAS_THREADS
+    std::lock_guard<std::mutex> lock(inbox->mutex);
+#endif
+    if (inbox->messages.empty()) return false;
+    message.swap(inbox->messages.front());
+    inbox->messages.pop_front();
+    return true;
+}
+
+DelayedTransport::DelayedTransport(std::unique_ptr<Transport> inner, int delayMs)
+    : inner(std::move(inner))
+    , delay(std::chrono::milliseconds(delayMs))
+{
+}
+
+bool DelayedTransport::send(const uint8_t* data, size_t size) {
+    if (size > MAX_MESSAGE_SIZE - STAMP_SIZE) return false;
+    
+    // Stamp: send time in steady_clock ticks, little-endian
+    uint64_t sent = static_cast<uint64_t>(Clock::now().time_since_epoch().count());
+    stamped.resize(STAMP_SIZE + size);
+    for (size_t i = 0; i < STAMP_SIZE; i++) {
+        stamped[i] = static_cast<uint8_t>(sent >> (8 * i));
+    }
+    std::memcpy(stamped.data() + STAMP_SIZE, data, size);
+    return inner->send(stamped.data(), stamped.size());
+}
+
+bool DelayedTransport::receive(std::vector<uint8_t>& message) {
+    while (inner->receive(stamped)) {
+        if (stamped.size() < STAMP_SIZE) continue;
+        uint64_t sent = 0;
+        for (size_t i = 0; i < STAMP_SIZE; i++) {
+            sent |= static_cast<uint64_t>(stamped[i]) << (8 * i);
+        }
+        Clock::time_point due = Clock::time_point(Clock::duration(static_cast<Clock::rep>(sent))) + delay;
+        pending.push_back({ due, std::vector<uint8_t>(stamped.begin() + STAMP_SIZE, stamped.end()) });
+    }
+    
+    // In arrival order, so a shorter setDelay cannot reorder messages
+    if (pending.empty() || pending.front().due > Clock::now()) return false;
+    message.swap(pending.front().data);
+    pending.pop_front();
+    return true;
+}
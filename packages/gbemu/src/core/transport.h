@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "threads.h"
+
+// Sockets everywhere but the browser
+#if defined(__EMSCRIPTEN__) || defined(_WIN32)
+#define GBEMU_HAS_SOCKETS 0
+#else
+#define GBEMU_HAS_SOCKETS 1
+#endif
+
+/**
+ * Transport - Message channel between two linked emulators
+ *
+ * Carries whole messages (up to MAX_MESSAGE_SIZE bytes), in order, without
+ * ever blocking: send() queues, receive() returns false when nothing has
+ * arrived yet. Used by the serial link (serial_link.h) and netplay.
+ *
+ *   SocketTransport     Unix-domain or loopback TCP stream to another process
+ *   LoopbackTransport   in-process pair, for tests and local sessions
+ *   DelayedTransport    wraps another and delivers every message a fixed
+ *                       time after it was sent, to test latency tolerance
+ */
+class Transport {
+public:
+    static constexpr size_t MAX_MESSAGE_SIZE = 0xFFFF;
+    
+    virtual ~Transport() {}
+    
+    // Queue one message; false once the connection is gone
+    virtual bool send(const uint8_t* data, size_t size) = 0;
+    
+    // Next received message, if any
+    virtual bool receive(std::vector<uint8_t>& message) = 0;
+    
+    virtual bool isConnected() const = 0;
+};
+
+#if GBEMU_HAS_SOCKETS
+class SocketTransport : public Transport {
+public:
+    // `address` is "unix:<path>" or "tcp:<port>" (127.0.0.1 only). listen()
+    // waits up to `timeoutMs` for one peer to connect; connect() retries
+    // until then. Null on failure.
+    static std::unique_ptr<SocketTransport> listen(const char* address, int timeoutMs);
+    static std::unique_ptr<SocketTransport> connect(const char* address, int timeoutMs);
+    
+    ~SocketTransport() override;
+    
+    bool send(const uint8_t* data, size_t size) override;
+    bool receive(std::vector<uint8_t>& message) override;
+    bool isConnected() const override { return fd >= 0; }
+
+private:
+    explicit SocketTransport(int fd);
+    
+    int fd;
+    std::vector<uint8_t> outgoing;  // Framed bytes the socket did not take yet
+    std::vector<uint8_t> incoming;  // Received bytes not yet returned
+    size_t incomingStart;
+    
+    bool flush();
+    void disconnect();
+};
+#endif
+
+class LoopbackTransport : public Transport {
+public:
+    // Two connected endpoints; each may be used from its own thread
+    static void createPair(std::unique_ptr<LoopbackTransport>& first, std::unique_ptr<LoopbackTransport>& second);
+    
+    bool send(const uint8_t* data, size_t size) override;
+    bool receive(std::vector<uint8_t>& message) override;
+    bool isConnected() const override { return true; }
+
+private:
+    struct Channel {
+        std::deque<std::vector<uint8_t>> messages;
+#if GBEMU_HAS_THREADS
+        std::mutex mutex;
+#endif
+    };
+    
+    LoopbackTransport(std::shared_ptr<Channel> inbox, std::shared_ptr<Channel> outbox);
+    
+    std::shared_ptr<Channel> inbox;
+    std::shared_ptr<Channel> outbox;
+};
+
+// Both ends of the link must be wrapped: send() stamps each message with
+// its send time and passes it on at once, and the receiving end holds it
+// until `delayMs` after that. The delay is applied on the receiving side so
+// a peer that stops pumping still has its last messages delivered. Stamps
+// come from steady_clock, which is shared by processes on one host.
+class DelayedTransport : public Transport {
+public:
+    static constexpr size_t STAMP_SIZE = 8;
+    
+    DelayedTransport(std::unique_ptr<Transport> inner, int delayMs);
+    
+    void setDelay(int delayMs) { delay = std::chrono::milliseconds(delayMs); }
+    
+    bool send(const uint8_t* data, size_t size) override;
+    bool receive(std::vector<uint8_t>& message) override;
+    // Messages still held count as in flight on a closed connection
+    bool isConnected() const override { return inner->isConnected() || !pending.empty(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    struct Pending {
+        Clock::time_point due;
+        std::vector<uint8_t> data;
+    };
+    
+    std::unique_ptr<Transport> inner;
+    Clock::duration delay;
+    std::deque<Pending> pending;    // Received, not yet due
+    std::vector<uint8_t> stamped;   // Message with its stamp, either way
+};
@@ -0,0 +1,280 @@
+#include "vector_env.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+// splitmix64: seeds the per-episode no-op count
+static uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint8_t grayOf(uint32_t pixel) {
+    uint32_t r = pixel & 0xFF;
+    uint32_t g = (pixel >> 8) & 0xFF;
+    uint32_t b = (pixel >> 16) & 0xFF;
+    return static_cast<uint8_t>((r * 77 + g * 150 + b * 29) >> 8);
+}
+
+VectorEnv::VectorEnv(int threads)
+    : runner(threads)
+    , format(OBSERVATION_GRAYSCALE)
+    , downsample(1)
+    , rewardTermCount(0)
+    , terminationRuleCount(0)
+    , rewardHook(nullptr)
+    , rewardUser(nullptr)
+    , maxEpisodeFrames(0)
+    , noopMax(0)
+    , autoReset(true)
+    , pendingSeeds(nullptr)
+    , pendingActions(nullptr)
+    , pendingFrameskip(1)
+    , pendingObservations(nullptr)
+    , pendingRewards(nullptr)
+    , pendingDones(nullptr)
+{
+    // Shades by nearest DMG palette gray, so colour games map sensibly too
+    for (int gray = 0; gray < 256; gray++) {
+        int best = 0;
+        for (int shade = 1; shade < 4; shade++) {
+            if (std::abs(gray - grayOf(PPU::COLORS[shade])) < std::abs(gray - grayOf(PPU::COLORS[best]))) {
+                best = shade;
+            }
+        }
+        shadeOfGray[gray] = static_cast<uint8_t>(best);
+    }
+    
+    // Built once so dispatching them never allocates
+    resetTask = [this](int env) { resetEnv(env); };
+    stepTask = [this](int env) { stepEnv(env); };
+}
+
+bool VectorEnv::loadROM(const uint8_t* data, size_t size, int envs) {
+    // Observations are read from each instance's framebuffer; step() and
+    // reset() decide per frame whether it is drawn
+    runner.setRendering(true);
+    if (envs < 1 || !runner.loadROM(data, size, envs)) return false;
+    
+    GameBoy& first = runner.getInstance(0);
+    startState.resize(first.getStateSize());
+    first.saveState(startState.data(), startState.size());
+    
+    episodes.assign(envs, Episode());
+    for (int env = 0; env < envs; env++) {
+        episodes[env].rng = static_cast<uint64_t>(env);
+    }
+    
+    // Size every lazily allocated buffer now (GameBoy::loadState keeps a
+    // backup copy) so the first reset does not allocate
+    reset(nullptr, nullptr);
+    return true;
+}
+
+bool VectorEnv::setStartState(const uint8_t* data, size_t size) {
+    if (getEnvCount() == 0) return false;
+    
+    // Validated on a throwaway fork so env 0 keeps its running episode. The
+    // fork took env 0's pages shared; they are made env 0's own again here,
+    // so its next reset() or step() does not copy them.
+    GameBoy& first = runner.getInstance(0);
+    bool valid = first.fork()->loadState(data, size);
+    first.getMMU().reservePages(std::allocator<uint8_t>());
+    if (!valid) return false;
+    startState.assign(data, data + size);
+    return true;
+}
+
+bool VectorEnv::setObservation(ObservationFormat observationFormat, int factor) {
+    if (factor != 1 && factor != 2 && factor != 4) return false;
+    format = observationFormat;
+    downsample = factor;
+    return true;
+}
+
+bool VectorEnv::addRewardTerm(const RewardTerm& term) {
+    if (rewardTermCount == MAX_REWARD_TERMS || (term.width != 1 && term.width != 2)) return false;
+    rewardTerms[rewardTermCount++] = term;
+    return true;
+}
+
+bool VectorEnv::addTerminationRule(const TerminationRule& rule) {
+    if (terminationRuleCount == MAX_TERMINATION_RULES || rule.compare > COMPARE_GREATER) return false;
+    terminationRules[terminationRuleCount++] = rule;
+    return true;
+}
+
+void VectorEnv::setRewardHook(RewardHook hook, void* user) {
+    rewardHook = hook;
+    rewardUser = user;
+}
+
+void VectorEnv::clearRules() {
+    rewardTermCount = 0;
+    terminationRuleCount = 0;
+    rewardHook = nullptr;
+    rewardUser = nullptr;
+}
+
+void VectorEnv::reset(const uint64_t* seeds, uint8_t* observations) {
+    pendingSeeds = seeds;
+    pendingObservations = observations;
+    runner.forEachInstance(resetTask);
+    pendingSeeds = nullptr;
+    pendingObservations = nullptr;
+}
+
+void VectorEnv::step(const uint8_t* actions, int frameskip, uint8_t* observations, float* rewards, uint8_t* dones) {
+    pendingActions = actions;
+    pendingFrameskip = std::max(1, frameskip);
+    pendingObservations = observations;
+    pendingRewards = rewards;
+    pendingDones = dones;
+    runner.forEachInstance(stepTask);
+    pendingActions = nullptr;
+    pendingObservations = nullptr;
+    pendingRewards = nullptr;
+    pendingDones = nullptr;
+}
+
+void VectorEnv::resetEnv(int env) {
+    GameBoy& gb = runner.getInstance(env);
+    Episode& episode = episodes[env];
+    if (pendingSeeds) {
+        episode.rng = pendingSeeds[env];
+    }
+    
+    gb.loadState(startState.data(), startState.size());
+    episode.held = 0xFF;
+    applyAction(env, 0);
+    episode.frames = 0;
+    
+    // The start state carries no picture, so at least one frame is run;
+    // only the last one is drawn
+    int frames = 1 + (noopMax > 0 ? static_cast<int>(nextRandom(episode.rng) % (noopMax + 1)) : 0);
+    for (int i = 0; i < frames; i++) {
+        gb.getPPU().setRenderingSkipped(i < frames - 1);
+        gb.runFrame();
+    }
+    gb.getPPU().setRenderingSkipped(true);
+    
+    sampleRewardValues(env);
+    writeObservation(env);
+}
+
+void VectorEnv::stepEnv(int env) {
+    GameBoy& gb = runner.getInstance(env);
+    Episode& episode = episodes[env];
+    
+    applyAction(env, pendingActions ? pendingActions[env] : 0);
+    for (int i = 0; i < pendingFrameskip; i++) {
+        gb.getPPU().setRenderingSkipped(i < pendingFrameskip - 1 || !pendingObservations);
+        gb.runFrame();
+    }
+    gb.getPPU().setRenderingSkipped(true);
+    episode.frames += pendingFrameskip;
+    
+    float reward = collectReward(env);
+    uint8_t done = 0;
+    if (isTerminal(env)) {
+        done |= DONE_TERMINATED;
+    }
+    if (maxEpisodeFrames > 0 && episode.frames >= maxEpisodeFrames) {
+        done |= DONE_TRUNCATED;
+    }
+    
+    if (pendingRewards) pendingRewards[env] = reward;
+    if (pendingDones) pendingDones[env] = done;
+    
+    if (done && autoReset) {
+        resetEnv(env);
+    } else {
+        writeObservation(env);
+    }
+}
+
+void VectorEnv::applyAction(int env, uint8_t action) {
+    // Only changes reach the joypad: repeating a press would raise its
+    // interrupt again
+    GameBoy& gb = runner.getInstance(env);
+    Episode& episode = episodes[env];
+    uint8_t changed = action ^ episode.held;
+    for (int button = 0; button < 8; button++) {
+        if (changed & (1 << button)) {
+            gb.setButton(button, (action >> button) & 1);
+        }
+    }
+    episode.held = action;
+}
+
+void VectorEnv::sampleRewardValues(int env) {
+    MMU& mmu = runner.getInstance(env).getMMU();
+    Episode& episode = episodes[env];
+    for (int i = 0; i < rewardTermCount; i++) {
+        const RewardTerm& term = rewardTerms[i];
+        int32_t value = mmu.peek(term.address);
+        if (term.width == 2) {
+            value |= mmu.peek(static_cast<uint16_t>(term.address + 1)) << 8;
+        }
+        episode.values[i] = value;
+    }
+}
+
+float VectorEnv::collectReward(int env) {
+    Episode& episode = episodes[env];
+    std::array<int32_t, MAX_REWARD_TERMS> before = episode.values;
+    sampleRewardValues(env);
+    
+    float reward = 0;
+    for (int i = 0; i < rewardTermCount; i++) {
+        reward += rewardTerms[i].weight * static_cast<float>(episode.values[i] - before[i]);
+    }
+    if (rewardHook) {
+        reward += rewardHook(runner.getInstance(env), env, rewardUser);
+    }
+    return reward;
+}
+
+bool VectorEnv::isTerminal(int env) {
+    MMU& mmu = runner.getInstance(env).getMMU();
+    for (int i = 0; i < terminationRuleCount; i++) {
+        const TerminationRule& rule = terminationRules[i];
+        uint8_t value = mmu.peek(rule.address) & rule.mask;
+        bool hit = false;
+        switch (rule.compare) {
+            case COMPARE_EQUAL:     hit = value == rule.value; break;
+            case COMPARE_NOT_EQUAL: hit = value != rule.value; break;
+            case COMPARE_LESS:      hit = value < rule.value; break;
+            case COMPARE_GREATER:   hit = value > rule.value; break;
+        }
+        if (hit) return true;
+    }
+    return false;
+}
+
+void VectorEnv::writeObservation(int env) {
+    if (!pendingObservations) return;
+    
+    const uint32_t* frame = runner.getInstance(env).getFramebuffer();
+    uint8_t* out = pendingObservations + env * getObservationSize();
+    const int width = getObservationWidth();
+    const int height = getObservationHeight();
+    const int shift = downsample == 4 ? 4 : downsample == 2 ? 2 : 0;  // log2(pixels per block)
+    
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            // Block average
+            uint32_t sum = 0;
+            for (int dy = 0; dy < downsample; dy++) {
+                const uint32_t* row = frame + (y * downsample + dy) * GameBoy::SCREEN_WIDTH + x * downsample;
+                for (int dx = 0; dx < downsample; dx++) {
+                    sum += grayOf(row[dx]);
+                }
+            }
+            uint8_t gray = static_cast<uint8_t>(sum >> shift);
+            *out++ = format == OBSERVATION_SHADES ? shadeOfGray[gray] : gray;
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <functional>
+#include <vector>
+
+#include "batch_runner.h"
+
+/**
+ * VectorEnv - Batched reinforcement-learning environment
+ *
+ * A batch of environments, each a headless GameBoy of the same ROM, stepped
+ * together on BatchRunner's thread pool. An action is a joypad bitmask (bit
+ * N = GameBoy::Button N held). Observations are the screen downsampled by
+ * 1, 2 or 4 and written as one byte per pixel, either 8-bit grayscale or
+ * shade index 0-3 (0 lightest), into buffers the caller owns.
+ *
+ * Rewards come from RAM: each reward term adds weight * (value after the
+ * step - value before) for a 1 or 2-byte little-endian value, and an
+ * optional hook adds an arbitrary amount. An episode terminates when any
+ * termination rule holds for a RAM byte, and is truncated after
+ * `maxEpisodeFrames` frames.
+ *
+ * reset() loads the start state (the power-on state unless set) and runs
+ * one frame plus a seed-chosen number of idle frames (0 to noopMax) so
+ * episodes do not all start identically. With auto-reset a finished environment is reset
+ * within the same step and its observation is the new episode's first.
+ *
+ * Once configured, reset() and step() allocate nothing.
+ */
+class VectorEnv {
+public:
+    enum ObservationFormat {
+        OBSERVATION_SHADES = 0,     // 0-3, 0 = lightest
+        OBSERVATION_GRAYSCALE = 1   // 0-255, 255 = white
+    };
+    
+    enum Compare {
+        COMPARE_EQUAL = 0,
+        COMPARE_NOT_EQUAL = 1,
+        COMPARE_LESS = 2,
+        COMPARE_GREATER = 3
+    };
+    
+    // Bits of a `dones` entry
+    static constexpr uint8_t DONE_TERMINATED = 1;
+    static constexpr uint8_t DONE_TRUNCATED = 2;
+    
+    struct RewardTerm {
+        uint16_t address;
+        uint8_t width;      // 1 or 2 bytes, little-endian
+        float weight;
+    };
+    
+    // Done when (byte at address & mask) compares to value
+    struct TerminationRule {
+        uint16_t address;
+        uint8_t mask;
+        uint8_t compare;    // Compare
+        uint8_t value;
+    };
+    
+    // Extra reward for `env` after a step; runs on pool threads, one call
+    // per environment at a time
+    using RewardHook = float (*)(GameBoy& gb, int env, void* user);
+    
+    static constexpr int MAX_REWARD_TERMS = 16;
+    static constexpr int MAX_TERMINATION_RULES = 16;
+    
+    // `threads` as for BatchRunner
+    explicit VectorEnv(int threads = 0);
+    
+    bool loadROM(const uint8_t* data, size_t size, int envs);
+    int getEnvCount() const { return runner.getInstanceCount(); }
+    GameBoy& getEnv(int env) { return runner.getInstance(env); }
+    
+    // State every episode starts from; false if it does not load
+    bool setStartState(const uint8_t* data, size_t size);
+    
+    bool setObservation(ObservationFormat format, int downsample);
+    int getObservationWidth() const { return GameBoy::SCREEN_WIDTH / downsample; }
+    int getObservationHeight() const { return GameBoy::SCREEN_HEIGHT / downsample; }
+    size_t getObservationSize() const { return static_cast<size_t>(getObservationWidth()) * getObservationHeight(); }
+    
+    bool addRewardTerm(const RewardTerm& term);
+    bool addTerminationRule(const TerminationRule& rule);
+    void setRewardHook(RewardHook hook, void* user);
+    void clearRules();
+    
+    void setMaxEpisodeFrames(uint32_t frames) { maxEpisodeFrames = frames; }
+    void setNoopMax(int frames) { noopMax = frames < 0 ? 0 : frames; }
+    void setAutoReset(bool enabled) { autoReset = enabled; }
+    
+    // Reset every environment; `seeds` (one per environment) may be null to
+    // continue each environment's own sequence. `observations` (envs x
+    // getObservationSize() bytes) may be null.
+    void reset(const uint64_t* seeds, uint8_t* observations);
+    
+    // Hold `actions[env]` for `frameskip` frames (only the last is drawn),
+    // then write the observations, the summed rewards and the done flags.
+    // Any output may be null.
+    void step(const uint8_t* actions, int frameskip, uint8_t* observations, float* rewards, uint8_t* dones);
+
+private:
+    struct alignas(64) Episode {
+        uint64_t rng;
+        uint32_t frames;
+        uint8_t held;       // Action currently applied
+        std::array<int32_t, MAX_REWARD_TERMS> values;
+    };
+    
+    BatchRunner runner;
+    std::vector<Episode> episodes;
+    std::vector<uint8_t> startState;
+    
+    ObservationFormat format;
+    int downsample;
+    std::array<uint8_t, 256> shadeOfGray;
+    
+    std::array<RewardTerm, MAX_REWARD_TERMS> rewardTerms;
+    int rewardTermCount;
+    std::array<TerminationRule, MAX_TERMINATION_RULES> terminationRules;
+    int terminationRuleCount;
+    RewardHook rewardHook;
+    void* rewardUser;
+    
+    uint32_t maxEpisodeFrames;
+    int noopMax;
+    bool autoReset;
+    
+    // Arguments of the reset/step in progress, read by the pool tasks
+    const uint64_t* pendingSeeds;
+    const uint8_t* pendingActions;
+    int pendingFrameskip;
+    uint8_t* pendingObservations;
+    float* pendingRewards;
+    uint8_t* pendingDones;
+    std::function<void(int)> resetTask;
+    std::function<void(int)> stepTask;
+    
+    void resetEnv(int env);
+    void stepEnv(int env);
+    void applyAction(int env, uint8_t action);
+    void sampleRewardValues(int env);
+    float collectReward(int env);
+    bool isTerminal(int env);
+    void writeObservation(int env);
+};
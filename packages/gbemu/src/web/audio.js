@@ -9,6 +9,69 @@ let audioReadPos = 0;
 let isMuted = false;
 let menuAudioContext = null;
 let speakerElement = null;
+let audioRing = null;
+
+// Header words of the APU's AudioRing (see src/core/audio_ring.h)
+const RING_CAPACITY = 2;
+const RING_FORMAT = 3;
+const RING_HEADER_BYTES = 32;
+
+// Views of an AudioRing at byteOffset in a SharedArrayBuffer (the heap of
+// the pthreads build)
+function openAudioRing(buffer, byteOffset) {
+	const header = new Int32Array(buffer, byteOffset, RING_HEADER_BYTES / 4);
+	const capacity = header[RING_CAPACITY];
+	const int16 = header[RING_FORMAT] === 1;
+	const samplesOffset = byteOffset + RING_HEADER_BYTES;
+	return {
+		header,
+		mask: capacity - 1,
+		samples: int16
+			? new Int16Array(buffer, samplesOffset, capacity * 2)
+			: new Float32Array(buffer, samplesOffset, capacity * 2),
+		scale: int16 ? 1 / 32768 : 1,
+		lastLeft: 0,
+		lastRight: 0
+	};
+}
+
+// Consumer side of the ring, reading the emulator's samples in place. Frames
+// that are not there yet fade out and are counted as underruns. Also runs
+// inside the worklet (injected as source), so it must stay self-contained:
+// header words 0/1/5/6 are writePos/readPos/underruns/discardPos.
+function readAudioRing(ring, left, right) {
+	const header = ring.header;
+
+	// Frames before discardPos were dropped by the emulator (reset, ROM load)
+	let readPos = Atomics.load(header, 1);
+	const discardPos = Atomics.load(header, 6);
+	if (((discardPos - readPos) | 0) > 0) {
+		readPos = discardPos;
+		Atomics.store(header, 1, readPos);
+	}
+	const writePos = Atomics.load(header, 0);
+	const frames = Math.min(left.length, (writePos - readPos) >>> 0);
+
+	for (let i = 0; i < frames; i++) {
+		const index = ((readPos + i) & ring.mask) * 2;
+		left[i] = ring.samples[index] * ring.scale;
+		right[i] = ring.samples[index + 1] * ring.scale;
+	}
+	if (frames > 0) {
+		ring.lastLeft = left[frames - 1];
+		ring.lastRight = right[frames - 1];
+		Atomics.store(header, 1, (readPos + frames) | 0);
+	}
+	if (frames < left.length) {
+		for (let i = frames; i < left.length; i++) {
+			ring.lastLeft *= 0.95;
+			ring.lastRight *= 0.95;
+			left[i] = ring.lastLeft;
+			right[i] = ring.lastRight;
+		}
+		Atomics.add(header, 5, left.length - frames);
+	}
+}
 
 export function setSpeakerElement(element) {
 	speakerElement = element;
@@ -26,6 +89,19 @@ export function getAudioWorkletNode() {
 	return audioWorkletNode;
 }
 
+// Play straight from the APU's output ring (emu.getAudioRing() in the pthreads
+// build, where the heap is a SharedArrayBuffer) instead of the copied samples
+export function setAudioRing(buffer, byteOffset) {
+	audioRing = { buffer, byteOffset, reader: openAudioRing(buffer, byteOffset) };
+	if (audioWorkletNode) {
+		audioWorkletNode.port.postMessage({ type: 'set-ring', buffer, byteOffset });
+	}
+}
+
+export function isUsingAudioRing() {
+	return audioRing !== null;
+}
+
 export async function initAudioWorkerMode(sharedAudioSAB, sharedControlSAB) {
 	if (audioContext) return;
 
@@ -41,9 +117,16 @@ export async function initAudioWorkerMode(sharedAudioSAB, sharedControlSAB) {
 		if (audioContext.audioWorklet) {
 			try {
 				const workletCode = `
+					const RING_HEADER_BYTES = ${RING_HEADER_BYTES};
+					const RING_CAPACITY = ${RING_CAPACITY};
+					const RING_FORMAT = ${RING_FORMAT};
+					${openAudioRing.toString()}
+					${readAudioRing.toString()}
+					
 					class GBAudioProcessor extends AudioWorkletProcessor {
 						constructor(options) {
 							super();
+							this.ring = null;
 							this.sharedAudio = null;
 							this.sharedControl = null;
 							this.readPos = 0;
@@ -59,7 +142,12 @@ export async function initAudioWorkerMode(sharedAudioSAB, sharedControlSAB) {
 									this.readPos = 0;
 									this.lastLeft = 0;
 									this.lastRight = 0;
+								} else if (e.data.type === 'set-ring') {
+									this.ring = openAudioRing(e.data.buffer, e.data.byteOffset);
 								} else if (e.data.type === 'reset') {
+									if (this.ring) {
+										Atomics.store(this.ring.header, 1, Atomics.load(this.ring.header, 0));
+									}
 									this.readPos = 0;
 									this.lastLeft = 0;
 									this.lastRight = 0;
@@ -68,11 +156,16 @@ export async function initAudioWorkerMode(sharedAudioSAB, sharedControlSAB) {
 						}
 						
 						process(inputs, outputs, parameters) {
-							if (!this.sharedAudio || !this.sharedControl) return true;
-							
 							const output = outputs[0];
 							const left = output[0];
 							const right = output[1] || left;
+							
+							if (this.ring) {
+								readAudioRing(this.ring, left, right);
+								return true;
+							}
+							if (!this.sharedAudio || !this.sharedControl) return true;
+							
 							const writePos = Atomics.load(this.sharedControl, this.ctrlAudioWritePos);
 							
 							for (let i = 0; i < left.length; i++) {
@@ -110,6 +203,13 @@ export async function initAudioWorkerMode(sharedAudioSAB, sharedControlSAB) {
 					audio: sharedAudioSAB,
 					control: sharedControlSAB
 				});
+				if (audioRing) {
+					audioWorkletNode.port.postMessage({
+						type: 'set-ring',
+						buffer: audioRing.buffer,
+						byteOffset: audioRing.byteOffset
+					});
+				}
 				audioWorkletNode.connect(audioContext.destination);
 				audioEnabled = true;
 				return;
@@ -119,6 +219,14 @@ export async function initAudioWorkerMode(sharedAudioSAB, sharedControlSAB) {
 		const bufferSize = 2048;
 		scriptProcessorNode = audioContext.createScriptProcessor(bufferSize, 0, 2);
 		scriptProcessorNode.onaudioprocess = (event) => {
+			if (audioRing && audioEnabled) {
+				readAudioRing(
+					audioRing.reader,
+					event.outputBuffer.getChannelData(0),
+					event.outputBuffer.getChannelData(1)
+				);
+				return;
+			}
 			if (!sharedAudio || !sharedControl || !audioEnabled) {
 				event.outputBuffer.getChannelData(0).fill(0);
 				event.outputBuffer.getChannelData(1).fill(0);
@@ -270,12 +378,9 @@ export function sendAudioSamples(emu) {
 
 	const sampleCount = emu.getAudioSamplesCount();
 	if (sampleCount > 0) {
-		const audioBuffer = emu.getAudioBuffer();
-		const samples = new Float32Array(sampleCount * 2);
-		for (let i = 0; i < sampleCount * 2; i++) {
-			samples[i] = audioBuffer[i];
-		}
-		audioWorkletNode.port.postMessage(samples);
+		// One copy out of the heap, then transferred rather than cloned
+		const samples = emu.getAudioBuffer().slice(0, sampleCount * 2);
+		audioWorkletNode.port.postMessage(samples, [samples.buffer]);
 	}
 }
 
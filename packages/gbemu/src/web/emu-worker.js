@@ -13,6 +13,7 @@ let currentBuffer = 0;
 const FB_SIZE = 160 * 144;
 
 let audioWritePos = 0;
+let audioRingShared = false;
 const AUDIO_BUFFER_SIZE = 16384;
 
 const CTRL_RUNNING = 0;
@@ -59,6 +60,7 @@ function loadROM(romData) {
 	emu.HEAPU8.set(data, ptr);
 
 	if (emu.loadROMFromBuffer(size)) {
+		publishAudioRing();
 		postMessage({ type: 'rom-loaded', size: size });
 		return true;
 	} else {
@@ -67,6 +69,18 @@ function loadROM(romData) {
 	}
 }
 
+// In the pthreads build the WASM heap is a SharedArrayBuffer, so the audio
+// worklet can read the APU's output ring in place; no per-frame copy needed.
+// The ring's address is fixed, so the view survives memory growth.
+function publishAudioRing() {
+	const ring = emu.getAudioRing();
+	audioRingShared = !!ring && typeof SharedArrayBuffer !== 'undefined' &&
+		ring.buffer instanceof SharedArrayBuffer;
+	if (audioRingShared) {
+		postMessage({ type: 'audio-ring', buffer: ring.buffer, byteOffset: ring.byteOffset });
+	}
+}
+
 function emulationLoop() {
 	if (!running || !emu) return;
 
@@ -101,15 +115,20 @@ function emulationLoop() {
 			currentBuffer = 1 - currentBuffer;
 		}
 
-		if (sharedAudio) {
+		if (sharedAudio && !audioRingShared) {
 			const sampleCount = emu.getAudioSamplesCount();
 			if (sampleCount > 0) {
 				const audioBuffer = emu.getAudioBuffer();
 				const samplesToWrite = sampleCount * 2;
 
-				for (let i = 0; i < samplesToWrite; i++) {
-					sharedAudio[audioWritePos] = audioBuffer[i];
-					audioWritePos = (audioWritePos + 1) % AUDIO_BUFFER_SIZE;
+				const remaining = AUDIO_BUFFER_SIZE - audioWritePos;
+				if (samplesToWrite <= remaining) {
+					sharedAudio.set(audioBuffer.subarray(0, samplesToWrite), audioWritePos);
+					audioWritePos = (audioWritePos + samplesToWrite) % AUDIO_BUFFER_SIZE;
+				} else {
+					sharedAudio.set(audioBuffer.subarray(0, remaining), audioWritePos);
+					sharedAudio.set(audioBuffer.subarray(remaining, samplesToWrite), 0);
+					audioWritePos = samplesToWrite - remaining;
 				}
 
 				Atomics.store(sharedControl, CTRL_AUDIO_WRITE_POS, audioWritePos);
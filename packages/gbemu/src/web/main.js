@@ -208,6 +208,10 @@ function handleWorkerMessageOffscreen(e) {
 			statusDisplay.textContent = 'Ready';
 			break;
 
+		case 'audio-ring':
+			Audio.setAudioRing(data.buffer, data.byteOffset);
+			break;
+
 		case 'rom-loaded':
 			resetBtn.disabled = false;
 			powerLed.classList.add('on');
@@ -335,6 +339,10 @@ function handleWorkerMessage(e) {
 		case 'shared-memory-ready':
 			break;
 
+		case 'audio-ring':
+			Audio.setAudioRing(data.buffer, data.byteOffset);
+			break;
+
 		case 'rom-loaded':
 			resetBtn.disabled = false;
 			powerLed.classList.add('on');
@@ -16,6 +16,7 @@ let currentBuffer = 0;
 const FB_SIZE = 160 * 144;
 
 let audioWritePos = 0;
+let audioRingShared = false;
 const AUDIO_BUFFER_SIZE = 16384;
 
 const CTRL_RUNNING = 0;
@@ -62,6 +63,7 @@ function loadROM(romData) {
 	emu.HEAPU8.set(data, ptr);
 
 	if (emu.loadROMFromBuffer(size)) {
+		publishAudioRing();
 		postMessage({ type: 'rom-loaded', size: size });
 		return true;
 	} else {
@@ -70,6 +72,18 @@ function loadROM(romData) {
 	}
 }
 
+// In the pthreads build the WASM heap is a SharedArrayBuffer, so the audio
+// worklet can read the APU's output ring in place; no per-frame copy needed.
+// The ring's address is fixed, so the view survives memory growth.
+function publishAudioRing() {
+	const ring = emu.getAudioRing();
+	audioRingShared = !!ring && typeof SharedArrayBuffer !== 'undefined' &&
+		ring.buffer instanceof SharedArrayBuffer;
+	if (audioRingShared) {
+		postMessage({ type: 'audio-ring', buffer: ring.buffer, byteOffset: ring.byteOffset });
+	}
+}
+
 function emulationLoop() {
 	if (!running || !emu) return;
 
@@ -94,7 +108,7 @@ function emulationLoop() {
 		emu.runFrame();
 		totalFramesRun++;
 
-		if (sharedAudio) {
+		if (sharedAudio && !audioRingShared) {
 			const sampleCount = emu.getAudioSamplesCount();
 			if (sampleCount > 0) {
 				const audioBuffer = emu.getAudioBuffer();